@@ -0,0 +1,212 @@
+/***** AnalysisCache.cpp *****/
+#include "AnalysisCache.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Layout of the cache files: a 64 byte header followed by numFrames * (nFft / 2 + 1) complex bins
+const char ANALYSIS_CACHE_MAGIC[8] = "PAGSTFT";
+const unsigned int ANALYSIS_CACHE_VERSION = 1;
+const int ANALYSIS_CACHE_HEADER_SIZE = 64;
+
+// Window used for the analysis (the same Hann window render.cpp uses for the grain source FFT)
+const int ANALYSIS_WINDOW_HANN = 0;
+
+struct AnalysisCacheHeader {
+	char magic[8];
+	unsigned int version;
+	int nFft;
+	int hopSize;
+	int window;
+	int bins;
+	int numFrames;
+	unsigned long long contentHash;
+	char reserved[ANALYSIS_CACHE_HEADER_SIZE - 40];
+};
+static_assert(sizeof(AnalysisCacheHeader) == ANALYSIS_CACHE_HEADER_SIZE, "Analysis cache header must be 64 bytes");
+
+AnalysisCache::AnalysisCache()
+	: ready (false) {
+}
+
+bool AnalysisCache::open(const string& path, unsigned long long contentHash, const QualityTier& quality){
+	close();
+	return mapFile(path, contentHash, quality);
+}
+
+bool AnalysisCache::build(const string& path, const SampleData& data, unsigned long long contentHash, const QualityTier& quality){
+	close();
+	int fftSize = quality.fftSize;
+	int hopSize = quality.hopSize;
+	int frameBins = quality.numBins();
+	int frameCount = (data.sampleLen + hopSize - 1) / hopSize;
+
+	// Write to a temporary file first so that an interrupted build never leaves a valid looking cache
+	string temporaryPath = path + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if(file == nullptr){
+		cout << "Couldn't create analysis cache " << temporaryPath << endl;
+		return false;
+	}
+
+	AnalysisCacheHeader header = {};
+	memcpy(header.magic, ANALYSIS_CACHE_MAGIC, sizeof(header.magic));
+	header.version = ANALYSIS_CACHE_VERSION;
+	header.nFft = fftSize;
+	header.hopSize = hopSize;
+	header.window = ANALYSIS_WINDOW_HANN;
+	header.bins = frameBins;
+	header.numFrames = frameCount;
+	header.contentHash = contentHash;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	// Same analysis as processGrainSrcBufferUpdate() in render.cpp
+	vector<float> window(fftSize);
+	for(int n = 0; n < fftSize; n++) {
+		window[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(fftSize - 1)));
+	}
+	ne10_fft_cfg_float32_t cfg = ne10_fft_alloc_c2c_float32_neon (fftSize);
+	ne10_fft_cpx_float32_t* timeDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t));
+	ne10_fft_cpx_float32_t* frequencyDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t));
+
+	for(int frame = 0; ok && frame < frameCount; frame++){
+		int start = frame * hopSize;
+		for(int n = 0; n < fftSize; n++){
+			float sample = start + n < data.sampleLen ? data.samples[start + n] : 0.0f;
+			timeDomain[n].r = sample * window[n];
+			timeDomain[n].i = 0.0f;
+		}
+		ne10_fft_c2c_1d_float32_neon (frequencyDomain, timeDomain, cfg, 0);
+		ok = fwrite(frequencyDomain, sizeof(ne10_fft_cpx_float32_t), frameBins, file) == (size_t)frameBins;
+	}
+
+	NE10_FREE(cfg);
+	NE10_FREE(timeDomain);
+	NE10_FREE(frequencyDomain);
+
+	ok = fclose(file) == 0 && ok;
+	if(!ok || rename(temporaryPath.c_str(), path.c_str()) != 0){
+		cout << "Couldn't write analysis cache " << path << endl;
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+	return mapFile(path, contentHash, quality);
+}
+
+bool AnalysisCache::mapFile(const string& path, unsigned long long hash, const QualityTier& quality){
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size < ANALYSIS_CACHE_HEADER_SIZE){
+		::close(fd);
+		return false;
+	}
+	void* fileMapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the file open
+	::close(fd);
+	if(fileMapping == MAP_FAILED)
+		return false;
+
+	// Everything has to match, including the size (a truncated file is never used)
+	const AnalysisCacheHeader* header = (const AnalysisCacheHeader*) fileMapping;
+	size_t expectedSize = ANALYSIS_CACHE_HEADER_SIZE + (size_t)header->numFrames * quality.numBins() * sizeof(ne10_fft_cpx_float32_t);
+	bool valid = memcmp(header->magic, ANALYSIS_CACHE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == ANALYSIS_CACHE_VERSION
+		&& header->nFft == quality.fftSize
+		&& header->hopSize == quality.hopSize
+		&& header->window == ANALYSIS_WINDOW_HANN
+		&& header->bins == quality.numBins()
+		&& header->contentHash == hash
+		&& (size_t)info.st_size == expectedSize;
+	if(!valid){
+		munmap(fileMapping, info.st_size);
+		return false;
+	}
+
+	mapping = fileMapping;
+	mappingLength = info.st_size;
+	numFrames = header->numFrames;
+	bins = header->bins;
+	frames = (const ne10_fft_cpx_float32_t*)((const char*)fileMapping + ANALYSIS_CACHE_HEADER_SIZE);
+	ready.store(true, memory_order_release);
+	return true;
+}
+
+bool AnalysisCache::isReady(){
+	return ready.load(memory_order_acquire);
+}
+
+int AnalysisCache::getNumFrames(){
+	return numFrames;
+}
+
+int AnalysisCache::getNumBins(){
+	return bins;
+}
+
+ne10_fft_cpx_float32_t AnalysisCache::getBin(int frame, int bin){
+	ne10_fft_cpx_float32_t value = {0.0f, 0.0f};
+	if(frame < 0 || frame >= numFrames)
+		return value;
+	const ne10_fft_cpx_float32_t* stored = frames + (size_t)frame * bins;
+	if(bin < bins)
+		return stored[bin];
+	// Negative bins are the complex conjugates of the stored ones
+	value.r = stored[2 * (bins - 1) - bin].r;
+	value.i = -stored[2 * (bins - 1) - bin].i;
+	return value;
+}
+
+void AnalysisCache::fill(GrainSource& source, int firstFrame, int hop, ne10_fft_cpx_float32_t* spectrum){
+	int fftSize = source.getQuality().fftSize;
+	int frame = firstFrame + hop;
+	if(frame < 0 || frame >= numFrames){
+		memset(spectrum, 0, fftSize * sizeof(ne10_fft_cpx_float32_t));
+	} else {
+		// Non-negative bins straight from the file, negative bins are their complex conjugates
+		const ne10_fft_cpx_float32_t* stored = frames + (size_t)frame * bins;
+		memcpy(spectrum, stored, bins * sizeof(ne10_fft_cpx_float32_t));
+		for(int k = 1; k < fftSize / 2; k++){
+			spectrum[fftSize - k].r = stored[k].r;
+			spectrum[fftSize - k].i = -stored[k].i;
+		}
+	}
+	source.writeFrame(hop, spectrum);
+}
+
+void AnalysisCache::close(){
+	ready = false;
+	if(mapping != nullptr)
+		munmap(mapping, mappingLength);
+	mapping = nullptr;
+	mappingLength = 0;
+	frames = nullptr;
+	numFrames = 0;
+	bins = 0;
+}
+
+unsigned long long AnalysisCache::hashSamples(const SampleData& data){
+	// FNV-1a over the 32 bit sample words plus the length
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned int* words = (const unsigned int*) data.samples;
+	for(int i = 0; i < data.sampleLen; i++){
+		hash ^= words[i];
+		hash *= 1099511628211ULL;
+	}
+	hash ^= (unsigned long long) data.sampleLen;
+	hash *= 1099511628211ULL;
+	return hash;
+}
+
+AnalysisCache::~AnalysisCache(){
+	close();
+}
@@ -0,0 +1,73 @@
+/*****
+ * AnalysisCache.h
+ * Persistent STFT of a whole song, stored next to the decoded song in the song cache directory
+ *
+ * The file holds the hop-aligned frames (frame f starts at sample f * hopSize) of the song.
+ * Only the fftSize / 2 + 1 non-negative bins are stored, the others follow from the symmetry of
+ * the spectrum of a real signal. The header records a content hash of the samples and the
+ * analysis parameters (quality tier, window), so a cache built for other material or
+ * other settings is never used. Valid caches are memory-mapped read-only, which makes a
+ * source position change a copy of sourceHops frames instead of as many FFTs
+*****/
+#ifndef ANALYSIS_CACHE_H
+#define ANALYSIS_CACHE_H
+
+#include <string>
+#include <atomic>
+#include <libraries/ne10/NE10.h>
+#include "Constants.h"
+#include "SampleData.h"
+#include "GrainSource.h"
+
+class AnalysisCache {
+	public:
+		AnalysisCache();
+		~AnalysisCache();
+
+		// Map the cache file at path if it exists and matches the content hash of the samples and the quality tier
+		// Returns false if the cache has to be (re)built
+		bool open(const std::string& path, unsigned long long contentHash, const QualityTier& quality);
+
+		// Analyse the samples with the given quality tier, write the cache file to path (recording their content hash) and map it
+		// Takes as long as one FFT per hop of the song, so it is called from a background task
+		bool build(const std::string& path, const SampleData& data, unsigned long long contentHash, const QualityTier& quality);
+
+		// Content hash of samples, computed once when a song is decoded (it reads every sample)
+		static unsigned long long hashSamples(const SampleData& data);
+
+		// Whether the frames can be read
+		bool isReady();
+
+		// Number of frames in the cache
+		int getNumFrames();
+		// Number of bins stored per frame (fftSize / 2 + 1 of the tier the cache was opened with)
+		int getNumBins();
+
+		// Value of any bin (0 ... fftSize - 1) of a frame, zero for frames past the end of the song
+		ne10_fft_cpx_float32_t getBin(int frame, int bin);
+
+		// Copy frame firstFrame + hop into the given hop of the grain source (frames past the end of the song are zero)
+		// spectrum is a scratch buffer of fftSize bins, so different hops can be filled on several threads
+		// The grain source has to use the FFT size the cache was opened with
+		void fill(GrainSource& source, int firstFrame, int hop, ne10_fft_cpx_float32_t* spectrum);
+
+		// Unmap the cache file
+		void close();
+
+	private:
+		// Start and length of the mapping
+		void* mapping = nullptr;
+		size_t mappingLength = 0;
+		// Frames inside the mapping (numFrames * bins bins)
+		const ne10_fft_cpx_float32_t* frames = nullptr;
+		int numFrames = 0;
+		// Number of bins stored per frame (fftSize / 2 + 1)
+		int bins = 0;
+		// Set once the mapping can be read
+		std::atomic<bool> ready;
+
+		// Map the file at path if its header matches the given hash and quality tier
+		bool mapFile(const std::string& path, unsigned long long hash, const QualityTier& quality);
+};
+
+#endif
@@ -0,0 +1,163 @@
+/***** CompactBuffer.cpp *****/
+#include "CompactBuffer.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COMPACT_BUFFER_NEON
+// Half precision conversion instructions (-mfpu=neon-fp16)
+#if defined(__ARM_FP) && (__ARM_FP & 2)
+#define COMPACT_BUFFER_NEON_FP16
+#endif
+#endif
+
+uint16_t floatToHalf(float value){
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t biasedExponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+	// Infinity and NaN
+	if(biasedExponent == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	int exponent = int(biasedExponent) - 127 + 15;
+	// Too large: infinity
+	if(exponent >= 31)
+		return sign | 0x7c00;
+	// Subnormal or zero
+	if(exponent <= 0){
+		if(exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if(remainder > halfway || (remainder == halfway && (half & 1)))
+			half++;
+		return sign | half;
+	}
+	// A carry out of the mantissa correctly rounds up into the exponent
+	uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1fff;
+	if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return sign | half;
+}
+
+void CompactBuffer::allocate(int length, SampleFormat format){
+	this->length = length;
+	this->format = format;
+	floats.clear();
+	halves.clear();
+	ints.clear();
+	scales.clear();
+	switch(format){
+		case SAMPLE_FORMAT_FLOAT16:
+			halves.assign(length, 0);
+			break;
+		case SAMPLE_FORMAT_INT16:
+			ints.assign(length, 0);
+			scales.assign((length + COMPACT_BLOCK_SIZE - 1) / COMPACT_BLOCK_SIZE, 0.0f);
+			break;
+		default:
+			floats.assign(length, 0.0f);
+			break;
+	}
+}
+
+int CompactBuffer::getLength(){
+	return length;
+}
+
+SampleFormat CompactBuffer::getFormat(){
+	return format;
+}
+
+void CompactBuffer::store(int begin, const float* samples, int count){
+	count = std::min(count, length - begin);
+	if(count <= 0)
+		return;
+	switch(format){
+		case SAMPLE_FORMAT_FLOAT16:
+			for(int i = 0; i < count; i++){
+				halves[begin + i] = floatToHalf(samples[i]);
+			}
+			break;
+		case SAMPLE_FORMAT_INT16:
+			// Every block uses the full int16 range for its peak
+			for(int blockStart = 0; blockStart < count; blockStart += COMPACT_BLOCK_SIZE){
+				int blockEnd = std::min(blockStart + COMPACT_BLOCK_SIZE, count);
+				float peak = 0.0f;
+				for(int i = blockStart; i < blockEnd; i++){
+					peak = fmaxf(peak, fabsf(samples[i]));
+				}
+				float scale = peak / 32767.0f;
+				float inverse = peak > 0.0f ? 1.0f / scale : 0.0f;
+				for(int i = blockStart; i < blockEnd; i++){
+					ints[begin + i] = int16_t(lrintf(samples[i] * inverse));
+				}
+				scales[(begin + blockStart) / COMPACT_BLOCK_SIZE] = scale;
+			}
+			break;
+		default:
+			std::copy(samples, samples + count, floats.begin() + begin);
+			break;
+	}
+}
+
+void CompactBuffer::loadWindowed(int begin, const float* gains, float* destination, int count){
+	int n = 0;
+	switch(format){
+		case SAMPLE_FORMAT_FLOAT16: {
+			const uint16_t* source = halves.data() + begin;
+#ifdef COMPACT_BUFFER_NEON_FP16
+			for(; n + 4 <= count; n += 4){
+				float32x4_t x = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(source + n)));
+				vst1q_f32(destination + n, vmulq_f32(x, vld1q_f32(gains + n)));
+			}
+#endif
+			for(; n < count; n++){
+				destination[n] = halfToFloat(source[n]) * gains[n];
+			}
+			break;
+		}
+		case SAMPLE_FORMAT_INT16: {
+			// Runs of samples within one block share the scale
+			while(n < count){
+				int index = begin + n;
+				int runEnd = std::min(count, n + COMPACT_BLOCK_SIZE - index % COMPACT_BLOCK_SIZE);
+				float scale = scales[index / COMPACT_BLOCK_SIZE];
+				const int16_t* source = ints.data() + begin;
+#ifdef COMPACT_BUFFER_NEON
+				float32x4_t scale4 = vdupq_n_f32(scale);
+				for(; n + 4 <= runEnd; n += 4){
+					float32x4_t x = vcvtq_f32_s32(vmovl_s16(vld1_s16(source + n)));
+					vst1q_f32(destination + n, vmulq_f32(vmulq_f32(x, scale4), vld1q_f32(gains + n)));
+				}
+#endif
+				for(; n < runEnd; n++){
+					destination[n] = source[n] * scale * gains[n];
+				}
+			}
+			break;
+		}
+		default: {
+			const float* source = floats.data() + begin;
+#ifdef COMPACT_BUFFER_NEON
+			for(; n + 4 <= count; n += 4){
+				vst1q_f32(destination + n, vmulq_f32(vld1q_f32(source + n), vld1q_f32(gains + n)));
+			}
+#endif
+			for(; n < count; n++){
+				destination[n] = source[n] * gains[n];
+			}
+			break;
+		}
+	}
+}
+
+int CompactBuffer::getMemoryUsage(){
+	return floats.capacity() * sizeof(float) + halves.capacity() * sizeof(uint16_t)
+		+ ints.capacity() * sizeof(int16_t) + scales.capacity() * sizeof(float);
+}
@@ -0,0 +1,84 @@
+/*****
+ * CompactBuffer.h
+ * Sample buffer stored as float32, IEEE half precision or block-scaled int16
+ *
+ * Voices keep their resynthesised buffer here in the compact formats, so the grains of all voices
+ * stream half the memory. Samples are written once they are final (store() of whole blocks)
+ * and decoded while the grains are mixed: one at a time with get() or a chunk at a time,
+ * fused with the grain window, with the vectorised loadWindowed()
+*****/
+#ifndef COMPACT_BUFFER_H
+#define COMPACT_BUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "Constants.h"
+
+// Number of samples the leading grain of a voice decodes (and windows) at once
+const int COMPACT_DECODE_CHUNK = 64;
+
+// IEEE half precision conversion (round to nearest even)
+uint16_t floatToHalf(float value);
+inline float halfToFloat(uint16_t half){
+	uint32_t sign = uint32_t(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits;
+	if(exponent == 0){
+		// Zero and subnormals: mantissa * 2^-24
+		float value = mantissa * 5.9604645e-8f;
+		return sign ? -value : value;
+	} else if(exponent == 31){
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	} else {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+class CompactBuffer {
+	public:
+		// Allocate length samples (all zero) in the given format
+		void allocate(int length, SampleFormat format);
+
+		int getLength();
+		SampleFormat getFormat();
+
+		// Encode count samples to the positions from begin on
+		// With SAMPLE_FORMAT_INT16 begin has to be a multiple of COMPACT_BLOCK_SIZE and the blocks
+		// are scaled to the samples of this call
+		void store(int begin, const float* samples, int count);
+
+		// Decode the sample at index
+		inline float get(int index){
+			switch(format){
+				case SAMPLE_FORMAT_FLOAT16:
+					return halfToFloat(halves[index]);
+				case SAMPLE_FORMAT_INT16:
+					return ints[index] * scales[index / COMPACT_BLOCK_SIZE];
+				default:
+					return floats[index];
+			}
+		}
+
+		// destination[i] = sample(begin + i) * gains[i] for i < count (NEON where available)
+		void loadWindowed(int begin, const float* gains, float* destination, int count);
+
+		// Bytes held by the samples and scales
+		int getMemoryUsage();
+
+	private:
+		SampleFormat format = SAMPLE_FORMAT_FLOAT32;
+		int length = 0;
+		// Only the vector of the format is allocated
+		std::vector<float> floats;
+		std::vector<uint16_t> halves;
+		std::vector<int16_t> ints;
+		// One scale per COMPACT_BLOCK_SIZE samples (SAMPLE_FORMAT_INT16)
+		std::vector<float> scales;
+};
+
+#endif
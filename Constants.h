@@ -8,27 +8,115 @@
 // Buffer length for the main output buffer
 const int MAIN_BUFFER_LENGTH = 16384;
 
-// FFT params
-const int N_FFT = 4096;
-const int FFT_HOP_SIZE = 1024;
+// Storage of the voice buffers and of the bin-major view of the grain sources
+// The compact formats halve the memory the voices stream through (see CompactBuffer)
+enum SampleFormat {
+	SAMPLE_FORMAT_FLOAT32 = 0,
+	// IEEE half precision
+	SAMPLE_FORMAT_FLOAT16,
+	// int16 with one float scale per COMPACT_BLOCK_SIZE samples (the spectra use half precision)
+	SAMPLE_FORMAT_INT16
+};
+const char* const SAMPLE_FORMAT_NAMES[] = { "float32", "float16", "int16" };
+const int NUM_SAMPLE_FORMATS = 3;
+
+// Number of samples sharing one scale in SAMPLE_FORMAT_INT16 (hop sizes are multiples of it)
+const int COMPACT_BLOCK_SIZE = 64;
+
+// Analysis quality tier: FFT size and hop size of the grain source analysis and the voice resynthesis,
+// and the number of hops in the grain source span
+// All FFT buffers, grain sources and voice buffers are sized from the active tier
+struct QualityTier {
+	int fftSize;
+	int hopSize;
+	// 100 will lead to a src grain buffer of 100 * 1024 = 102400 samples (~2.3s at 44.1kHz) with the medium tier
+	int sourceHops;
+	// Storage format of voice buffers and spectra (set with --storage, kept when the tier changes)
+	SampleFormat storage;
+	// Whether the grain sources keep a bin-major view of their frames (see GrainSource), off for --benchmark bin-major only
+	bool binMajor = true;
+	
+	// The final length of the grain source buffer
+	// i.e. the buffer that is passed to voices on noteOn events
+	int sourceSamples() const { return hopSize * sourceHops; }
+	// Number of non-negative frequency bins
+	int numBins() const { return fftSize / 2 + 1; }
+};
+
+// Selectable at startup (--quality) and in the GUI: smaller FFTs leave CPU for more polyphony,
+// larger ones give a finer pitch resolution (~21Hz, ~10Hz and ~5Hz per bin at 44.1kHz)
+const QualityTier QUALITY_TIERS[] = {
+	{ 2048, 512, 100, SAMPLE_FORMAT_FLOAT32 },
+	{ 4096, 1024, 100, SAMPLE_FORMAT_FLOAT32 },
+	{ 8192, 2048, 100, SAMPLE_FORMAT_FLOAT32 }
+};
+const char* const QUALITY_TIER_NAMES[] = { "low", "medium", "high" };
+const int NUM_QUALITY_TIERS = 3;
+const int DEFAULT_QUALITY_TIER = 1;
 
 // System-wide indicator for "not playing"
 const float NOT_PLAYING = -1.0f;
 // int version
 const int NOT_PLAYING_I = -1;
 
-// Number of voices
+// Number of voices (per engine instance)
 const int NUM_VOICES = 10;
 
-// Expressed in factors of FFT_HOP_SIZE
-// 100 will lead to a src grain buffer of 100 * 512 = 51200 samples (~1.25s at 44.1kHz)
-const int GRAIN_FFT_INTERVAL = 100;
+// Maximum number of engine instances (layers) playing at the same time
+const int MAX_ENGINES = 16;
+// MIDI events an engine instance responds to: one MIDI channel (or all of them) and a range of notes
+struct EngineRoute {
+	// MIDI channel [0...15], -1 for all channels
+	int channel;
+	// Lowest and highest note [0...127]
+	int lowestNote;
+	int highestNote;
+};
+
+// Minimum number of hops in the grain source span (--source-hops)
+// so that a voice buffer overlap-adds at least two IFFT hops
+const int MIN_SOURCE_HOPS = 2;
 
-// The final length of the grain source buffer
-// i.e. the buffer that is passed to voices on noteOn events
-const int MAX_GRAIN_SAMPLES = FFT_HOP_SIZE * GRAIN_FFT_INTERVAL;
+// Maximum number of output channels the grains are panned across (a multiple of 4, see Voice::play())
+// Further channels of the audio device stay silent
+const int MAX_OUTPUT_CHANNELS = 8;
 
-// Maximum allowed grain length (22050 = 500ms at 44.1kHz)
+// Maximum allowed grain length (22050 = 500ms at 44.1kHz, longer grains are clamped by Engine::applyParameters())
 const int MAX_GRAIN_LENGTH = 22050;
 
+// How a voice extracts the overtones of its note from the grain source:
+// VOICE_MODE_FFT masks the overtone bins of the analysis and resynthesises them hop by hop into a voice buffer,
+// VOICE_MODE_RESONATOR runs the source samples through a bank of bandpass resonators tuned to the overtones
+// (no analysis, no buffer and no preparation, so the note sounds from the first sample on)
+enum VoiceMode {
+	VOICE_MODE_FFT = 0,
+	VOICE_MODE_RESONATOR
+};
+const char* const VOICE_MODE_NAMES[] = { "fft", "resonator" };
+const int NUM_VOICE_MODES = 2;
+
+// How grains playing at a rate other than 1 read the voice buffer between samples (see Interpolator)
+enum InterpolationKernel {
+	INTERPOLATION_LINEAR = 0,
+	// Catmull-Rom cubic Hermite spline
+	INTERPOLATION_CUBIC,
+	// Blackman windowed sinc from a polyphase table
+	INTERPOLATION_SINC
+};
+const char* const INTERPOLATION_KERNEL_NAMES[] = { "linear", "cubic", "sinc" };
+const int NUM_INTERPOLATION_KERNELS = 3;
+
+// File format of the recordings (see Recorder): 32 bit float WAV (the output as it was played) or 24 bit FLAC
+enum RecordFormat {
+	RECORD_FORMAT_WAV = 0,
+	RECORD_FORMAT_FLAC
+};
+const char* const RECORD_FORMAT_NAMES[] = { "wav", "flac" };
+const int NUM_RECORD_FORMATS = 2;
+
+// Resonator bandwidth relative to the fundamental (bandwidth = frequency / RESONATOR_Q)
+const float RESONATOR_Q = 30.0f;
+// Resonators are only tuned to overtones below this fraction of the Nyquist frequency
+const float RESONATOR_MAX_FREQUENCY = 0.9f;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,439 @@
+/***** Engine.cpp *****/
+#include "Engine.h"
+#include "Globals.h"
+#include "Trace.h"
+
+Engine::Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+	const EngineParameters& parameters, int song, LiveSource* liveSource)
+	: Engine(sampleRate, quality, numOutputChannels, route, parameters, song, gSongLibrary.get(song), liveSource) {
+}
+
+Engine::Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+	const EngineParameters& parameters, SampleData* sampleData, LiveSource* liveSource)
+	: Engine(sampleRate, quality, numOutputChannels, route, parameters, -1, sampleData, liveSource) {
+}
+
+Engine::Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+	const EngineParameters& parameters, int song, SampleData* sampleData, LiveSource* liveSource)
+	: sampleRate (sampleRate), quality (quality), mode (parameters.voiceMode), numOutputChannels (numOutputChannels), route (route),
+	parameters (parameters), applied (parameters), song (song), requestedSong (song), sampleData (sampleData),
+	pyramid (nullptr), liveSource (liveSource), windowUpdatePending (true) {
+	gSongLibrary.retain(song);
+	window.reset(new Window(MAX_GRAIN_LENGTH));
+
+	for(int channel = 0; channel < numOutputChannels; channel++){
+		lowpass.push_back(std::unique_ptr<Lowpass>(new Lowpass(sampleRate)));
+		lowpass.back()->calculate_coefficients(applied.lowpassCutoff, applied.lowpassQ);
+		highpass.push_back(std::unique_ptr<Highpass>(new Highpass(sampleRate)));
+		highpass.back()->calculate_coefficients(applied.highpassCutoff, applied.highpassQ);
+	}
+	createVoices();
+}
+
+Engine::~Engine(){
+	gSongLibrary.release(song);
+	gSongLibrary.release(sliceSong);
+}
+
+void Engine::createVoices(){
+	voices.clear();
+	for (int i = 0; i < NUM_VOICES; i++){
+		voices.push_back(std::unique_ptr<Voice>(new Voice(sampleRate, *window, quality, mode)));
+		voices[i]->setSourceSamples(sampleData, getSourceStart(), gSongLibrary.getAnalysis(song));
+		voices[i]->setNumOutputChannels(numOutputChannels);
+		voices[i]->setScatter(applied.scatter);
+		voices[i]->setPan(applied.pan, applied.spread);
+		voices[i]->setPlaybackRate(applied.playbackRate, applied.rateJitter);
+		voices[i]->setInterpolation(applied.interpolation);
+		voices[i]->setScanRate(applied.liveInput ? 0.0f : applied.scanRate);
+		voices[i]->setOvertoneSnapping(gSnapOvertones);
+		voices[i]->setGrainFrequency(applied.grainFrequency);
+		voices[i]->setGrainLength(windowLength);
+	}
+	for (auto& voice : voiceIndices) {
+		voice = NOT_PLAYING;
+	}
+	for (auto& voice : noteVoices) {
+		voice = NOT_PLAYING_I;
+	}
+}
+
+bool Engine::accepts(const MidiEvent& event){
+	return (route.channel < 0 || route.channel == event.channel) && event.note >= route.lowestNote && event.note <= route.highestNote;
+}
+
+EngineParameters& Engine::getParameters(){
+	return parameters;
+}
+
+int Engine::applyParameters(){
+	int updates = 0;
+	// The grain window and the windowed grain of the voices hold at most MAX_GRAIN_LENGTH samples
+	// (the 500 ms of the GUI are longer above 44.1 kHz)
+	parameters.grainLength = std::max(1, std::min(parameters.grainLength, MAX_GRAIN_LENGTH));
+	if(parameters.scatter != applied.scatter){
+		for(auto& voice : voices){
+			voice->setScatter(parameters.scatter);
+		}
+	}
+	if(parameters.pan != applied.pan || parameters.spread != applied.spread){
+		for(auto& voice : voices){
+			voice->setPan(parameters.pan, parameters.spread);
+		}
+	}
+	if(parameters.playbackRate != applied.playbackRate || parameters.rateJitter != applied.rateJitter){
+		for(auto& voice : voices){
+			voice->setPlaybackRate(parameters.playbackRate, parameters.rateJitter);
+		}
+	}
+	if(parameters.interpolation != applied.interpolation){
+		for(auto& voice : voices){
+			voice->setInterpolation(parameters.interpolation);
+		}
+	}
+	// The live input has no song to scan through
+	if(parameters.scanRate != applied.scanRate || parameters.liveInput != applied.liveInput){
+		for(auto& voice : voices){
+			voice->setScanRate(parameters.liveInput ? 0.0f : parameters.scanRate);
+		}
+	}
+	if(parameters.grainFrequency != applied.grainFrequency){
+		for(auto& voice : voices){
+			voice->setGrainFrequency(parameters.grainFrequency);
+		}
+	}
+	// Calculate new filter coefficients if changed
+	if(parameters.lowpassCutoff != applied.lowpassCutoff || parameters.lowpassQ != applied.lowpassQ){
+		for(auto& filter : lowpass){
+			filter->calculate_coefficients(parameters.lowpassCutoff, parameters.lowpassQ);
+		}
+	}
+	if(parameters.highpassCutoff != applied.highpassCutoff || parameters.highpassQ != applied.highpassQ){
+		for(auto& filter : highpass){
+			filter->calculate_coefficients(parameters.highpassCutoff, parameters.highpassQ);
+		}
+	}
+	// The window is recomputed on the grain window task
+	if(parameters.grainLength != applied.grainLength || parameters.windowType != applied.windowType
+	|| parameters.windowModifier != applied.windowModifier){
+		windowUpdatePending = true;
+		updates |= ENGINE_UPDATE_WINDOW;
+	}
+	// A new slice or grain source is analysed / switched to on the grain source task
+	if(parameters.sourcePosition != applied.sourcePosition || parameters.liveInput != applied.liveInput)
+		updates |= ENGINE_UPDATE_SOURCE;
+
+	applied = parameters;
+	return updates;
+}
+
+GrainSource& Engine::activeGrainSource(float frequency){
+	GrainPyramid* source = pyramid;
+	return applied.liveInput ? liveSource->getGrainSource() : source->getLevel(source->levelFor(frequency));
+}
+
+bool Engine::noteOn(int note, float frequency){
+	// No grain source yet
+	if(pyramid.load() == nullptr)
+		return false;
+	// A note that is still playing is retriggered on its voice, otherwise take the first free voice
+	int voiceIdx = noteVoices[note];
+	for (int i = 0; i < NUM_VOICES && voiceIdx == NOT_PLAYING_I; i++){
+		if (voiceIndices[i] == NOT_PLAYING)
+			voiceIdx = i;
+	}
+	// All voices taken: the note is ignored
+	if(voiceIdx == NOT_PLAYING_I)
+		return true;
+	if(!voices[voiceIdx]->noteOn(activeGrainSource(frequency), frequency, applied.grainLength))
+		return false;
+	voiceIndices[voiceIdx] = frequency;
+	noteVoices[note] = voiceIdx;
+	return true;
+}
+
+int Engine::getNoteVoice(int note){
+	return noteVoices[note];
+}
+
+void Engine::noteOff(int note){
+	int voiceIdx = noteVoices[note];
+	if(voiceIdx == NOT_PLAYING_I)
+		return;
+	voiceIndices[voiceIdx] = NOT_PLAYING;
+	voices[voiceIdx]->noteOff();
+	noteVoices[note] = NOT_PLAYING_I;
+}
+
+void Engine::process(float* frame){
+	// Get grain audio data from voices, every grain panned across the output channels
+	float bus[MAX_OUTPUT_CHANNELS] = {};
+	for(int voiceIdx = 0; voiceIdx < NUM_VOICES; voiceIdx++){
+		if(voiceIndices[voiceIdx] > NOT_PLAYING){
+			float sample = fabsf(voices[voiceIdx]->play(bus));
+			if(sample > voicePeaks[voiceIdx])
+				voicePeaks[voiceIdx] = sample;
+		}
+	}
+
+	for(int channel = 0; channel < numOutputChannels; channel++){
+		// Apply filters
+		float out = lowpass[channel]->processSample(bus[channel]);
+		out = highpass[channel]->processSample(out);
+
+		// Apply output gain
+		frame[channel] += out * applied.outputGain;
+	}
+}
+
+bool Engine::needsSynthesis(){
+	for(auto& voice : voices){
+		if(voice->needsSynthesis())
+			return true;
+	}
+	return false;
+}
+
+bool Engine::requestLevels(){
+	GrainPyramid* source = pyramid;
+	if(applied.liveInput || mode != VOICE_MODE_FFT || source == nullptr)
+		return false;
+	bool requested = false;
+	for(int i = 0; i < NUM_VOICES; i++){
+		if(voiceIndices[i] <= NOT_PLAYING)
+			continue;
+		int level = source->levelFor(voiceIndices[i]);
+		if(!source->getLevel(level).isReady() && source->request(level))
+			requested = true;
+	}
+	return requested;
+}
+
+void Engine::takeMeters(float* levels, float* grains){
+	for(int i = 0; i < NUM_VOICES; i++){
+		levels[i] = voicePeaks[i];
+		grains[i] = voiceIndices[i] > NOT_PLAYING ? voices[i]->getNumPlayingGrains() : 0;
+		voicePeaks[i] = 0.0f;
+	}
+}
+
+void Engine::requestSong(int index){
+	// Any index into the song library is accepted, the song is loaded in the background
+	requestedSong = index;
+	gSongLibrary.request(index);
+}
+
+bool Engine::switchSong(){
+	// Switch as soon as the requested song is loaded (just a pointer swap)
+	SampleData* requestedSongData = requestedSong != song ? gSongLibrary.get(requestedSong) : nullptr;
+	if(requestedSongData == nullptr)
+		return false;
+	int previousSong = song;
+	gSongLibrary.retain(requestedSong);
+	song = requestedSong;
+	sampleData = requestedSongData;
+
+	// Resonator voices and scanning notes read the song samples directly, so they must not touch the previous
+	// song again (it may be unmapped once no engine plays it)
+	AnalysisCache* analysis = gSongLibrary.getAnalysis(requestedSong);
+	for(auto& voice : voices){
+		voice->setSourceSamples(requestedSongData, getSourceStart(), analysis);
+	}
+	gSongLibrary.release(previousSong);
+	return true;
+}
+
+int Engine::getSong(){
+	return song;
+}
+
+SampleData* Engine::getSampleData(){
+	return sampleData;
+}
+
+int Engine::getSourceStart(){
+	// Songs in the library can have any length: keep the slice inside the song (zero-padded if the song is too short)
+	SampleData* data = sampleData;
+	return std::max(0, std::min(applied.sourcePosition, data->sampleLen - (quality.sourceSamples() + quality.fftSize)));
+}
+
+bool Engine::usesLiveInput(){
+	return applied.liveInput;
+}
+
+VoiceMode Engine::getVoiceMode(){
+	return mode;
+}
+
+bool Engine::takeWindowUpdate(){
+	return windowUpdatePending.exchange(false);
+}
+
+void Engine::requestWindowUpdate(){
+	windowUpdatePending = true;
+}
+
+void Engine::updateWindow(){
+	TRACE_SCOPE("window-rebuild");
+
+	// Update grain window type (also sets length)
+	int grainLength = applied.grainLength;
+	window->updateWindow(grainLength, applied.windowType, applied.windowModifier);
+
+	// Adjust grains to new length
+	for(auto& voice : voices){
+		voice->setGrainLength(grainLength);
+	}
+	windowLength = grainLength;
+}
+
+Window& Engine::getWindow(){
+	return *window;
+}
+
+int Engine::getWindowLength(){
+	return windowLength;
+}
+
+GrainPyramid* Engine::getPyramid(){
+	return pyramid;
+}
+
+void Engine::setGrainSource(GrainPyramid* source, int sliceSongIndex, SampleData* data, int startIdx){
+	if(source != pyramid.load())
+		pyramidChanged = true;
+	// The slice holds its song until the grain source moves to another one: the audio thread may have switched
+	// the engine to the next song already, the previous one must stay mapped while the slice is read from it
+	if(sliceSongIndex != sliceSong){
+		gSongLibrary.retain(sliceSongIndex);
+		gSongLibrary.release(sliceSong);
+	}
+	sliceSong = sliceSongIndex;
+	sliceData = data;
+	sliceStart = startIdx;
+	pyramid = source;
+}
+
+int Engine::getSliceSong(){
+	return sliceSong;
+}
+
+SampleData* Engine::getSliceData(){
+	return sliceData;
+}
+
+int Engine::getSliceStart(){
+	return sliceStart;
+}
+
+void Engine::markLevelsInUse(bool* levelsInUse){
+	GrainPyramid* source = pyramid;
+	if(applied.liveInput)
+		return;
+	for (int i = 0; i < NUM_VOICES; i++){
+		if(voiceIndices[i] > NOT_PLAYING)
+			levelsInUse[source->levelFor(voiceIndices[i])] = true;
+	}
+}
+
+void Engine::updateVoiceSources(const bool* levelsAnalysed){
+	GrainPyramid* source = pyramid;
+	// All voices follow if the grain source was switched, with the live input they restart from its newest frames
+	bool liveInput = applied.liveInput;
+	bool sourceSwitched = liveInput != grainSrcLiveInput || (pyramidChanged && !liveInput);
+	grainSrcLiveInput = liveInput;
+	pyramidChanged = false;
+	for (int i = 0; i < NUM_VOICES; i++){
+		if(voiceIndices[i] > NOT_PLAYING && (sourceSwitched || levelsAnalysed[source->levelFor(voiceIndices[i])]))
+			voices[i]->updateGrainSrcBuffer(activeGrainSource(voiceIndices[i]));
+	}
+}
+
+void Engine::updateSourceSamples(){
+	int startIdx = getSourceStart();
+	AnalysisCache* analysis = gSongLibrary.getAnalysis(song);
+	for(auto& voice : voices){
+		voice->setSourceSamples(sampleData, startIdx, analysis);
+	}
+}
+
+void Engine::updateGrainSources(std::vector<std::unique_ptr<Engine>>& engines, GrainSourceCache& cache){
+	// The pyramid of the slice every engine plays from
+	for(auto& engine : engines){
+		int song = engine->getSong();
+		SampleData* data = engine->getSampleData();
+		int startIdx = engine->getSourceStart();
+		engine->setGrainSource(cache.acquire(song, startIdx, engine->getPyramid()), song, data, startIdx);
+		engine->updateSourceSamples();
+	}
+
+	for(unsigned int i = 0; i < engines.size(); i++){
+		// Every pyramid once (with the first engine using it)
+		GrainPyramid* source = engines[i]->getPyramid();
+		bool analysedAlready = false;
+		for(unsigned int j = 0; j < i; j++){
+			if(engines[j]->getPyramid() == source)
+				analysedAlready = true;
+		}
+		if(analysedAlready)
+			continue;
+
+		// Levels the playing voices of all engines on the pyramid read from
+		// (the live input replaces the song, its analysis runs continuously on its own task;
+		// resonator voices filter the samples of the slice directly, so there is nothing to analyse for them)
+		bool levelsInUse[NUM_QUALITY_TIERS] = {};
+		bool levelsAnalysed[NUM_QUALITY_TIERS] = {};
+		bool songInUse = false;
+		for(auto& engine : engines){
+			if(engine->getPyramid() == source && !engine->usesLiveInput() && engine->getVoiceMode() == VOICE_MODE_FFT){
+				engine->markLevelsInUse(levelsInUse);
+				songInUse = true;
+			}
+		}
+		if(songInUse){
+			// With a valid analysis cache the frames of the base level are copied from disk, no FFT needed
+			AnalysisCache* analysis = gSongLibrary.getAnalysis(engines[i]->getSliceSong());
+			source->update(*engines[i]->getSliceData(), engines[i]->getSliceStart(), analysis, levelsInUse, levelsAnalysed);
+		}
+
+		// Update grain source buffer for the playing voices on a rewritten level
+		for(auto& engine : engines){
+			if(engine->getPyramid() == source)
+				engine->updateVoiceSources(levelsAnalysed);
+		}
+	}
+}
+
+std::vector<std::unique_ptr<Voice>>& Engine::getVoices(){
+	return voices;
+}
+
+void Engine::synthesise(std::vector<std::unique_ptr<Engine>>& engines, WorkerPool& pool){
+	std::vector<Voice*> voices;
+	for(auto& engine : engines){
+		Voice::prepareBatch(engine->voices, pool);
+		for(auto& voice : engine->voices){
+			voices.push_back(voice.get());
+		}
+	}
+	// One hop per voice and round, the voices of a round (of all engines) share lane-interleaved inverse FFTs
+	Voice::synthesiseRounds(voices, pool);
+}
+
+void Engine::rebuild(const QualityTier& newQuality, LiveSource* newLiveSource){
+	quality = newQuality;
+	mode = parameters.voiceMode;
+	liveSource = newLiveSource;
+	pyramid = nullptr;
+	gSongLibrary.release(sliceSong);
+	sliceSong = -1;
+	sliceData = nullptr;
+	createVoices();
+	windowUpdatePending = true;
+}
+
+void Engine::rebuildVoices(){
+	mode = parameters.voiceMode;
+	createVoices();
+	windowUpdatePending = true;
+}
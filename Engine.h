@@ -0,0 +1,214 @@
+/*****
+ * Engine.h
+ * One instance (layer) of the synthesiser: voices, grain window, output filters and grain parameters
+ *
+ * Several engines play at the same time, each responding to its own MIDI channel and / or key range
+ * (EngineRoute) with its own song, source position and grain parameters, and render.cpp sums their outputs.
+ * The grain sources are not part of an engine: engines on the same slice of the same song share one
+ * GrainPyramid of the GrainSourceCache, and all of them share the live input, the worker pool and the
+ * quality tier (switching it rebuilds every engine). The voice mode is a parameter of each engine
+*****/
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "Constants.h"
+#include "SampleData.h"
+#include "Voice.h"
+#include "Lowpass.h"
+#include "Highpass.h"
+#include "GrainPyramid.h"
+#include "GrainSourceCache.h"
+#include "WorkerPool.h"
+#include "LiveSource.h"
+#include "MidiQueue.h"
+
+// Parameters of an engine, set from the GUI (render.cpp) and applied once per block by Engine::applyParameters()
+struct EngineParameters {
+	// Position of the grain source slice in the song (in samples)
+	int sourcePosition = 0;
+	// Grain length (in samples, clamped to MAX_GRAIN_LENGTH) and distance between grain starts (in samples)
+	int grainLength = 1;
+	int grainFrequency = 1;
+	// Pseudorandom grain start positions [0...100]
+	int scatter = 0;
+	// Pan position [-1...1] of new grains and how far they are spread around it [0...100]
+	float pan = 0.0f;
+	int spread = 0;
+	// Playback rate of new grains and their pseudorandom detune in cents
+	float playbackRate = 1.0f;
+	float rateJitter = 0.0f;
+	// Interpolation of grains at fractional read positions
+	InterpolationKernel interpolation = INTERPOLATION_CUBIC;
+	// Rate the notes scan through the song from the slice on (1 = as fast as the song plays, 0 = no scanning)
+	float scanRate = 0.0f;
+	// Grain window type (0 = Hann, 1 = Tukey, 2 = Gaussian or 3 = trapezoid) and its modifier
+	int windowType = 0;
+	float windowModifier = 0.5f;
+	// Output filters
+	float lowpassCutoff = 20000.0f;
+	float lowpassQ = 0.707f;
+	float highpassCutoff = 20.0f;
+	float highpassQ = 0.707f;
+	// Output gain
+	float outputGain = 5.0f;
+	// Whether the live input is the grain source instead of the song
+	bool liveInput = false;
+	// Overtone extraction of the voices, switching it recreates the voices on the rebuild task
+	VoiceMode voiceMode = VOICE_MODE_FFT;
+};
+
+// Background work requested by Engine::applyParameters()
+const int ENGINE_UPDATE_WINDOW = 1;
+const int ENGINE_UPDATE_SOURCE = 2;
+
+class Engine {
+	public:
+		// Voices for the given tier and the voice mode of parameters, panned across numOutputChannels, playing song (which has to be loaded)
+		// Until the grain source task hands the engine a pyramid (setGrainSource()) no note can be played
+		Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+			const EngineParameters& parameters, int song, LiveSource* liveSource);
+		// Engine playing sampleData, which is not part of the song library (the stress test), its song is -1
+		Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+			const EngineParameters& parameters, SampleData* sampleData, LiveSource* liveSource);
+		~Engine();
+
+		// ---- audio thread
+		// Whether a MIDI event is meant for this engine
+		bool accepts(const MidiEvent& event);
+		// Parameters to be applied by the next applyParameters() (set by the GUI)
+		EngineParameters& getParameters();
+		// Pass the parameters that changed since the last call to the voices and filters
+		// Returns ENGINE_UPDATE_WINDOW and / or ENGINE_UPDATE_SOURCE if the window or grain source task has to run
+		int applyParameters();
+		// Start or release a note, noteOn() returns false if its voice is busy and the note has to be retried later
+		bool noteOn(int note, float frequency);
+		void noteOff(int note);
+		// Index of the voice playing a note (NOT_PLAYING_I if none)
+		int getNoteVoice(int note);
+		// Add the filtered output of all voices (one sample per output channel) to frame
+		void process(float* frame);
+		// Whether any voice needs the voice synthesis task
+		bool needsSynthesis();
+		// Ask for the pyramid levels that playing voices wait for, returns true if the grain source task has to run
+		bool requestLevels();
+		// Peak output of every voice since the last call and its number of playing grains (NUM_VOICES values each),
+		// for the meters in the GUI
+		void takeMeters(float* levels, float* grains);
+		// Song selection: the song is requested from gSongLibrary and played from as soon as it is loaded
+		void requestSong(int index);
+		// Switch to the requested song if it is loaded now, returns true if the song changed
+		bool switchSong();
+
+		// ---- any thread
+		int getSong();
+		SampleData* getSampleData();
+		// Start of the grain source slice, kept inside the song
+		int getSourceStart();
+		bool usesLiveInput();
+		// Voice mode of the voices (the one of the parameters once the voices are recreated for it)
+		VoiceMode getVoiceMode();
+
+		// ---- window task
+		// Whether the window has to be recomputed (clears the request)
+		bool takeWindowUpdate();
+		// Make the next takeWindowUpdate() return true (e.g. to send the window of this engine to the GUI)
+		void requestWindowUpdate();
+		// Recompute the window and the grain length of the voices
+		void updateWindow();
+		Window& getWindow();
+		// Grain length the window was last computed for
+		int getWindowLength();
+
+		// ---- grain source task
+		GrainPyramid* getPyramid();
+		// Play from pyramid, holding the slice of sampleData (song) starting at startIdx (the song stays mapped until the slice moves to another song)
+		void setGrainSource(GrainPyramid* pyramid, int song, SampleData* sampleData, int startIdx);
+		// Song, song data and start of the slice passed to setGrainSource()
+		int getSliceSong();
+		SampleData* getSliceData();
+		int getSliceStart();
+		// Mark the pyramid levels the playing voices read from
+		void markLevelsInUse(bool* levelsInUse);
+		// Pass the new grain source to the playing voices on a rewritten level (levelsAnalysed holds one flag per level),
+		// or to all of them if the engine switched pyramids or between song and live input
+		void updateVoiceSources(const bool* levelsAnalysed);
+		// Point the voices to the current slice: resonator voices filter it, scanning notes start their scan there
+		void updateSourceSamples();
+
+		// Acquire the pyramid of the slice every engine plays from cache, analyse the levels its playing voices
+		// (and noteOn requests) need and pass the rewritten levels to the playing voices
+		// Engines on the same slice share one pyramid, which is analysed once
+		static void updateGrainSources(std::vector<std::unique_ptr<Engine>>& engines, GrainSourceCache& cache);
+
+		// ---- voice synthesis task
+		std::vector<std::unique_ptr<Voice>>& getVoices();
+		// Prepare the notes triggered since the last call (one batch per engine) and synthesise the remaining hops
+		// of all voices, one hop per voice and round so that all playing voices make progress together
+		// (Voice::synthesiseRounds(): up to LANE_FFT_LANES voices per inverse FFT, the FFTs of a round split across pool)
+		static void synthesise(std::vector<std::unique_ptr<Engine>>& engines, WorkerPool& pool);
+
+		// ---- rebuild task (no other task running, render() not using the engine)
+		// Recreate the voices for another tier (playing notes are released)
+		// The engine has no grain source until the next setGrainSource()
+		void rebuild(const QualityTier& quality, LiveSource* liveSource);
+		// Recreate the voices for the voice mode of the parameters, keeping the grain source (playing notes are released)
+		void rebuildVoices();
+
+	private:
+		float sampleRate;
+		QualityTier quality;
+		VoiceMode mode;
+		int numOutputChannels;
+		EngineRoute route;
+
+		// Parameters set by the GUI and the ones applied to voices and filters
+		EngineParameters parameters;
+		EngineParameters applied;
+
+		// Song played and song selected, becoming the played one as soon as it is loaded
+		std::atomic<int> song;
+		int requestedSong;
+		std::atomic<SampleData*> sampleData;
+
+		// Grain source of the notes: the pyramid of the slice or the live input
+		std::atomic<GrainPyramid*> pyramid;
+		LiveSource* liveSource;
+		// Slice the pyramid was acquired for (its song is retained in the library until the slice moves to another song)
+		int sliceSong = -1;
+		SampleData* sliceData = nullptr;
+		int sliceStart = 0;
+		// Set by setGrainSource() when the pyramid changed, cleared by updateVoiceSources()
+		bool pyramidChanged = false;
+		// Whether the live input was the grain source at the last grain source update
+		bool grainSrcLiveInput = false;
+
+		// Grain window of all voices of this engine
+		std::unique_ptr<Window> window;
+		std::atomic<bool> windowUpdatePending;
+		int windowLength = 0;
+
+		// Frequency each voice is playing (NOT_PLAYING if none) and voice playing each MIDI note (NOT_PLAYING_I if none)
+		float voiceIndices[NUM_VOICES];
+		int noteVoices[128];
+		std::vector<std::unique_ptr<Voice>> voices;
+		// Peak output of every voice since the last takeMeters()
+		float voicePeaks[NUM_VOICES] = {};
+
+		// One filter per output channel
+		std::vector<std::unique_ptr<Lowpass>> lowpass;
+		std::vector<std::unique_ptr<Highpass>> highpass;
+
+		Engine(float sampleRate, const QualityTier& quality, int numOutputChannels, const EngineRoute& route,
+			const EngineParameters& parameters, int song, SampleData* sampleData, LiveSource* liveSource);
+
+		// Create the voices with the applied parameters
+		void createVoices();
+		// Grain source new notes of the given frequency are masked from: the live input or the level
+		// of the pyramid that fits the register of the note
+		GrainSource& activeGrainSource(float frequency);
+};
+
+#endif
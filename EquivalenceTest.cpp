@@ -0,0 +1,395 @@
+/***** EquivalenceTest.cpp *****/
+#include "EquivalenceTest.h"
+#include "Voice.h"
+#include "Lowpass.h"
+#include "Highpass.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// Samples of the filter checks
+const int EQUIVALENCE_FILTER_SAMPLES = 8192;
+
+// Deterministic pseudorandom numbers of a check input (the same for the reference and the alternate)
+class CheckRandom {
+	public:
+		CheckRandom(unsigned int seed) : state (seed * 2654435761u + 12345u) {}
+		// Uniform in [low, high)
+		float uniform(float low, float high){
+			state = state * 1664525u + 1013904223u;
+			return low + (high - low) * float(state >> 8) / float(1 << 24);
+		}
+		// Log-uniform in [low, high)
+		float logUniform(float low, float high){
+			return low * powf(high / low, uniform(0.0f, 1.0f));
+		}
+	private:
+		unsigned int state;
+};
+
+EquivalenceTest::EquivalenceTest(float sampleRate, const QualityTier& quality)
+	: sampleRate (sampleRate), quality (quality), pool (0) {
+	this->quality.sourceHops = EQUIVALENCE_SOURCE_HOPS;
+	spectrumCfg = ne10_fft_alloc_c2c_float32_neon (EQUIVALENCE_SPECTRUM_SIZE);
+	sourceCfg = ne10_fft_alloc_c2c_float32_neon (quality.fftSize);
+	timeDomain.resize(max(EQUIVALENCE_SPECTRUM_SIZE, quality.fftSize));
+	frequencyDomain.resize(max(EQUIVALENCE_SPECTRUM_SIZE, quality.fftSize));
+	window.reset(new Window(MAX_GRAIN_LENGTH));
+
+	addFilterChecks();
+	addWindowChecks();
+	addVoiceChecks();
+}
+
+void EquivalenceTest::add(const string& kernel, const string& alternate, Kernel reference, Kernel alternateKernel,
+	const EquivalenceTolerance& tolerance){
+	checks.push_back({ kernel, alternate, reference, alternateKernel, tolerance });
+}
+
+bool EquivalenceTest::run(int numRandomRuns){
+	printf("%-28s %-22s | %12s %9s %9s | %12s %9s %9s | %s\n", "kernel", "alternate", "golden err", "SNR dB", "LSD dB",
+		"worst err", "SNR dB", "LSD dB", "result");
+	bool allPassed = true;
+	vector<float> reference;
+	vector<float> output;
+	for (auto& check : checks){
+		EquivalenceResult golden;
+		EquivalenceResult worst;
+		worst.snr = INFINITY;
+		for (int seed = 0; seed <= numRandomRuns; seed++){
+			reference.clear();
+			output.clear();
+			check.reference(seed, reference);
+			check.alternateKernel(seed, output);
+			EquivalenceResult result = compare(reference, output);
+			if(seed == 0)
+				golden = result;
+			worst.maxAbsError = max(worst.maxAbsError, result.maxAbsError);
+			worst.snr = min(worst.snr, result.snr);
+			worst.spectralDistance = max(worst.spectralDistance, result.spectralDistance);
+		}
+		bool passed = worst.maxAbsError <= check.tolerance.maxAbsError && worst.snr >= check.tolerance.minSnr
+			&& worst.spectralDistance <= check.tolerance.maxSpectralDistance;
+		allPassed = allPassed && passed;
+		printf("%-28s %-22s | %12.3g %9.1f %9.4f | %12.3g %9.1f %9.4f | %s\n", check.kernel.c_str(), check.alternate.c_str(),
+			golden.maxAbsError, golden.snr, golden.spectralDistance, worst.maxAbsError, worst.snr, worst.spectralDistance,
+			passed ? "pass" : "FAIL");
+		fflush(stdout);
+	}
+	printf("Golden input and %d randomized inputs per kernel; LSD: log spectral distance of the averaged power spectra\n", numRandomRuns);
+	return allPassed;
+}
+
+EquivalenceResult EquivalenceTest::compare(const vector<float>& reference, const vector<float>& output){
+	EquivalenceResult result;
+	size_t length = min(reference.size(), output.size());
+	double signal = 0.0;
+	double noise = 0.0;
+	for (size_t n = 0; n < length; n++){
+		double error = double(output[n]) - reference[n];
+		result.maxAbsError = max(result.maxAbsError, float(fabs(error)));
+		signal += double(reference[n]) * reference[n];
+		noise += error * error;
+	}
+	result.snr = noise > 0.0 ? 10.0 * log10(signal / noise) : INFINITY;
+	if(noise == 0.0)
+		return result;
+
+	// RMS difference in dB over the bins the reference has energy in
+	vector<double> referenceSpectrum = powerSpectrum(reference, length);
+	vector<double> outputSpectrum = powerSpectrum(output, length);
+	double floor = *max_element(referenceSpectrum.begin(), referenceSpectrum.end()) * pow(10.0, -0.1 * EQUIVALENCE_SPECTRUM_FLOOR);
+	double sum = 0.0;
+	int bins = 0;
+	for (size_t k = 0; k < referenceSpectrum.size(); k++){
+		if(referenceSpectrum[k] <= floor && outputSpectrum[k] <= floor)
+			continue;
+		double difference = 10.0 * log10((outputSpectrum[k] + floor) / (referenceSpectrum[k] + floor));
+		sum += difference * difference;
+		bins++;
+	}
+	result.spectralDistance = bins > 0 ? sqrt(sum / bins) : 0.0;
+	return result;
+}
+
+vector<double> EquivalenceTest::powerSpectrum(const vector<float>& output, size_t length){
+	const int size = EQUIVALENCE_SPECTRUM_SIZE;
+	vector<double> power(size / 2 + 1, 0.0);
+	// Short outputs are zero-padded into one frame
+	size_t numFrames = max<size_t>(1, length / size);
+	for (size_t frame = 0; frame < numFrames; frame++){
+		for (int n = 0; n < size; n++){
+			size_t idx = frame * size + n;
+			float sample = idx < length ? output[idx] : 0.0f;
+			timeDomain[n].r = sample * 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(size - 1)));
+			timeDomain[n].i = 0.0f;
+		}
+		ne10_fft_c2c_1d_float32_neon (frequencyDomain.data(), timeDomain.data(), spectrumCfg, 0);
+		for (int k = 0; k <= size / 2; k++){
+			power[k] += double(frequencyDomain[k].r) * frequencyDomain[k].r + double(frequencyDomain[k].i) * frequencyDomain[k].i;
+		}
+	}
+	return power;
+}
+
+void EquivalenceTest::addFilterChecks(){
+	// Golden input: an impulse and a step at 1 kHz, randomized: white noise at any cutoff and Q
+	struct FilterInput {
+		vector<float> samples;
+		float cutoff;
+		float q;
+	};
+	auto input = [](unsigned int seed){
+		FilterInput in;
+		in.samples.assign(EQUIVALENCE_FILTER_SAMPLES, 0.0f);
+		CheckRandom random(seed);
+		if(seed == 0){
+			in.samples[0] = 1.0f;
+			fill(in.samples.begin() + EQUIVALENCE_FILTER_SAMPLES / 2, in.samples.end(), 0.5f);
+			in.cutoff = 1000.0f;
+			in.q = 0.707f;
+		} else {
+			for (auto& sample : in.samples){
+				sample = random.uniform(-1.0f, 1.0f);
+			}
+			in.cutoff = random.logUniform(40.0f, 16000.0f);
+			in.q = random.uniform(0.5f, 4.0f);
+		}
+		return in;
+	};
+	// Two cascaded biquads with the given coefficients (a0 = 1) in double precision
+	auto cascade = [](const vector<float>& samples, const double* b, const double* a, vector<float>& output){
+		double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+		double u1 = 0, u2 = 0, z1 = 0, z2 = 0;
+		for (float sample : samples){
+			double y = b[0] * sample + b[1] * x1 + b[2] * x2 - a[1] * y1 - a[2] * y2;
+			x2 = x1; x1 = sample; y2 = y1; y1 = y;
+			double z = b[0] * y + b[1] * u1 + b[2] * u2 - a[1] * z1 - a[2] * z2;
+			u2 = u1; u1 = y; z2 = z1; z1 = z;
+			output.push_back(float(z));
+		}
+	};
+	float rate = sampleRate;
+	// The float32 direct form of the filters loses precision towards low cutoffs (about 40 dB SNR at 40 Hz
+	// on white noise), the tolerances only keep an alternate from doing worse than that
+
+	add("Lowpass::processSample", "float64 model", [=](unsigned int seed, vector<float>& output){
+		FilterInput in = input(seed);
+		Lowpass filter(rate);
+		filter.calculate_coefficients(in.cutoff, in.q);
+		for (float sample : in.samples){
+			output.push_back(filter.processSample(sample));
+		}
+	}, [=](unsigned int seed, vector<float>& output){
+		FilterInput in = input(seed);
+		double w = 2.0 * M_PI * in.cutoff;
+		double T = 1.0 / rate;
+		double divisor = 4.0 * in.q + 2.0 * w * T + w * w * in.q * T * T;
+		double b[3], a[3];
+		b[0] = w * w * in.q * T * T / divisor;
+		b[1] = 2.0 * b[0];
+		b[2] = b[0];
+		a[0] = 1.0;
+		a[1] = (2.0 * w * w * in.q * T * T - 8.0 * in.q) / divisor;
+		a[2] = (4.0 * in.q + w * w * in.q * T * T - 2.0 * w * T) / divisor;
+		cascade(in.samples, b, a, output);
+	}, { 5e-3f, 30.0f, 0.2f });
+
+	add("Highpass::processSample", "float64 model", [=](unsigned int seed, vector<float>& output){
+		FilterInput in = input(seed);
+		Highpass filter(rate);
+		filter.calculate_coefficients(in.cutoff, in.q);
+		for (float sample : in.samples){
+			output.push_back(filter.processSample(sample));
+		}
+	}, [=](unsigned int seed, vector<float>& output){
+		FilterInput in = input(seed);
+		double n = tan(M_PI * in.cutoff / rate);
+		double c1 = 1.0 / (1.0 + n / in.q + n * n);
+		double b[3] = { c1, -2.0 * c1, c1 };
+		double a[3] = { 1.0, 2.0 * c1 * (n * n - 1.0), c1 * (1.0 - n / in.q + n * n) };
+		cascade(in.samples, b, a, output);
+	}, { 5e-3f, 30.0f, 0.2f });
+}
+
+void EquivalenceTest::addWindowChecks(){
+	// Golden input: 100 ms at modifier 0.5, randomized: any length and modifier
+	// The reference is set up for another length first, so setLength() recalculates the whole window
+	const char* const names[] = { "Window::setLength hann", "Window::setLength tukey", "Window::setLength gaussian",
+		"Window::setLength trapezoid" };
+	for (int type = 0; type < 4; type++){
+		auto parameters = [](unsigned int seed, int& length, float& modifier){
+			CheckRandom random(seed);
+			length = seed == 0 ? 4410 : int(random.uniform(16.0f, float(MAX_GRAIN_LENGTH)));
+			modifier = seed == 0 ? 0.5f : random.uniform(0.05f, 1.0f);
+		};
+		add(names[type], "float64 model", [=](unsigned int seed, vector<float>& output){
+			int length;
+			float modifier;
+			parameters(seed, length, modifier);
+			window->updateWindow(MAX_GRAIN_LENGTH - length / 2, type, modifier);
+			window->setLength(length);
+			for (int i = 0; i < length; i++){
+				output.push_back(window->getAt(i));
+			}
+		}, [=](unsigned int seed, vector<float>& output){
+			int length;
+			float modifier;
+			parameters(seed, length, modifier);
+			for (int i = 0; i < length; i++){
+				double value = 0.0;
+				if(type == Window::hann){
+					value = 0.5 * (1.0 - cos(2.0 * M_PI * i / double(length - 1)));
+				} else if(type == Window::tukey){
+					value = min(1.0, 1.0 / (2.0 * modifier) * (1.0 - cos(2.0 * M_PI * i / double(length))));
+				} else if(type == Window::gaussian){
+					// Same integer centre as Window
+					double x = (i - length / 2) / (modifier * length / 2.0);
+					value = exp(-0.5 * x * x);
+				} else {
+					double x = double(i) / double(length);
+					double rising = modifier * x;
+					double falling = -modifier * (x - (modifier - 1.0) / modifier) + 1.0;
+					value = x < 0.5 ? min(rising, 1.0) : min(falling, 1.0);
+				}
+				output.push_back(float(value));
+			}
+		}, { 1e-5f, 90.0f, 0.01f });
+	}
+}
+
+unique_ptr<GrainSource> EquivalenceTest::makeSource(SampleFormat storage, unsigned int seed, int variant){
+	QualityTier sourceQuality = quality;
+	sourceQuality.storage = storage;
+	unique_ptr<GrainSource> source(new GrainSource(sourceQuality));
+	CheckRandom random(seed * 2 + variant);
+	// A slightly inharmonic tone on a noise floor
+	float fundamental = random.logUniform(60.0f, 500.0f);
+	float stretch = random.uniform(0.0f, 0.001f);
+	int fftSize = quality.fftSize;
+	for (int hop = 0; hop < quality.sourceHops; hop++){
+		for (int n = 0; n < fftSize; n++){
+			float t = (hop * quality.hopSize + n) / sampleRate;
+			float sample = 0.05f * random.uniform(-1.0f, 1.0f);
+			for (int k = 1; k <= 12 && k * fundamental < 0.45f * sampleRate; k++){
+				sample += sinf(2.0f * M_PI * k * fundamental * sqrtf(1.0f + stretch * k * k) * t) / k;
+			}
+			timeDomain[n].r = sample * 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(fftSize - 1)));
+			timeDomain[n].i = 0.0f;
+		}
+		ne10_fft_c2c_1d_float32_neon (frequencyDomain.data(), timeDomain.data(), sourceCfg, 0);
+		source->writeFrame(hop, frequencyDomain.data());
+	}
+	source->updateBinMajor();
+	return source;
+}
+
+EquivalenceTest::Note EquivalenceTest::noteFor(unsigned int seed){
+	int hopSize = quality.hopSize;
+	if(seed == 0)
+		return { 220.0f, 2 * hopSize, hopSize / 2, 0 };
+	CheckRandom random(seed + 1000);
+	Note note;
+	note.frequency = random.logUniform(60.0f, 2000.0f);
+	note.grainLength = int(random.uniform(float(hopSize), float(4 * hopSize)));
+	note.grainFrequency = max(1, int(note.grainLength * random.uniform(0.125f, 1.0f)));
+	note.scatter = seed % 2 == 0 ? 0 : int(random.uniform(0.0f, 100.0f));
+	return note;
+}
+
+unique_ptr<Voice> EquivalenceTest::makeVoice(SampleFormat storage, const Note& note, bool snapOvertones){
+	QualityTier voiceQuality = quality;
+	voiceQuality.storage = storage;
+	unique_ptr<Voice> voice(new Voice(sampleRate, *window, voiceQuality, VOICE_MODE_FFT));
+	voice->setOvertoneSnapping(snapOvertones);
+	voice->setGrainFrequency(note.grainFrequency);
+	voice->setScatter(note.scatter);
+	voice->setGrainLength(note.grainLength);
+	window->updateWindow(note.grainLength, 0, 0.5f);
+	return voice;
+}
+
+void EquivalenceTest::playVoice(vector<unique_ptr<Voice>>& voices, vector<float>& output){
+	bool pending = true;
+	while(pending){
+		pending = false;
+		for (auto& voice : voices){
+			if(voice->synthesiseAhead(1))
+				pending = true;
+		}
+	}
+	for (int n = 0; n < 2 * quality.sourceSamples(); n++){
+		output.push_back(voices.back()->play());
+	}
+}
+
+void EquivalenceTest::addVoiceChecks(){
+	// The last voice plays the note of the seed from the first source variant; rand() is seeded right before its
+	// noteOn in every kernel, so scattered grains start at the same positions
+	auto single = [=](SampleFormat storage, bool snap){
+		return [=](unsigned int seed, vector<float>& output){
+			Note note = noteFor(seed);
+			unique_ptr<GrainSource> source = makeSource(storage, seed, 0);
+			vector<unique_ptr<Voice>> voices;
+			voices.push_back(makeVoice(storage, note, snap));
+			srand(seed);
+			voices.back()->noteOn(*source, note.frequency, note.grainLength);
+			playVoice(voices, output);
+		};
+	};
+
+	// Compact voice buffers and spectra
+	for (int format = SAMPLE_FORMAT_FLOAT16; format < NUM_SAMPLE_FORMATS; format++){
+		add("Voice::play", string("storage ") + SAMPLE_FORMAT_NAMES[format], single(SAMPLE_FORMAT_FLOAT32, false),
+			single(SampleFormat(format), false), { 1e-3f, 55.0f, 0.5f });
+	}
+
+	// A voice moved to a new source resynthesises exactly what a note started on it does
+	for (int snap = 0; snap < 2; snap++){
+		add("Voice::updateGrainSrcBuffer", snap ? "snapped overtones" : "nominal overtones", single(SAMPLE_FORMAT_FLOAT32, snap),
+			[=](unsigned int seed, vector<float>& output){
+			Note note = noteFor(seed);
+			unique_ptr<GrainSource> previous = makeSource(SAMPLE_FORMAT_FLOAT32, seed, 1);
+			unique_ptr<GrainSource> source = makeSource(SAMPLE_FORMAT_FLOAT32, seed, 0);
+			vector<unique_ptr<Voice>> voices;
+			voices.push_back(makeVoice(SAMPLE_FORMAT_FLOAT32, note, snap));
+			srand(seed);
+			voices.back()->noteOn(*previous, note.frequency, note.grainLength);
+			voices.back()->updateGrainSrcBuffer(*source);
+			playVoice(voices, output);
+		}, { 0.0f, INFINITY, 0.0f });
+	}
+
+	// Batched preparation (shared overtone lines) and the lane-interleaved inverse FFTs against a voice on its own
+	// The other voices play the octave, the fifth and the major third and come first in the batch, so the checked
+	// voice copies the bins it shares with them from their lines and takes the last lane of every transform
+	// Not exact on Bela: the lanes run another FFT than the NE10 one of the reference
+	for (int snap = 0; snap < 2; snap++){
+		add("Voice::synthesiseRounds", snap ? "snapped overtones" : "nominal overtones", single(SAMPLE_FORMAT_FLOAT32, snap),
+			[=](unsigned int seed, vector<float>& output){
+			Note note = noteFor(seed);
+			unique_ptr<GrainSource> source = makeSource(SAMPLE_FORMAT_FLOAT32, seed, 0);
+			vector<unique_ptr<Voice>> voices;
+			vector<Voice*> lanes;
+			const float intervals[LANE_FFT_LANES] = { 2.0f, 1.5f, 1.25f, 1.0f };
+			for (int v = 0; v < LANE_FFT_LANES; v++){
+				voices.push_back(makeVoice(SAMPLE_FORMAT_FLOAT32, note, snap));
+				lanes.push_back(voices.back().get());
+				if(v == LANE_FFT_LANES - 1)
+					srand(seed);
+				voices.back()->noteOn(*source, intervals[v] * note.frequency, note.grainLength);
+			}
+			Voice::prepareBatch(voices, pool);
+			Voice::synthesiseRounds(lanes, pool);
+			playVoice(voices, output);
+		}, { 1e-4f, 90.0f, 0.01f });
+	}
+}
+
+EquivalenceTest::~EquivalenceTest(){
+	NE10_FREE(spectrumCfg);
+	NE10_FREE(sourceCfg);
+}
@@ -0,0 +1,123 @@
+/*****
+ * EquivalenceTest.h
+ * Numerical equivalence of alternate DSP paths with the reference implementations
+ *
+ * Every check runs a reference kernel and an alternate one on the same input: a fixed golden input
+ * (seed 0, e.g. an impulse or a fixed note) and a number of randomized ones (seeds 1...), and compares
+ * their outputs by the largest absolute sample error, the signal to error ratio and the log spectral
+ * distance of their averaged power spectra. A check passes if the worst input stays within the
+ * tolerances of the kernel.
+ * The built-in checks cover the filters and grain windows against float64 models, the compact storage
+ * formats of the voices against float32 and the batched / switched voice preparation (with the
+ * lane-interleaved inverse FFTs) against preparing every voice on its own. An optimised kernel is checked by adding it next to its reference with add().
+ * Runs without the audio device (--verify), like the StressTest benchmarks, and needs no Bela at all:
+ * host/Makefile builds it with the kernels it checks for any Linux machine
+*****/
+#ifndef EQUIVALENCE_TEST_H
+#define EQUIVALENCE_TEST_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+#include <libraries/ne10/NE10.h>
+#include "Constants.h"
+#include "WorkerPool.h"
+
+class Voice;
+class Window;
+class GrainSource;
+
+// Number of randomized inputs of every check (besides the golden one)
+const int EQUIVALENCE_RANDOM_RUNS = 8;
+// Frame size of the spectra compared by the spectral distance
+const int EQUIVALENCE_SPECTRUM_SIZE = 2048;
+// Bins more than this far (dB) below the strongest bin of the reference are left out of the spectral distance
+const float EQUIVALENCE_SPECTRUM_FLOOR = 100.0f;
+// Hops of the grain sources the voice checks play from (short, so that the checks stay quick)
+const int EQUIVALENCE_SOURCE_HOPS = 8;
+
+// The alternate output has to stay within all three limits against the reference
+struct EquivalenceTolerance {
+	// Largest absolute difference of any sample
+	float maxAbsError;
+	// Minimum signal to error ratio in dB
+	float minSnr;
+	// Largest log spectral distance in dB
+	float maxSpectralDistance;
+};
+
+struct EquivalenceResult {
+	float maxAbsError = 0.0f;
+	// INFINITY if the outputs are identical
+	float snr = 0.0f;
+	float spectralDistance = 0.0f;
+};
+
+class EquivalenceTest {
+	public:
+		// Output of a kernel for the input of the given seed (0 = golden input, the same for every run)
+		typedef std::function<void(unsigned int seed, std::vector<float>& output)> Kernel;
+
+		// The voice checks use the FFT size and hop size of the given tier with EQUIVALENCE_SOURCE_HOPS hops
+		EquivalenceTest(float sampleRate, const QualityTier& quality);
+		~EquivalenceTest();
+
+		// Check alternate against reference with the given tolerances
+		void add(const std::string& kernel, const std::string& alternate, Kernel reference, Kernel alternateKernel,
+			const EquivalenceTolerance& tolerance);
+
+		// Run every check on the golden input and numRandomRuns randomized ones and print the worst result of each
+		// Returns true if all checks passed
+		bool run(int numRandomRuns);
+
+		// Compare an output with the reference output (the longer one is cut to the shorter one)
+		EquivalenceResult compare(const std::vector<float>& reference, const std::vector<float>& output);
+
+	private:
+		float sampleRate;
+		QualityTier quality;
+
+		struct Check {
+			std::string kernel;
+			std::string alternate;
+			Kernel reference;
+			Kernel alternateKernel;
+			EquivalenceTolerance tolerance;
+		};
+		std::vector<Check> checks;
+
+		// Forward FFT of the spectral distance (and of the grain sources, which use their own plan)
+		ne10_fft_cfg_float32_t spectrumCfg;
+		ne10_fft_cfg_float32_t sourceCfg;
+		std::vector<ne10_fft_cpx_float32_t> timeDomain;
+		std::vector<ne10_fft_cpx_float32_t> frequencyDomain;
+		// Hann windowed power spectrum of output averaged over frames of EQUIVALENCE_SPECTRUM_SIZE samples
+		std::vector<double> powerSpectrum(const std::vector<float>& output, size_t length);
+
+		// Grain window shared by the voices of a check
+		std::unique_ptr<Window> window;
+		WorkerPool pool;
+
+		// Built-in checks
+		void addFilterChecks();
+		void addWindowChecks();
+		void addVoiceChecks();
+
+		// Grain source with a few partials and some noise (variant picks another set of partials), fully indexed
+		std::unique_ptr<GrainSource> makeSource(SampleFormat storage, unsigned int seed, int variant);
+		// Note of the voice checks for a seed: frequency, grain length and distance, scatter
+		struct Note {
+			float frequency;
+			int grainLength;
+			int grainFrequency;
+			int scatter;
+		};
+		Note noteFor(unsigned int seed);
+		// Voice of the given storage set up for the note, with the grain window set to its grain length
+		std::unique_ptr<Voice> makeVoice(SampleFormat storage, const Note& note, bool snapOvertones);
+		// Synthesise everything the grains of the voices need and play the last voice for two source spans
+		void playVoice(std::vector<std::unique_ptr<Voice>>& voices, std::vector<float>& output);
+};
+
+#endif
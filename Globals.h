@@ -5,14 +5,36 @@
 *****/
 #ifndef GLOBALS_H
 #define GLOBALS_H
+#include <vector>
+#include <string>
+#include "Constants.h"
 #include "SampleData.h"
+#include "SongLibrary.h"
 
-// Lengths of the files loaded in main.cpp in samples
-extern int FILE_LENGTH1;
-extern int FILE_LENGTH2;
-extern int FILE_LENGTH3;
+// Library of source songs, scanned in main.cpp
+extern SongLibrary gSongLibrary;
 
-// Songs
-extern SampleData songs[3];
+// Analysis quality tier (FFT size, hop size and grain source span), chosen in main.cpp
+// and switched from the GUI by the engine rebuild task in render.cpp
+extern QualityTier gQuality;
+// How the voices of the engines extract the overtones at startup (FFT resynthesis or resonator bank),
+// chosen with --voice-mode, the GUI switches it per engine (EngineParameters::voiceMode)
+extern VoiceMode gVoiceMode;
+// Whether the song is analysed at every quality tier's resolution for the matching registers (--single-resolution turns it off)
+extern bool gMultiResolution;
+// Whether the voices move their overtones onto the spectral peaks of the grain source (--nominal-overtones turns it off)
+extern bool gSnapOvertones;
+// Interpolation of grains playing at a rate other than 1, chosen with --interpolation and in the GUI
+extern InterpolationKernel gInterpolation;
+// Number of helper threads for the analysis and the voice synthesis (-1: one per core besides the task using them)
+extern int gWorkerThreads;
+// MIDI channel and key range of every engine instance (layer) render.cpp creates, set with --layer
+// (one engine for all channels and notes if none is given)
+extern std::vector<EngineRoute> gEngineRoutes;
+// Recording of the output (see Recorder): path prefix of the files (empty: no recording), their format
+// and the length of one file in seconds, set with --record, --record-format and --record-rotate
+extern std::string gRecordPath;
+extern RecordFormat gRecordFormat;
+extern float gRecordRotateSeconds;
 
 #endif
\ No newline at end of file
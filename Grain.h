@@ -4,6 +4,9 @@
  * Defined via its start index in the buffer from its voice
  * and a length in samples
 *****/
+#ifndef GRAIN_H
+#define GRAIN_H
+
 #include "Constants.h"
 #include <array>
 
@@ -18,10 +21,21 @@ class Grain {
 		// The length of the grain in samples
 		int length = 0;
 		
+		// Gain of this grain on every output channel, calculated when it starts
+		// (zero on the channels the voice does not use)
+		float gains[MAX_OUTPUT_CHANNELS] = {};
+		
+		// Playback rate of this grain (1 reads one buffer sample per output sample), set when it starts
+		float rate = 1.0f;
+		// Fractional part of the read position (the integer part is the grain position of the voice)
+		float fraction = 0.0f;
+		
 		Grain();
 		Grain(int length);
 		
 		void updateLength(int length);
 		
 		~Grain();
-};
\ No newline at end of file
+};
+
+#endif
@@ -0,0 +1,164 @@
+/***** GrainPyramid.cpp *****/
+#include "GrainPyramid.h"
+#include "Trace.h"
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+GrainPyramid::GrainPyramid(const QualityTier& base, float sampleRate, bool multiResolution, WorkerPool& pool)
+	: sampleRate (sampleRate), pool (pool) {
+	int span = base.sourceSamples();
+	for (int i = 0; i < NUM_QUALITY_TIERS; i++){
+		bool isBase = QUALITY_TIERS[i].fftSize == base.fftSize && QUALITY_TIERS[i].hopSize == base.hopSize;
+		if(!multiResolution && !isBase)
+			continue;
+		if(isBase)
+			baseLevel = levels.size();
+		
+		std::unique_ptr<Level> level(new Level());
+		level->quality = isBase ? base : QUALITY_TIERS[i];
+		level->quality.storage = base.storage;
+		level->quality.binMajor = base.binMajor;
+		// Round up so that every level covers at least the span of the base tier
+		level->quality.sourceHops = (span + level->quality.hopSize - 1) / level->quality.hopSize;
+		level->source.reset(new GrainSource(level->quality));
+		// Nothing analysed yet
+		level->source->setReady(false);
+		
+		int fftSize = level->quality.fftSize;
+		for (int worker = 0; worker < pool.getNumWorkers(); worker++){
+			level->cfgs.push_back(ne10_fft_alloc_c2c_float32_neon (fftSize));
+			level->timeDomains.push_back((ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t)));
+			level->frequencyDomains.push_back((ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t)));
+		}
+		level->window.resize(fftSize);
+		for(int n = 0; n < fftSize; n++) {
+			level->window[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(fftSize - 1)));
+		}
+		level->minFrequency = PYRAMID_BINS_PER_HARMONIC * sampleRate / fftSize;
+		levels.push_back(std::move(level));
+	}
+}
+
+int GrainPyramid::getNumLevels(){
+	return levels.size();
+}
+
+int GrainPyramid::levelFor(float frequency){
+	if(frequency <= NOT_PLAYING)
+		return baseLevel;
+	// Levels are ordered by FFT size, the first one fine enough wins
+	for (int i = 0; i < int(levels.size()); i++){
+		if(frequency >= levels[i]->minFrequency)
+			return i;
+	}
+	return levels.size() - 1;
+}
+
+GrainSource& GrainPyramid::getLevel(int level){
+	return *levels[level]->source;
+}
+
+bool GrainPyramid::request(int level){
+	return !levels[level]->requested.exchange(true);
+}
+
+void GrainPyramid::update(const SampleData& data, int startIdx, AnalysisCache* analysis, const bool* levelsInUse, bool* analysed){
+	for (int i = 0; i < int(levels.size()); i++){
+		Level& level = *levels[i];
+		analysed[i] = false;
+		bool wanted = level.requested.exchange(false) || levelsInUse[i];
+		if(level.analysedData == &data && level.analysedPosition == startIdx && level.source->isReady())
+			continue;
+		// Not played right now: analysed when a note in its register arrives
+		if(!wanted){
+			level.source->setReady(false);
+			continue;
+		}
+		
+		auto start = std::chrono::steady_clock::now();
+		analyse(level, data, startIdx, i == baseLevel ? analysis : nullptr);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		level.analysedData = &data;
+		level.analysedPosition = startIdx;
+		level.source->setReady(true);
+		analysed[i] = true;
+		
+		level.analyses++;
+		level.totalMs += ms;
+		level.maxMs = std::max(level.maxMs, ms);
+	}
+}
+
+void GrainPyramid::analyse(Level& level, const SampleData& data, int startIdx, AnalysisCache* analysis){
+	GrainSource& source = *level.source;
+	int fftSize = level.quality.fftSize;
+	int hopSize = level.quality.hopSize;
+	
+	// With a valid analysis cache the frames are copied from disk, no FFT needed
+	// (the source position snaps to the nearest hop)
+	if(analysis != nullptr){
+		TRACE_SCOPE("cached-analysis");
+		int firstFrame = (startIdx + hopSize / 2) / hopSize;
+		pool.run(level.quality.sourceHops, [&](int worker, int hop){
+			analysis->fill(source, firstFrame, hop, level.frequencyDomains[worker]);
+		});
+		source.updateBinMajor();
+		level.cachedAnalyses++;
+		return;
+	}
+	
+	TRACE_BEGIN("forward-fft-batch");
+	// The hops are independent: every worker transforms the hops it takes with its own plan and buffer
+	pool.run(level.quality.sourceHops, [&](int worker, int hop){
+		ne10_fft_cpx_float32_t* timeDomain = level.timeDomains[worker];
+		// Copy part of sample buffer into FFT input from given start index
+		int currentStart = hop * hopSize;
+		for(int n = 0; n < fftSize; n++) {
+			int sampleIdx = startIdx + currentStart + n;
+			float sample = sampleIdx < data.sampleLen ? data.samples[sampleIdx] : 0.0f;
+			timeDomain[n].r = (ne10_float32_t) (sample * level.window[n]);
+			timeDomain[n].i = 0;
+		}
+		
+		// Perform FFT -> indicated by the "0" for the last function parameter 
+		ne10_fft_c2c_1d_float32_neon (level.frequencyDomains[worker], timeDomain, level.cfgs[worker], 0);
+		// Store the frame and index its peaks while it is still in the cache of this worker
+		source.writeFrame(hop, level.frequencyDomains[worker]);
+	});
+	TRACE_END("forward-fft-batch");
+	
+	// Transposed view so voices can read each overtone bin as one contiguous line
+	int numRanges = (fftSize + PYRAMID_TRANSPOSE_BINS - 1) / PYRAMID_TRANSPOSE_BINS;
+	pool.run(numRanges, [&](int, int range){
+		source.updateBinMajor(range * PYRAMID_TRANSPOSE_BINS, (range + 1) * PYRAMID_TRANSPOSE_BINS);
+	});
+}
+
+void GrainPyramid::printStatistics(){
+	int last = levels.size() - 1;
+	for (int i = 0; i <= last; i++){
+		Level& level = *levels[i];
+		// Fundamentals played from the level (see levelFor()), the largest FFT takes everything below
+		float lower = i == last ? 0.0f : level.minFrequency;
+		float upper = i == 0 ? 0.5f * sampleRate : levels[i - 1]->minFrequency;
+		printf("Analysis FFT %d / hop %d (notes %.0f - %.0f Hz): %d analyses (%d from cache), mean %.2f ms, max %.2f ms, total %.1f ms\n",
+			level.quality.fftSize, level.quality.hopSize, lower, upper, level.analyses, level.cachedAnalyses,
+			level.analyses > 0 ? level.totalMs / level.analyses : 0.0, level.maxMs, level.totalMs);
+	}
+}
+
+GrainPyramid::~GrainPyramid(){
+	for (auto& level : levels){
+		for (auto cfg : level->cfgs){
+			NE10_FREE(cfg);
+		}
+		for (auto timeDomain : level->timeDomains){
+			NE10_FREE(timeDomain);
+		}
+		for (auto frequencyDomain : level->frequencyDomains){
+			NE10_FREE(frequencyDomain);
+		}
+	}
+}
@@ -0,0 +1,98 @@
+/*****
+ * GrainPyramid.h
+ * Multi-resolution grain source: the current slice of the song analysed with several FFT sizes
+ *
+ * Every level uses one of the QUALITY_TIERS, with as many hops as it takes to cover the span of the
+ * base tier, so a voice synthesises the same buffer length from any level. Low notes need the
+ * fine frequency resolution of the large FFTs to keep their overtones in separate bins, high notes
+ * get by with the small ones (and a better time resolution).
+ * Levels are analysed lazily: for a new source position only the levels voices are playing from
+ * are analysed, the others are marked as not ready and analysed once a note in their register arrives.
+ * The hops of a level are transformed on all threads of a WorkerPool, each with its own FFT plan and input buffer
+*****/
+#ifndef GRAIN_PYRAMID_H
+#define GRAIN_PYRAMID_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <libraries/ne10/NE10.h>
+#include "Constants.h"
+#include "SampleData.h"
+#include "GrainSource.h"
+#include "AnalysisCache.h"
+#include "WorkerPool.h"
+
+// Minimum number of bins between neighbouring overtones (i.e. per fundamental) a level has to resolve
+// for a note to be played from it, the largest level is used for everything below
+const float PYRAMID_BINS_PER_HARMONIC = 8.0f;
+
+// Number of bins per piece of work when the bin-major view is rebuilt on the worker pool
+const int PYRAMID_TRANSPOSE_BINS = 256;
+
+class GrainPyramid {
+	public:
+		// One level per quality tier covering the span of the base tier
+		// (only the base tier if multiResolution is false)
+		// The analysis runs on the threads of pool (which has to outlive the pyramid)
+		GrainPyramid(const QualityTier& base, float sampleRate, bool multiResolution, WorkerPool& pool);
+		~GrainPyramid();
+
+		int getNumLevels();
+
+		// Smallest level that resolves the overtones of the given fundamental
+		int levelFor(float frequency);
+
+		// Grain source of a level
+		GrainSource& getLevel(int level);
+
+		// Ask for a level to be analysed by the next update()
+		// Never blocks, called from the audio thread. Returns false if the level was requested already
+		bool request(int level);
+
+		// Analyse the slice of data starting at startIdx for the requested levels and the levels in use
+		// (levelsInUse holds one flag per level) unless they hold that slice already
+		// All other levels that do not hold the slice are marked as not ready
+		// analysis is the cache of the song for the base tier (nullptr if there is none)
+		// Sets analysed[level] for every level that was rewritten
+		void update(const SampleData& data, int startIdx, AnalysisCache* analysis, const bool* levelsInUse, bool* analysed);
+
+		// Print the number of analyses and their cost for every level (register)
+		void printStatistics();
+
+	private:
+		struct Level {
+			QualityTier quality;
+			std::unique_ptr<GrainSource> source;
+			// Forward FFT with a Hann window, one plan and input and output buffer per worker of the pool
+			// (NE10 plans keep scratch data, so they cannot be shared between threads)
+			std::vector<ne10_fft_cfg_float32_t> cfgs;
+			std::vector<float> window;
+			std::vector<ne10_fft_cpx_float32_t*> timeDomains;
+			std::vector<ne10_fft_cpx_float32_t*> frequencyDomains;
+			// Lowest fundamental played from this level
+			float minFrequency = 0.0f;
+			// Set by request(), cleared by update()
+			std::atomic<bool> requested;
+			// Slice the source holds
+			const SampleData* analysedData = nullptr;
+			int analysedPosition = -1;
+			// Statistics
+			int analyses = 0;
+			int cachedAnalyses = 0;
+			double totalMs = 0.0;
+			double maxMs = 0.0;
+
+			Level() : requested (false) {}
+		};
+		std::vector<std::unique_ptr<Level>> levels;
+		// Level of the base tier (the only one the analysis cache fits)
+		int baseLevel = 0;
+		float sampleRate;
+		WorkerPool& pool;
+
+		// Fill the source of a level from the cache or with one forward FFT per hop
+		void analyse(Level& level, const SampleData& data, int startIdx, AnalysisCache* analysis);
+};
+
+#endif
@@ -0,0 +1,242 @@
+/***** GrainSource.cpp *****/
+#include "GrainSource.h"
+#include "CompactBuffer.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Alignment of the slabs (one cache line)
+const int GRAIN_SOURCE_ALIGNMENT = 64;
+
+// Tile size used for the cache friendly transposition in updateBinMajor()
+const int TRANSPOSE_TILE = 32;
+
+static void* allocateSlab(const QualityTier& quality, int bytesPerValue){
+	void* slab = nullptr;
+	if(posix_memalign(&slab, GRAIN_SOURCE_ALIGNMENT, quality.sourceHops * quality.fftSize * bytesPerValue) != 0)
+		return nullptr;
+	return slab;
+}
+
+GrainSource::GrainSource(const QualityTier& quality)
+	: quality (quality), oldestSlot (0), ready (true) {
+	if(quality.storage == SAMPLE_FORMAT_FLOAT32){
+		frames = (ne10_fft_cpx_float32_t*) allocateSlab(quality, sizeof(ne10_fft_cpx_float32_t));
+		if(quality.binMajor)
+			binMajor = (ne10_fft_cpx_float32_t*) allocateSlab(quality, sizeof(ne10_fft_cpx_float32_t));
+	} else {
+		framesHalf = (uint16_t*) allocateSlab(quality, 2 * sizeof(uint16_t));
+		if(quality.binMajor)
+			binMajorHalf = (uint16_t*) allocateSlab(quality, 2 * sizeof(uint16_t));
+	}
+	maxPeaks = quality.numBins() / 2;
+	peaks.resize(quality.sourceHops * maxPeaks);
+	numPeaks.resize(quality.sourceHops);
+	clear();
+}
+
+void GrainSource::setBinMajor(int index, const ne10_fft_cpx_float32_t& value){
+	if(binMajor != nullptr){
+		binMajor[index] = value;
+	} else if(binMajorHalf != nullptr){
+		binMajorHalf[2 * index] = floatToHalf(value.r);
+		binMajorHalf[2 * index + 1] = floatToHalf(value.i);
+	}
+}
+
+const QualityTier& GrainSource::getQuality(){
+	return quality;
+}
+
+int GrainSource::slotOf(int hop){
+	return (oldestSlot.load(std::memory_order_acquire) + hop) % quality.sourceHops;
+}
+
+void GrainSource::writeFrame(int hop, const ne10_fft_cpx_float32_t* spectrum){
+	int fftSize = quality.fftSize;
+	int slot = slotOf(hop);
+	if(frames != nullptr){
+		std::copy(spectrum, spectrum + fftSize, frames + slot * fftSize);
+	} else {
+		uint16_t* frame = framesHalf + 2 * slot * fftSize;
+		for (int k = 0; k < fftSize; k++){
+			frame[2 * k] = floatToHalf(spectrum[k].r);
+			frame[2 * k + 1] = floatToHalf(spectrum[k].i);
+		}
+	}
+	// Peaks from the full precision spectrum while it is in the cache
+	indexPeaks(slot, spectrum);
+}
+
+ne10_fft_cpx_float32_t GrainSource::getBin(int hop, int bin){
+	int index = slotOf(hop) * quality.fftSize + bin;
+	if(frames != nullptr)
+		return frames[index];
+	ne10_fft_cpx_float32_t value;
+	value.r = halfToFloat(framesHalf[2 * index]);
+	value.i = halfToFloat(framesHalf[2 * index + 1]);
+	return value;
+}
+
+void GrainSource::copyBinLine(int bin, ne10_fft_cpx_float32_t* destination){
+	// Oldest hop first: the line from the oldest slot to the end, then from the start
+	int numHops = quality.sourceHops;
+	int oldest = oldestSlot.load(std::memory_order_acquire);
+	if(binMajor != nullptr){
+		const ne10_fft_cpx_float32_t* line = binMajor + bin * numHops;
+		std::copy(line + oldest, line + numHops, destination);
+		std::copy(line, line + oldest, destination + numHops - oldest);
+	} else if(binMajorHalf != nullptr){
+		const uint16_t* line = binMajorHalf + 2 * bin * numHops;
+		for (int hop = 0; hop < numHops; hop++){
+			int slot = (oldest + hop) % numHops;
+			destination[hop].r = halfToFloat(line[2 * slot]);
+			destination[hop].i = halfToFloat(line[2 * slot + 1]);
+		}
+	} else {
+		// No view: one value from every frame, each on its own cache line
+		int fftSize = quality.fftSize;
+		for (int hop = 0; hop < numHops; hop++){
+			int index = ((oldest + hop) % numHops) * fftSize + bin;
+			if(frames != nullptr){
+				destination[hop] = frames[index];
+			} else {
+				destination[hop].r = halfToFloat(framesHalf[2 * index]);
+				destination[hop].i = halfToFloat(framesHalf[2 * index + 1]);
+			}
+		}
+	}
+}
+
+void GrainSource::updateBinMajor(){
+	updateBinMajor(0, quality.fftSize);
+}
+
+void GrainSource::updateBinMajor(int binBegin, int binEnd){
+	if(binMajor == nullptr && binMajorHalf == nullptr)
+		return;
+	int numHops = quality.sourceHops;
+	int fftSize = quality.fftSize;
+	binEnd = std::min(binEnd, fftSize);
+	// Transpose tile by tile so that both the reads and the writes stay within a few cache lines
+	for (int hopTile = 0; hopTile < numHops; hopTile += TRANSPOSE_TILE){
+		int hopEnd = std::min(hopTile + TRANSPOSE_TILE, numHops);
+		for (int binTile = binBegin; binTile < binEnd; binTile += TRANSPOSE_TILE){
+			int tileEnd = std::min(binTile + TRANSPOSE_TILE, binEnd);
+			for (int hop = hopTile; hop < hopEnd; hop++){
+				if(frames != nullptr){
+					const ne10_fft_cpx_float32_t* src = frames + hop * fftSize;
+					for (int k = binTile; k < tileEnd; k++){
+						binMajor[k * numHops + hop] = src[k];
+					}
+				} else {
+					// Both views are in half precision, a value moves as one 32 bit word
+					const uint32_t* src = (const uint32_t*) framesHalf + hop * fftSize;
+					uint32_t* dst = (uint32_t*) binMajorHalf;
+					for (int k = binTile; k < tileEnd; k++){
+						dst[k * numHops + hop] = src[k];
+					}
+				}
+			}
+		}
+	}
+}
+
+void GrainSource::indexPeaks(int slot, const ne10_fft_cpx_float32_t* frame){
+	int numBins = quality.numBins();
+	auto power = [frame](int k){ return frame[k].r * frame[k].r + frame[k].i * frame[k].i; };
+	
+	float maxPower = 0.0f;
+	for (int k = 1; k < numBins - 1; k++){
+		maxPower = std::max(maxPower, power(k));
+	}
+	float floor = maxPower * PEAK_INDEX_FLOOR * PEAK_INDEX_FLOOR;
+	
+	// Maxima are strictly above their lower neighbour, so there is at most one per two bins
+	SpectralPeak* slotPeaks = &peaks[slot * maxPeaks];
+	int count = 0;
+	float previous = power(0);
+	float current = power(1);
+	for (int k = 1; k < numBins - 1 && count < maxPeaks; k++){
+		float next = power(k + 1);
+		if(current > previous && current >= next && current > floor){
+			// Vertex of the parabola through the log magnitudes (the log powers give the same vertex)
+			float a = logf(previous + 1e-20f);
+			float b = logf(current);
+			float c = logf(next + 1e-20f);
+			float curvature = a - 2.0f * b + c;
+			float offset = curvature < 0.0f ? 0.5f * (a - c) / curvature : 0.0f;
+			slotPeaks[count].bin = k;
+			slotPeaks[count].magnitude = floatToHalf(sqrtf(current));
+			slotPeaks[count].frequency = k + offset;
+			count++;
+		}
+		previous = current;
+		current = next;
+	}
+	numPeaks[slot] = count;
+}
+
+const SpectralPeak* GrainSource::findPeak(int hop, float bin, float maxDistance){
+	int slot = slotOf(hop);
+	const SpectralPeak* begin = &peaks[slot * maxPeaks];
+	const SpectralPeak* end = begin + numPeaks[slot];
+	// Peaks are sorted by bin and at least two bins apart, so their frequencies are sorted as well
+	const SpectralPeak* peak = std::lower_bound(begin, end, bin - maxDistance, [](const SpectralPeak& p, float frequency){
+		return p.frequency < frequency;
+	});
+	// The strongest one in range: a weak neighbour closer to the overtone is more likely noise or a sidelobe
+	// (non-negative half precision values sort like their bit patterns)
+	const SpectralPeak* strongest = nullptr;
+	for (; peak != end && peak->frequency <= bin + maxDistance; peak++){
+		if(strongest == nullptr || peak->magnitude > strongest->magnitude)
+			strongest = peak;
+	}
+	return strongest;
+}
+
+int GrainSource::getNumPeaks(int hop){
+	return numPeaks[slotOf(hop)];
+}
+
+void GrainSource::pushFrame(const ne10_fft_cpx_float32_t* spectrum){
+	int numHops = quality.sourceHops;
+	int fftSize = quality.fftSize;
+	// One column of the bin-major view changes, the rest stays in place
+	int slot = oldestSlot.load(std::memory_order_relaxed);
+	writeFrame(0, spectrum);
+	for (int k = 0; k < fftSize; k++){
+		setBinMajor(k * numHops + slot, spectrum[k]);
+	}
+	oldestSlot.store((slot + 1) % numHops, std::memory_order_release);
+}
+
+void GrainSource::clear(){
+	oldestSlot = 0;
+	std::fill(numPeaks.begin(), numPeaks.end(), 0);
+	size_t values = (size_t) quality.sourceHops * quality.fftSize;
+	if(frames != nullptr)
+		memset(frames, 0, values * sizeof(ne10_fft_cpx_float32_t));
+	if(binMajor != nullptr)
+		memset(binMajor, 0, values * sizeof(ne10_fft_cpx_float32_t));
+	if(framesHalf != nullptr)
+		memset(framesHalf, 0, values * 2 * sizeof(uint16_t));
+	if(binMajorHalf != nullptr)
+		memset(binMajorHalf, 0, values * 2 * sizeof(uint16_t));
+}
+
+bool GrainSource::isReady(){
+	return ready.load(std::memory_order_acquire);
+}
+
+void GrainSource::setReady(bool ready){
+	this->ready.store(ready, std::memory_order_release);
+}
+
+GrainSource::~GrainSource(){
+	free(frames);
+	free(framesHalf);
+	free(binMajor);
+	free(binMajorHalf);
+}
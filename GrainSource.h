@@ -0,0 +1,111 @@
+/*****
+ * GrainSource.h
+ * Frequency domain representation of the current slice of the source material
+ * (sourceHops hops of fftSize bins each, sized from the quality tier) that the voices mask on noteOn events
+ *
+ * All frames live in one contiguous, cache line aligned slab (hop-major)
+ * An optional bin-major (transposed) copy (quality.binMajor) stores the sourceHops values of every bin
+ * next to each other, so a voice extracting its overtones only reads one contiguous line per overtone
+ * instead of one value from each of the sourceHops frames
+ * With a compact storage format (quality.storage) both slabs are kept in half precision,
+ * so the source takes 8 instead of 16 bytes per value
+ *
+ * The hops can also be used as a ring (live input): pushFrame() overwrites the oldest hop and
+ * makes it the newest one, so hop 0 is always the oldest frame and the view never has to be rebuilt
+ *
+ * Every frame also gets an index of its spectral peaks (local magnitude maxima, sorted by bin) with
+ * their interpolated frequency, so a voice can move each overtone onto the partial actually present
+ * in the source with a binary search instead of peak-picking the frame itself
+*****/
+#ifndef GRAIN_SOURCE_H
+#define GRAIN_SOURCE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <libraries/ne10/NE10.h>
+#include "Constants.h"
+
+// Peaks weaker than this fraction of the strongest magnitude of their frame (-60 dB) are not indexed
+const float PEAK_INDEX_FLOOR = 0.001f;
+
+// Local magnitude maximum of a frame
+struct SpectralPeak {
+	// Bin of the maximum
+	uint16_t bin;
+	// Magnitude in half precision
+	uint16_t magnitude;
+	// Frequency in bins, interpolated with a parabola through the log magnitudes around the maximum
+	float frequency;
+};
+
+class GrainSource {
+	public:
+		GrainSource(const QualityTier& quality);
+		~GrainSource();
+
+		// Tier the frames were sized for
+		const QualityTier& getQuality();
+
+		// Store the fftSize bins of the given hop (hop-major storage) and index its peaks
+		// (different hops can be written on several threads)
+		void writeFrame(int hop, const ne10_fft_cpx_float32_t* spectrum);
+		// Value of a bin of the given hop (hop-major storage)
+		ne10_fft_cpx_float32_t getBin(int hop, int bin);
+
+		// Copy the sourceHops values (one per hop, oldest first) of the given bin
+		// Only valid after updateBinMajor() was called for the current frames (gathered from the frames without the view)
+		void copyBinLine(int bin, ne10_fft_cpx_float32_t* destination);
+
+		// Rebuild the bin-major view from the frames (nothing to do without the view)
+		// Must be called after the frames have been rewritten
+		void updateBinMajor();
+		// Rebuild the lines of the bins in [binBegin, binEnd) only
+		// (disjoint ranges can be rebuilt on several threads at the same time)
+		void updateBinMajor(int binBegin, int binEnd);
+
+		// Strongest peak of the given hop within maxDistance bins of the (fractional) bin position,
+		// nullptr if there is none. Binary search on the peaks of the hop
+		const SpectralPeak* findPeak(int hop, float bin, float maxDistance);
+		// Number of peaks indexed for the given hop
+		int getNumPeaks(int hop);
+
+		// Replace the oldest frame with a new one (frames, bin-major view and peak index) and make it the newest
+		void pushFrame(const ne10_fft_cpx_float32_t* spectrum);
+
+		// Set all frames (and the bin-major view) to zero
+		void clear();
+
+		// Whether the frames hold the current slice (voices wait with their preparation while they do not)
+		// Sources are ready from the start, GrainPyramid marks levels that are analysed lazily
+		bool isReady();
+		void setReady(bool ready);
+
+	private:
+		QualityTier quality;
+		// Hop-major slab: frames[hop * fftSize + bin]
+		ne10_fft_cpx_float32_t* frames = nullptr;
+		// Half precision hop-major slab instead of frames (compact storage): real and imaginary part of every value
+		uint16_t* framesHalf = nullptr;
+		// Bin-major slab: binMajor[bin * sourceHops + hop] (neither bin-major slab without quality.binMajor)
+		ne10_fft_cpx_float32_t* binMajor = nullptr;
+		// Half precision bin-major slab instead of binMajor (compact storage): real and imaginary part of every value
+		uint16_t* binMajorHalf = nullptr;
+		// Write one value of the bin-major view
+		void setBinMajor(int index, const ne10_fft_cpx_float32_t& value);
+		// Peak index: peaks[slot * maxPeaks + i] for i < numPeaks[slot], sorted by bin
+		// (a frame has at most one maximum per two bins, so maxPeaks = numBins / 2 never overflows)
+		std::vector<SpectralPeak> peaks;
+		std::vector<uint16_t> numPeaks;
+		int maxPeaks = 0;
+		// Index the spectrum of the frame in the given slot
+		void indexPeaks(int slot, const ne10_fft_cpx_float32_t* frame);
+		// Slot in both slabs holding the given hop
+		int slotOf(int hop);
+		// Slot in both slabs holding hop 0 (only moves with pushFrame())
+		std::atomic<int> oldestSlot;
+		// Set once the frames and the bin-major view are written (release), read by the voices (acquire)
+		std::atomic<bool> ready;
+};
+
+#endif
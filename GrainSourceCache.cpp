@@ -0,0 +1,61 @@
+/***** GrainSourceCache.cpp *****/
+#include "GrainSourceCache.h"
+#include <cstdio>
+
+GrainSourceCache::GrainSourceCache(const QualityTier& quality, float sampleRate, bool multiResolution, WorkerPool& pool)
+	: quality (quality), sampleRate (sampleRate), multiResolution (multiResolution), pool (pool) {
+}
+
+GrainSourceCache::Entry* GrainSourceCache::find(GrainPyramid* pyramid){
+	for(auto& entry : entries){
+		if(entry.pyramid.get() == pyramid)
+			return &entry;
+	}
+	return nullptr;
+}
+
+GrainPyramid* GrainSourceCache::acquire(int song, int startIdx, GrainPyramid* previous){
+	Entry* current = find(previous);
+	if(current != nullptr && current->song == song && current->startIdx == startIdx)
+		return previous;
+	acquisitions++;
+
+	// Give the previous pyramid up
+	if(current != nullptr)
+		current->users--;
+
+	// Another engine plays the same slice
+	for(auto& entry : entries){
+		if(entry.users > 0 && entry.song == song && entry.startIdx == startIdx){
+			entry.users++;
+			sharedAcquisitions++;
+			return entry.pyramid.get();
+		}
+	}
+
+	// Rewrite a pyramid nobody uses, preferably the previous one (it may hold levels of a nearby slice)
+	Entry* unused = current != nullptr && current->users == 0 ? current : nullptr;
+	for(auto& entry : entries){
+		if(unused == nullptr && entry.users == 0)
+			unused = &entry;
+	}
+	if(unused == nullptr){
+		entries.emplace_back();
+		unused = &entries.back();
+		unused->pyramid.reset(new GrainPyramid(quality, sampleRate, multiResolution, pool));
+	}
+	unused->song = song;
+	unused->startIdx = startIdx;
+	unused->users = 1;
+	return unused->pyramid.get();
+}
+
+void GrainSourceCache::printStatistics(){
+	printf("Grain sources: %d pyramids, %d of %d source changes shared the analysis of another engine\n",
+		int(entries.size()), sharedAcquisitions, acquisitions);
+	for(unsigned int i = 0; i < entries.size(); i++){
+		if(entries.size() > 1)
+			printf("Pyramid %u:\n", i + 1);
+		entries[i].pyramid->printStatistics();
+	}
+}
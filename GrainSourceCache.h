@@ -0,0 +1,61 @@
+/*****
+ * GrainSourceCache.h
+ * Grain sources (GrainPyramids) shared by all engine instances, keyed by song and source position
+ *
+ * Engines playing the same slice of the same song get the same pyramid, so the slice is analysed
+ * (and held in memory) once no matter how many layers play from it. Every pyramid counts the engines
+ * using it: one that only its caller uses is rewritten in place when the caller moves on, one that
+ * nobody uses any more is kept and handed to the next engine that needs a slice nobody holds.
+ * Pyramids are only freed with the cache (on an engine rebuild and in cleanup()), because voices keep
+ * pointing into the levels of the pyramid they were started from until the grain source task moves them,
+ * so there are never more pyramids than engines.
+ * Not thread safe: only the grain source task (and setup() / the rebuild task while no task runs) use the cache
+*****/
+#ifndef GRAIN_SOURCE_CACHE_H
+#define GRAIN_SOURCE_CACHE_H
+
+#include <vector>
+#include <memory>
+#include "Constants.h"
+#include "GrainPyramid.h"
+#include "WorkerPool.h"
+
+class GrainSourceCache {
+	public:
+		// Pyramids are created for the given base tier (see GrainPyramid), analysing on the threads of pool
+		GrainSourceCache(const QualityTier& quality, float sampleRate, bool multiResolution, WorkerPool& pool);
+
+		// Pyramid for the slice of song starting at startIdx, for an engine that used previous until now
+		// (nullptr if it used none): previous itself if it holds that slice already, the pyramid of another
+		// engine on the same slice if there is one, otherwise previous or an unused pyramid re-keyed to the slice
+		// (GrainPyramid::update() analyses it) or a new one
+		// The engine gives previous up, so the reference it held is passed on to the returned pyramid
+		GrainPyramid* acquire(int song, int startIdx, GrainPyramid* previous);
+
+		// Print how often a source change found its slice analysed by another engine and the statistics of every pyramid
+		void printStatistics();
+
+	private:
+		struct Entry {
+			std::unique_ptr<GrainPyramid> pyramid;
+			// Slice the pyramid holds or is about to hold
+			int song = -1;
+			int startIdx = -1;
+			// Number of engines using the pyramid
+			int users = 0;
+		};
+		std::vector<Entry> entries;
+
+		QualityTier quality;
+		float sampleRate;
+		bool multiResolution;
+		WorkerPool& pool;
+
+		// Source changes and how many of them were served by a pyramid another engine holds
+		int acquisitions = 0;
+		int sharedAcquisitions = 0;
+
+		Entry* find(GrainPyramid* pyramid);
+};
+
+#endif
@@ -1,7 +1,4 @@
 /***** Highpass.h *****/
-#include <Bela.h>
-#include <libraries/Gui/Gui.h>
-#include <libraries/GuiController/GuiController.h>
 #include <cmath>
 
 /* 
@@ -0,0 +1,87 @@
+/***** Interpolator.cpp *****/
+#include "Interpolator.h"
+#include <cmath>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define INTERPOLATOR_NEON
+#endif
+
+// Index of the tap at the integer part of the position
+const int CENTER_TAP = -INTERPOLATION_FIRST_TAP;
+
+#ifdef INTERPOLATOR_NEON
+static inline float sumLanes(float32x4_t v){
+	float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+#endif
+
+Interpolator::Interpolator(){
+	sincTable.resize((INTERPOLATION_PHASES + 1) * INTERPOLATION_TAPS);
+	float halfWidth = 0.5f * INTERPOLATION_TAPS;
+	for (int phase = 0; phase <= INTERPOLATION_PHASES; phase++){
+		float fraction = float(phase) / INTERPOLATION_PHASES;
+		float* row = &sincTable[phase * INTERPOLATION_TAPS];
+		float sum = 0.0f;
+		for (int k = 0; k < INTERPOLATION_TAPS; k++){
+			// Distance of the tap from the position
+			float x = float(k - CENTER_TAP) - fraction;
+			float sinc = fabsf(x) < 1e-6f ? 1.0f : sinf(float(M_PI) * x) / (float(M_PI) * x);
+			float blackman = 0.42f + 0.5f * cosf(float(M_PI) * x / halfWidth) + 0.08f * cosf(2.0f * float(M_PI) * x / halfWidth);
+			row[k] = fabsf(x) >= halfWidth ? 0.0f : sinc * blackman;
+			sum += row[k];
+		}
+		// Unity gain at DC for every phase
+		for (int k = 0; k < INTERPOLATION_TAPS; k++){
+			row[k] /= sum;
+		}
+	}
+}
+
+float Interpolator::read(InterpolationKernel kernel, const float* taps, float fraction) const{
+	switch(kernel){
+		case INTERPOLATION_LINEAR:
+			return taps[CENTER_TAP] + fraction * (taps[CENTER_TAP + 1] - taps[CENTER_TAP]);
+		case INTERPOLATION_CUBIC: {
+			// Catmull-Rom weights of the samples before, at, after and two after the position
+			float c0 = ((-0.5f * fraction + 1.0f) * fraction - 0.5f) * fraction;
+			float c1 = (1.5f * fraction - 2.5f) * fraction * fraction + 1.0f;
+			float c2 = ((-1.5f * fraction + 2.0f) * fraction + 0.5f) * fraction;
+			float c3 = (0.5f * fraction - 0.5f) * fraction * fraction;
+			const float* x = taps + CENTER_TAP - 1;
+#ifdef INTERPOLATOR_NEON
+			float coefficients[4] = { c0, c1, c2, c3 };
+			return sumLanes(vmulq_f32(vld1q_f32(coefficients), vld1q_f32(x)));
+#else
+			return c0 * x[0] + c1 * x[1] + c2 * x[2] + c3 * x[3];
+#endif
+		}
+		case INTERPOLATION_SINC:
+		default: {
+			float phase = fraction * INTERPOLATION_PHASES;
+			int row = int(phase);
+			float blend = phase - row;
+			const float* row0 = &sincTable[row * INTERPOLATION_TAPS];
+			const float* row1 = row0 + INTERPOLATION_TAPS;
+#ifdef INTERPOLATOR_NEON
+			float32x4_t sum = vdupq_n_f32(0.0f);
+			for (int k = 0; k < INTERPOLATION_TAPS; k += 4){
+				float32x4_t c0 = vld1q_f32(row0 + k);
+				float32x4_t coefficients = vmlaq_n_f32(c0, vsubq_f32(vld1q_f32(row1 + k), c0), blend);
+				sum = vmlaq_f32(sum, coefficients, vld1q_f32(taps + k));
+			}
+			return sumLanes(sum);
+#else
+			float sum = 0.0f;
+			for (int k = 0; k < INTERPOLATION_TAPS; k++){
+				sum += (row0[k] + blend * (row1[k] - row0[k])) * taps[k];
+			}
+			return sum;
+#endif
+		}
+	}
+}
+
+int Interpolator::getMemoryUsage() const{
+	return sizeof(Interpolator) + sincTable.capacity() * sizeof(float);
+}
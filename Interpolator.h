@@ -0,0 +1,41 @@
+/*****
+ * Interpolator.h
+ * Kernels reading a buffer at fractional positions (grains playing at a rate other than 1)
+ *
+ * Every kernel reads the INTERPOLATION_TAPS samples around the position,
+ * taps[k] = data[index + INTERPOLATION_FIRST_TAP + k] for the position index + fraction,
+ * so callers can pass a pointer into the buffer directly and only gather the taps at its edges.
+ * The kernels are vectorised across the taps (four at a time with NEON).
+ * The windowed sinc kernel takes its coefficients from a polyphase table of INTERPOLATION_PHASES
+ * phases and blends the two phases next to the fraction
+*****/
+#ifndef INTERPOLATOR_H
+#define INTERPOLATOR_H
+
+#include <vector>
+#include "Constants.h"
+
+// Number of samples every kernel reads (the sinc kernel uses all of them)
+const int INTERPOLATION_TAPS = 8;
+// Offset of the first tap from the integer part of the position
+const int INTERPOLATION_FIRST_TAP = -(INTERPOLATION_TAPS / 2 - 1);
+// Number of phases of the sinc table between two samples
+const int INTERPOLATION_PHASES = 128;
+
+class Interpolator {
+	public:
+		// Builds the sinc table
+		Interpolator();
+
+		// Value at the position fraction [0...1) after taps[-INTERPOLATION_FIRST_TAP]
+		float read(InterpolationKernel kernel, const float* taps, float fraction) const;
+
+		// Bytes used by the sinc table
+		int getMemoryUsage() const;
+
+	private:
+		// INTERPOLATION_PHASES + 1 rows of INTERPOLATION_TAPS coefficients (the last row is the first one shifted by a sample)
+		std::vector<float> sincTable;
+};
+
+#endif
@@ -0,0 +1,114 @@
+/***** LaneFft.cpp *****/
+#include "LaneFft.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LANE_FFT_NEON
+#endif
+
+LaneFft::LaneFft(int size) : size (size), transformed (false) {
+	reversed.resize(size);
+	for(int n = 0, bits = 0; n < size; n++){
+		reversed[n] = bits;
+		int bit = size >> 1;
+		for(; bits & bit; bit >>= 1)
+			bits ^= bit;
+		bits |= bit;
+	}
+	// The forward twiddles of NE10 with the imaginary part negated for the inverse transform
+	twiddleReal.resize(size / 2);
+	twiddleImag.resize(size / 2);
+	for(int k = 0; k < size / 2; k++){
+		double angle = -2.0 * M_PI * k / size;
+		twiddleReal[k] = float(cos(angle));
+		twiddleImag[k] = -float(sin(angle));
+	}
+	real.assign(size * LANE_FFT_LANES, 0.0f);
+	imag.assign(size * LANE_FFT_LANES, 0.0f);
+}
+
+int LaneFft::getSize(){
+	return size;
+}
+
+void LaneFft::setBin(int lane, int bin, const ne10_fft_cpx_float32_t& value){
+	if(transformed){
+		std::fill(real.begin(), real.end(), 0.0f);
+		std::fill(imag.begin(), imag.end(), 0.0f);
+		transformed = false;
+	}
+	int position = reversed[bin] * LANE_FFT_LANES + lane;
+	real[position] = value.r;
+	imag[position] = value.i;
+}
+
+void LaneFft::inverse(){
+	// No bin set since the last transform: all spectra are zero
+	if(transformed){
+		std::fill(real.begin(), real.end(), 0.0f);
+		std::fill(imag.begin(), imag.end(), 0.0f);
+	}
+	float* re = real.data();
+	float* im = imag.data();
+	// Iterative radix-2 butterflies on the bit-reversed spectra, all lanes of a butterfly at once
+	for(int length = 2; length <= size; length <<= 1){
+		int half = length / 2;
+		int stride = size / length;
+		for(int start = 0; start < size; start += length){
+			for(int k = 0; k < half; k++){
+				float wr = twiddleReal[k * stride];
+				float wi = twiddleImag[k * stride];
+				float* ar = re + (start + k) * LANE_FFT_LANES;
+				float* ai = im + (start + k) * LANE_FFT_LANES;
+				float* br = ar + half * LANE_FFT_LANES;
+				float* bi = ai + half * LANE_FFT_LANES;
+#ifdef LANE_FFT_NEON
+				float32x4_t bReal = vld1q_f32(br);
+				float32x4_t bImag = vld1q_f32(bi);
+				float32x4_t aReal = vld1q_f32(ar);
+				float32x4_t aImag = vld1q_f32(ai);
+				float32x4_t tr = vsubq_f32(vmulq_n_f32(bReal, wr), vmulq_n_f32(bImag, wi));
+				float32x4_t ti = vaddq_f32(vmulq_n_f32(bReal, wi), vmulq_n_f32(bImag, wr));
+				vst1q_f32(br, vsubq_f32(aReal, tr));
+				vst1q_f32(bi, vsubq_f32(aImag, ti));
+				vst1q_f32(ar, vaddq_f32(aReal, tr));
+				vst1q_f32(ai, vaddq_f32(aImag, ti));
+#else
+				// Through local copies, so that the compiler can vectorise the lanes without alias checks
+				float aReal[LANE_FFT_LANES], aImag[LANE_FFT_LANES], bReal[LANE_FFT_LANES], bImag[LANE_FFT_LANES];
+				std::copy(ar, ar + LANE_FFT_LANES, aReal);
+				std::copy(ai, ai + LANE_FFT_LANES, aImag);
+				std::copy(br, br + LANE_FFT_LANES, bReal);
+				std::copy(bi, bi + LANE_FFT_LANES, bImag);
+				for(int lane = 0; lane < LANE_FFT_LANES; lane++){
+					float tr = bReal[lane] * wr - bImag[lane] * wi;
+					float ti = bReal[lane] * wi + bImag[lane] * wr;
+					bReal[lane] = aReal[lane] - tr;
+					bImag[lane] = aImag[lane] - ti;
+					aReal[lane] += tr;
+					aImag[lane] += ti;
+				}
+				std::copy(aReal, aReal + LANE_FFT_LANES, ar);
+				std::copy(aImag, aImag + LANE_FFT_LANES, ai);
+				std::copy(bReal, bReal + LANE_FFT_LANES, br);
+				std::copy(bImag, bImag + LANE_FFT_LANES, bi);
+#endif
+			}
+		}
+	}
+	// Only the real parts are used by the voices
+	float scale = 1.0f / size;
+	for(int n = 0; n < size * LANE_FFT_LANES; n++){
+		re[n] *= scale;
+	}
+	transformed = true;
+}
+
+const float* LaneFft::getReal(int lane){
+	return real.data() + lane;
+}
+
+int LaneFft::getMemoryUsage(){
+	return sizeof(LaneFft) + size * sizeof(int) + size * sizeof(float) + 2 * size * LANE_FFT_LANES * sizeof(float);
+}
@@ -0,0 +1,52 @@
+/*****
+ * LaneFft.h
+ * Inverse FFTs of several voices at once, interleaved in SIMD lanes
+ *
+ * The spectra of LANE_FFT_LANES voices are stored lane-interleaved (bin n of lane l at n * LANE_FFT_LANES + l,
+ * real and imaginary parts in separate arrays), so every butterfly of the radix-2 transform works on all lanes
+ * with one vector operation (NEON, or a loop of LANE_FFT_LANES the compiler vectorises) and the twiddle factor
+ * is loaded once for all of them. Same conventions as the NE10 inverse transform: scaled by 1 / size,
+ * twiddles computed in double precision.
+ * The voice masks are sparse (a few overtone bins per hop), so only the bins set with setBin() are written
+ * (straight to their bit-reversed position), the first setBin() after a transform clears the work buffers
+*****/
+#ifndef LANE_FFT_H
+#define LANE_FFT_H
+
+#include <vector>
+#include <libraries/ne10/NE10.h>
+
+// Number of transforms computed at once (the width of a NEON float vector)
+const int LANE_FFT_LANES = 4;
+
+class LaneFft {
+	public:
+		// Plan for transforms of size points (a power of two)
+		LaneFft(int size);
+
+		int getSize();
+		// Set bin of the spectrum of lane for the next inverse(), all bins not set are zero
+		void setBin(int lane, int bin, const ne10_fft_cpx_float32_t& value);
+		// Inverse transform of every lane in place, scaled by 1 / size (only the real parts)
+		void inverse();
+		// Real part of the output of lane: sample n at getReal(lane)[n * LANE_FFT_LANES]
+		const float* getReal(int lane);
+
+		// Bytes of the plan and the work buffers
+		int getMemoryUsage();
+
+	private:
+		int size;
+		// Bit-reversed position of every bin
+		std::vector<int> reversed;
+		// size / 2 twiddles exp(2 pi i k / size)
+		std::vector<float> twiddleReal;
+		std::vector<float> twiddleImag;
+		// Lane-interleaved work buffers, the spectra in bit-reversed order until inverse() transforms them in place
+		std::vector<float> real;
+		std::vector<float> imag;
+		// Whether the buffers hold the output of the last transform
+		bool transformed;
+};
+
+#endif
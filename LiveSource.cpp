@@ -0,0 +1,106 @@
+/***** LiveSource.cpp *****/
+#include "LiveSource.h"
+#include <cmath>
+#include <cstdio>
+
+LiveSource::LiveSource(const QualityTier& quality)
+	: quality (quality), writeCount (0), nextFrame (0), resumeFrame (0), pausePending (false), frames (quality) {
+	int fftSize = quality.fftSize;
+	captureLength = LIVE_CAPTURE_FRAMES * fftSize;
+	captureBuffer.assign(captureLength, 0.0f);
+	cfg = ne10_fft_alloc_c2c_float32_neon (fftSize);
+	timeDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t));
+	frequencyDomain = (ne10_fft_cpx_float32_t*) NE10_MALLOC (fftSize * sizeof (ne10_fft_cpx_float32_t));
+
+	// Same Hann window as the analysis of the songs
+	window = new float[fftSize];
+	for(int n = 0; n < fftSize; n++) {
+		window[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(fftSize - 1)));
+	}
+}
+
+void LiveSource::write(const float* samples, int count){
+	unsigned int position = writeCount.load(std::memory_order_relaxed);
+	for(int i = 0; i < count; i++){
+		captureBuffer[(position + i) & (captureLength - 1)] = samples[i];
+	}
+	// Publish the samples to the worker
+	writeCount.store(position + count, std::memory_order_release);
+}
+
+void LiveSource::pause(){
+	// The first frame that starts with the samples written after the pause
+	unsigned int position = writeCount.load(std::memory_order_relaxed);
+	resumeFrame.store((position + quality.hopSize - 1) / quality.hopSize, std::memory_order_relaxed);
+	pausePending.store(true, std::memory_order_release);
+}
+
+bool LiveSource::hasPendingFrames(){
+	if(pausePending.load(std::memory_order_acquire))
+		return true;
+	// Differences of the unsigned counters stay correct when they wrap around
+	// (negative while the next frame starts after the written samples, after a pause)
+	unsigned int frameStart = nextFrame.load() * quality.hopSize;
+	return int(writeCount.load(std::memory_order_acquire) - frameStart) >= quality.fftSize;
+}
+
+void LiveSource::analysePendingFrames(){
+	unsigned int fftSize = quality.fftSize;
+	unsigned int hopSize = quality.hopSize;
+	// Input from before a pause is neither analysed nor kept
+	if(pausePending.exchange(false, std::memory_order_acquire)){
+		frames.clear();
+		nextFrame = resumeFrame.load(std::memory_order_relaxed);
+	}
+	while(true){
+		unsigned int written = writeCount.load(std::memory_order_acquire);
+		unsigned int frame = nextFrame.load();
+		unsigned int frameStart = frame * hopSize;
+		if(int(written - frameStart) < int(fftSize))
+			break;
+
+		// The worker fell behind: continue with the newest complete frame, leaving
+		// one frame of the capture buffer for render() to write into while we read
+		if(written - frameStart > captureLength - fftSize){
+			unsigned int newest = (written - fftSize) / hopSize;
+			droppedFrames += newest - frame;
+			nextFrame = newest;
+			continue;
+		}
+
+		for(unsigned int n = 0; n < fftSize; n++){
+			timeDomain[n].r = captureBuffer[(frameStart + n) & (captureLength - 1)] * window[n];
+			timeDomain[n].i = 0.0f;
+		}
+		// Discard the frame if render() overwrote part of it while we were reading
+		if(writeCount.load(std::memory_order_acquire) - frameStart > (unsigned int)captureLength){
+			droppedFrames++;
+			nextFrame = frame + 1;
+			continue;
+		}
+
+		ne10_fft_c2c_1d_float32_neon (frequencyDomain, timeDomain, cfg, 0);
+		frames.pushFrame(frequencyDomain);
+
+		analysedFrames++;
+		if(written - (frameStart + fftSize) > maxLatency)
+			maxLatency = written - (frameStart + fftSize);
+		nextFrame = frame + 1;
+	}
+}
+
+GrainSource& LiveSource::getGrainSource(){
+	return frames;
+}
+
+void LiveSource::printStatistics(float sampleRate){
+	printf("Live input: %u frames analysed, %u dropped, worst latency %.1f ms after the frame was complete\n",
+		analysedFrames, droppedFrames, 1000.0f * maxLatency / sampleRate);
+}
+
+LiveSource::~LiveSource(){
+	NE10_FREE(cfg);
+	NE10_FREE(timeDomain);
+	NE10_FREE(frequencyDomain);
+	delete[] window;
+}
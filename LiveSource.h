@@ -0,0 +1,81 @@
+/*****
+ * LiveSource.h
+ * Live audio input as grain source
+ *
+ * render() writes the (mono mixed) input into a lock-free circular capture buffer.
+ * A worker runs one forward FFT for every completed hop of hopSize samples and pushes
+ * the frame into a GrainSource used as a ring, so the newest sourceHops frames are
+ * always ready to be masked by Voice::noteOn.
+ * The latency from input to playable spectrum is one frame (fftSize samples) plus the worker delay
+ * render() only captures while an engine plays from the input; after pause() the worker clears the ring,
+ * so the next use starts from silence like the first one instead of input from before the pause
+*****/
+#ifndef LIVE_SOURCE_H
+#define LIVE_SOURCE_H
+
+#include <atomic>
+#include <vector>
+#include <libraries/ne10/NE10.h>
+#include "Constants.h"
+#include "GrainSource.h"
+
+// Length of the capture buffer in frames (the buffer length stays a power of two),
+// gives the worker four frames of slack before input is lost
+const int LIVE_CAPTURE_FRAMES = 4;
+
+class LiveSource {
+	public:
+		// Frames are analysed with the FFT and hop size of the given quality tier
+		LiveSource(const QualityTier& quality);
+		~LiveSource();
+
+		// Append input samples to the capture buffer
+		// Called from the audio thread only
+		void write(const float* samples, int count);
+
+		// Stop capturing until the next write(): the next analysePendingFrames() skips the incomplete frames
+		// and clears the analysed ones
+		// Called from the audio thread only
+		void pause();
+
+		// Whether a hop was completed that the worker has not analysed yet (or a pause() is pending)
+		bool hasPendingFrames();
+
+		// Analyse all completed hops, skipping the ones the capture buffer has already overwritten
+		// Called from a background task only
+		void analysePendingFrames();
+
+		// The newest sourceHops frames (hop 0 is the oldest)
+		GrainSource& getGrainSource();
+
+		// Print the number of analysed and dropped frames and the worst latency seen
+		void printStatistics(float sampleRate);
+
+	private:
+		QualityTier quality;
+
+		// Circular capture buffer (LIVE_CAPTURE_FRAMES * fftSize samples) and the total number of samples written to it
+		std::vector<float> captureBuffer;
+		int captureLength = 0;
+		std::atomic<unsigned int> writeCount;
+		// Number of the next frame to analyse (frame f starts at sample f * hopSize)
+		std::atomic<unsigned int> nextFrame;
+		// First frame after a pause() and whether the worker has not handled it yet
+		std::atomic<unsigned int> resumeFrame;
+		std::atomic<bool> pausePending;
+
+		// Analysis
+		ne10_fft_cfg_float32_t cfg;
+		float* window = nullptr;
+		ne10_fft_cpx_float32_t* timeDomain = nullptr;
+		ne10_fft_cpx_float32_t* frequencyDomain = nullptr;
+		GrainSource frames;
+
+		// Statistics
+		unsigned int analysedFrames = 0;
+		unsigned int droppedFrames = 0;
+		// Samples that arrived after the end of a frame before it was analysed (worst case)
+		unsigned int maxLatency = 0;
+};
+
+#endif
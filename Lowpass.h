@@ -1,6 +1,3 @@
-#include <Bela.h>
-#include <libraries/Gui/Gui.h>
-#include <libraries/GuiController/GuiController.h>
 #include <cmath>
 
 /*
@@ -0,0 +1,31 @@
+/***** MidiQueue.cpp *****/
+#include "MidiQueue.h"
+#include <time.h>
+
+MidiQueue::MidiQueue()
+	: writeCount (0), readCount (0) {
+}
+
+unsigned long long MidiQueue::now(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (unsigned long long)time.tv_sec * 1000000ULL + time.tv_nsec / 1000;
+}
+
+bool MidiQueue::push(const MidiEvent& event){
+	unsigned int position = writeCount.load(std::memory_order_relaxed);
+	if(position - readCount.load(std::memory_order_acquire) >= (unsigned int)MIDI_QUEUE_LENGTH)
+		return false;
+	events[position & (MIDI_QUEUE_LENGTH - 1)] = event;
+	writeCount.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool MidiQueue::pop(MidiEvent& event){
+	unsigned int position = readCount.load(std::memory_order_relaxed);
+	if(position == writeCount.load(std::memory_order_acquire))
+		return false;
+	event = events[position & (MIDI_QUEUE_LENGTH - 1)];
+	readCount.store(position + 1, std::memory_order_release);
+	return true;
+}
@@ -0,0 +1,55 @@
+/*****
+ * MidiQueue.h
+ * Lock-free single producer / single consumer queue of timestamped MIDI note events
+ *
+ * The MIDI parser thread only timestamps incoming notes and pushes them here.
+ * render() pops them at the start of every block and applies each one at the frame
+ * that corresponds to its arrival time, one block later than it arrived (constant latency
+ * instead of the jitter of applying events whenever the parser thread runs)
+*****/
+#ifndef MIDI_QUEUE_H
+#define MIDI_QUEUE_H
+
+#include <atomic>
+
+// Capacity of the queue (power of two)
+const int MIDI_QUEUE_LENGTH = 256;
+
+struct MidiEvent {
+	// MIDI channel [0...15]
+	int channel;
+	// Note number and velocity (velocity 0 releases the note)
+	int note;
+	int velocity;
+	// Arrival time in microseconds (MidiQueue::now())
+	unsigned long long timestamp;
+	// Frame within the block the event is applied at (set by render())
+	int frameOffset;
+	// Engine instances that applied the event already, one bit each (set by render(), so that an event
+	// retried because one engine's voice was busy is not applied twice by the others)
+	unsigned int appliedEngines;
+};
+
+class MidiQueue {
+	public:
+		MidiQueue();
+
+		// Monotonic time in microseconds
+		static unsigned long long now();
+
+		// Add an event (MIDI thread only)
+		// Returns false if the queue is full and the event was dropped
+		bool push(const MidiEvent& event);
+
+		// Take the oldest event (audio thread only)
+		// Returns false if the queue is empty
+		bool pop(MidiEvent& event);
+
+	private:
+		MidiEvent events[MIDI_QUEUE_LENGTH];
+		// Total number of events pushed and popped
+		std::atomic<unsigned int> writeCount;
+		std::atomic<unsigned int> readCount;
+};
+
+#endif
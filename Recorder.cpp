@@ -0,0 +1,139 @@
+/***** Recorder.cpp *****/
+#include "Recorder.h"
+#include <Bela.h>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+Recorder::Recorder(const std::string& path, RecordFormat format, float sampleRate, int numChannels, float rotateSeconds)
+	: path (path), format (format), sampleRate (sampleRate), numChannels (numChannels), writeCount (0), readCount (0),
+	  overruns (0), droppedFrames (0) {
+	rotateFrames = rotateSeconds > 0.0f ? (long long)(rotateSeconds * sampleRate) : 0;
+	// A power of two of at least one chunk, so the counters can wrap around and a chunk never crosses the end
+	ringFrames = RECORDER_WRITE_FRAMES;
+	while(ringFrames < RECORDER_RING_SECONDS * sampleRate){
+		ringFrames *= 2;
+	}
+	ring.assign((size_t)ringFrames * numChannels, 0.0f);
+}
+
+bool Recorder::write(const float* frames, int numFrames){
+	auto start = std::chrono::steady_clock::now();
+	unsigned int position = writeCount.load(std::memory_order_relaxed);
+	// Unsigned differences stay correct when the counters wrap around
+	unsigned int fill = position - readCount.load(std::memory_order_acquire);
+	bool written = fill + numFrames <= ringFrames;
+	if(written){
+		unsigned int first = position & (ringFrames - 1);
+		int head = std::min(numFrames, int(ringFrames - first));
+		std::copy(frames, frames + head * numChannels, &ring[first * numChannels]);
+		std::copy(frames + head * numChannels, frames + numFrames * numChannels, ring.begin());
+		writeCount.store(position + numFrames, std::memory_order_release);
+		maxFill = std::max(maxFill, fill + numFrames);
+	} else {
+		// The writer fell behind: drop the block rather than wait for it
+		droppedFrames.fetch_add(numFrames, std::memory_order_relaxed);
+		overruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	writeSeconds += seconds;
+	maxWriteSeconds = std::max(maxWriteSeconds, seconds);
+	writeCalls++;
+	return written;
+}
+
+bool Recorder::hasPendingChunk(){
+	return writeCount.load(std::memory_order_acquire) - readCount.load(std::memory_order_relaxed) >= (unsigned int)RECORDER_WRITE_FRAMES;
+}
+
+void Recorder::drain(bool flush){
+	std::lock_guard<std::mutex> lock(writerMutex);
+	auto start = std::chrono::steady_clock::now();
+	while(true){
+		unsigned int position = readCount.load(std::memory_order_relaxed);
+		unsigned int available = writeCount.load(std::memory_order_acquire) - position;
+		unsigned int first = position & (ringFrames - 1);
+		// Whole chunks (the read position stays chunk aligned, so they never wrap), the rest only when flushing
+		unsigned int numFrames = available >= (unsigned int)RECORDER_WRITE_FRAMES ? RECORDER_WRITE_FRAMES : (flush ? available : 0);
+		numFrames = std::min(numFrames, ringFrames - first);
+		if(numFrames == 0)
+			break;
+		writeFrames(&ring[first * numChannels], numFrames);
+		// Hand the frames back to the audio thread
+		readCount.store(position + numFrames, std::memory_order_release);
+	}
+	drainSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int totalOverruns = overruns.load(std::memory_order_relaxed);
+	if(totalOverruns != reportedOverruns){
+		rt_printf("Recorder: %d blocks dropped because the ring was full (%d frames in total) \n",
+			totalOverruns - reportedOverruns, droppedFrames.load(std::memory_order_relaxed));
+		reportedOverruns = totalOverruns;
+	}
+}
+
+void Recorder::writeFrames(const float* frames, int numFrames){
+	while(numFrames > 0 && !failed){
+		if(file == nullptr && !openNextFile())
+			return;
+		int count = numFrames;
+		if(rotateFrames > 0)
+			count = (int)std::min((long long)count, rotateFrames - fileFrames);
+		if(sf_writef_float(file, frames, count) != count){
+			rt_printf("Recorder: couldn't write to file %d: %s, recording stopped \n", fileIndex - 1, sf_strerror(file));
+			failed = true;
+			return;
+		}
+		frames += count * numChannels;
+		numFrames -= count;
+		fileFrames += count;
+		writtenFrames += count;
+		// Rotate: the next frames go to a new file
+		if(rotateFrames > 0 && fileFrames >= rotateFrames){
+			sf_close(file);
+			file = nullptr;
+		}
+	}
+}
+
+bool Recorder::openNextFile(){
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "-%03d.%s", fileIndex++, RECORD_FORMAT_NAMES[format]);
+	std::string filePath = path + suffix;
+	SF_INFO info = {};
+	info.samplerate = int(sampleRate);
+	info.channels = numChannels;
+	info.format = format == RECORD_FORMAT_FLAC ? (SF_FORMAT_FLAC | SF_FORMAT_PCM_24) : (SF_FORMAT_WAV | SF_FORMAT_FLOAT);
+	file = sf_open(filePath.c_str(), SFM_WRITE, &info);
+	if(file == nullptr){
+		rt_printf("Recorder: couldn't create %s: %s, recording stopped \n", filePath.c_str(), sf_strerror(nullptr));
+		failed = true;
+		return false;
+	}
+	// Integer formats clip instead of wrapping around
+	if(format == RECORD_FORMAT_FLAC)
+		sf_command(file, SFC_SET_CLIPPING, nullptr, SF_TRUE);
+	fileFrames = 0;
+	rt_printf("Recording to %s \n", filePath.c_str());
+	return true;
+}
+
+void Recorder::close(){
+	drain(true);
+	std::lock_guard<std::mutex> lock(writerMutex);
+	if(file != nullptr)
+		sf_close(file);
+	file = nullptr;
+}
+
+void Recorder::printStatistics(){
+	double seconds = writtenFrames / sampleRate;
+	printf("Recorder: %d files, %.1f s written, %d blocks dropped (%d frames), ring fill max %.0f%% of %.1f s, "
+		"audio thread %.2f us mean / %.2f us max per block, writer %.2f ms per second of output\n",
+		fileIndex, seconds, overruns.load(), droppedFrames.load(), 100.0 * maxFill / ringFrames, ringFrames / sampleRate,
+		writeCalls > 0 ? writeSeconds * 1e6 / writeCalls : 0.0, maxWriteSeconds * 1e6, seconds > 0.0 ? drainSeconds * 1e3 / seconds : 0.0);
+}
+
+Recorder::~Recorder(){
+	close();
+}
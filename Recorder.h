@@ -0,0 +1,94 @@
+/*****
+ * Recorder.h
+ * Recording (bounce) of the synthesiser output into WAV or FLAC files
+ *
+ * render() copies the output of every block (after the main gain, as sent to the audio device) into a
+ * preallocated single producer / single consumer ring and never waits for the disk: if the ring is full
+ * the block is dropped and counted as an overrun. A low priority auxiliary task drains the ring in chunks of
+ * RECORDER_WRITE_FRAMES frames, written straight from the ring, into numbered files and starts a new file
+ * every rotateSeconds. Overruns are reported by that task as it finds them
+*****/
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <libraries/sndfile/sndfile.h>
+#include "Constants.h"
+
+// Frames the writer takes out of the ring at a time (the ring holds a multiple of it, so a chunk never wraps)
+const int RECORDER_WRITE_FRAMES = 8192;
+// Output the ring holds while the writer is not running, in seconds (rounded up to a power of two frames)
+const float RECORDER_RING_SECONDS = 3.0f;
+// Length of one file before the next one is started, in seconds (0: a single file)
+const float RECORDER_ROTATE_SECONDS = 1800.0f;
+
+class Recorder {
+	public:
+		// Files are named <path>-000.wav, <path>-001.wav, ... (.flac), the first one is created by the first drain()
+		// Allocates the ring, so it is created in setup()
+		Recorder(const std::string& path, RecordFormat format, float sampleRate, int numChannels, float rotateSeconds);
+		~Recorder();
+
+		// ---- audio thread
+		// Copy numFrames interleaved frames of numChannels samples into the ring (no file I/O, no allocation, no locks)
+		// Returns false if the ring had no room for them and the block was dropped
+		bool write(const float* frames, int numFrames);
+		// Whether a whole chunk is waiting for drain()
+		bool hasPendingChunk();
+
+		// ---- writer task
+		// Write every complete chunk to the files (and what is left of the last one if flush is set),
+		// report the overruns since the last call
+		void drain(bool flush);
+
+		// ---- after the audio thread stopped
+		// Write the rest of the ring and close the file
+		void close();
+		// Files, length written, overruns, ring fill and time spent in write() and drain()
+		void printStatistics();
+
+	private:
+		std::string path;
+		RecordFormat format;
+		float sampleRate;
+		int numChannels;
+		// Frames per file (0: no rotation)
+		long long rotateFrames;
+
+		// ringFrames * numChannels interleaved samples, ringFrames is a power of two
+		std::vector<float> ring;
+		unsigned int ringFrames;
+		// Total number of frames written by the audio thread and taken out by the writer
+		std::atomic<unsigned int> writeCount;
+		std::atomic<unsigned int> readCount;
+		// Blocks and frames dropped because the ring was full
+		std::atomic<int> overruns;
+		std::atomic<int> droppedFrames;
+
+		// Audio thread statistics: time spent in write() and the fullest the ring got
+		double writeSeconds = 0.0;
+		double maxWriteSeconds = 0.0;
+		long long writeCalls = 0;
+		unsigned int maxFill = 0;
+
+		// Writer state (serialised by writerMutex, drain() and close() may run on different threads)
+		std::mutex writerMutex;
+		SNDFILE* file = nullptr;
+		int fileIndex = 0;
+		long long fileFrames = 0;
+		long long writtenFrames = 0;
+		// Set when a file could not be created or written, the output is discarded from then on
+		bool failed = false;
+		int reportedOverruns = 0;
+		double drainSeconds = 0.0;
+
+		// Write frames to the current file, starting the next one where the rotation falls
+		void writeFrames(const float* frames, int numFrames);
+		// Create the next numbered file
+		bool openNextFile();
+};
+
+#endif
@@ -0,0 +1,237 @@
+/***** Resampler.cpp *****/
+#include "Resampler.h"
+#include "VectorOps.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+static int greatestCommonDivisor(int a, int b){
+	while(b != 0){
+		int remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+// Zeroth order modified Bessel function of the first kind (for the Kaiser window)
+static double besselI0(double x){
+	double sum = 1.0;
+	double term = 1.0;
+	for(int k = 1; k < 50; k++){
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if(term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+Resampler::Resampler(int inputRate, int outputRate){
+	int divisor = greatestCommonDivisor(inputRate, outputRate);
+	upFactor = outputRate / divisor;
+	downFactor = inputRate / divisor;
+	numPhases = min(upFactor, RESAMPLER_MAX_PHASES);
+
+	// Going down the filter gets narrower in input samples, so it needs proportionally more taps
+	double ratio = double(upFactor) / double(downFactor);
+	int taps = int(ceil(RESAMPLER_BASE_TAPS / min(1.0, ratio)));
+	tapsPerPhase = (taps + 3) & ~3;
+	double cutoff = RESAMPLER_ROLLOFF * min(1.0, ratio);
+
+	// Phase q is the kernel centred q / numPhases input samples after the first tap right of the output position
+	coefficients.resize(numPhases * tapsPerPhase);
+	double halfLength = tapsPerPhase / 2;
+	double normalisation = besselI0(RESAMPLER_KAISER_BETA);
+	for(int phase = 0; phase < numPhases; phase++){
+		float* row = &coefficients[phase * tapsPerPhase];
+		double sum = 0.0;
+		for(int j = 0; j < tapsPerPhase; j++){
+			double t = double(phase) / numPhases + halfLength - 1 - j;
+			double x = cutoff * t;
+			double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			double position = t / halfLength;
+			double window = fabs(position) >= 1.0 ? 0.0 : besselI0(RESAMPLER_KAISER_BETA * sqrt(1.0 - position * position)) / normalisation;
+			row[j] = float(cutoff * sinc * window);
+			sum += row[j];
+		}
+		// Unity gain at DC for every phase
+		for(int j = 0; j < tapsPerPhase; j++){
+			row[j] = float(row[j] / sum);
+		}
+	}
+}
+
+int Resampler::getOutputLength(int inputLength){
+	return int(((long long)inputLength * upFactor + downFactor - 1) / downFactor);
+}
+
+void Resampler::process(const float* input, int inputLength, float* output){
+	// Zero padding on both sides so that every output sample is a plain dot product
+	int halfLength = tapsPerPhase / 2;
+	vector<float> padded(inputLength + tapsPerPhase + 1, 0.0f);
+	copy(input, input + inputLength, padded.begin() + halfLength);
+
+	int outputLength = getOutputLength(inputLength);
+	for(int n = 0; n < outputLength; n++){
+		long long position = (long long)n * downFactor;
+		int base = int(position / upFactor);
+		int phase = int(position % upFactor);
+		if(numPhases != upFactor)
+			phase = int((long long)phase * numPhases / upFactor);
+		output[n] = dotProduct(&coefficients[phase * tapsPerPhase], &padded[base + 1], tapsPerPhase);
+	}
+}
+
+void Resampler::push(const float* input, int inputLength, vector<float>& output){
+	// The conversion starts with the zero padding in front of the signal
+	if(inputPushed == 0 && history.empty())
+		history.assign(tapsPerPhase / 2, 0.0f);
+	history.insert(history.end(), input, input + inputLength);
+	inputPushed += inputLength;
+	convertHistory(-1, output);
+}
+
+void Resampler::flush(vector<float>& output){
+	// Zero padding behind the signal, then everything up to the length process() would give
+	int halfLength = tapsPerPhase / 2;
+	if(inputPushed == 0 && history.empty())
+		history.assign(halfLength, 0.0f);
+	history.insert(history.end(), tapsPerPhase + 1 - halfLength, 0.0f);
+	convertHistory(((long long)inputPushed * upFactor + downFactor - 1) / downFactor, output);
+
+	// Ready for the next signal
+	history.clear();
+	historyStart = 0;
+	inputPushed = 0;
+	nextOutput = 0;
+}
+
+void Resampler::convertHistory(long long outputEnd, vector<float>& output){
+	output.clear();
+	long long historyEnd = historyStart + history.size();
+	for(; outputEnd < 0 || nextOutput < outputEnd; nextOutput++){
+		long long position = nextOutput * downFactor;
+		long long base = position / upFactor;
+		if(base + 1 + tapsPerPhase > historyEnd)
+			break;
+		int phase = int(position % upFactor);
+		if(numPhases != upFactor)
+			phase = int((long long)phase * numPhases / upFactor);
+		output.push_back(dotProduct(&coefficients[phase * tapsPerPhase], &history[base + 1 - historyStart], tapsPerPhase));
+	}
+
+	// Drop the input no later output reads
+	long long needed = nextOutput * downFactor / upFactor + 1;
+	if(needed > historyStart){
+		long long drop = min<long long>(needed - historyStart, history.size());
+		history.erase(history.begin(), history.begin() + drop);
+		historyStart += drop;
+	}
+}
+
+// Least squares fit of a sinusoid at frequency (cycles per sample) to signal[start, end)
+// Returns its amplitude and the RMS of what is left
+static void fitSinusoid(const float* signal, int start, int end, double frequency, double& amplitude, double& residual){
+	double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0;
+	for(int n = start; n < end; n++){
+		double s = sin(2.0 * M_PI * frequency * n);
+		double c = cos(2.0 * M_PI * frequency * n);
+		ss += s * s;
+		cc += c * c;
+		sc += s * c;
+		xs += signal[n] * s;
+		xc += signal[n] * c;
+	}
+	double determinant = ss * cc - sc * sc;
+	double a = (xs * cc - xc * sc) / determinant;
+	double b = (xc * ss - xs * sc) / determinant;
+	amplitude = sqrt(a * a + b * b);
+
+	double error = 0.0;
+	for(int n = start; n < end; n++){
+		double fitted = a * sin(2.0 * M_PI * frequency * n) + b * cos(2.0 * M_PI * frequency * n);
+		error += (signal[n] - fitted) * (signal[n] - fitted);
+	}
+	residual = sqrt(error / (end - start));
+}
+
+static double toDecibels(double value){
+	return 20.0 * log10(max(value, 1e-12));
+}
+
+void Resampler::printReport(int outputRate){
+	const int sourceRates[] = { 22050, 32000, 44100, 48000, 88200, 96000 };
+	const double toneAmplitude = 0.5;
+
+	printf("Resampler report (output rate %d Hz)\n", outputRate);
+	printf("%8s %6s %14s %16s %14s %12s\n", "source", "taps", "ripple (dB)", "spurious (dB)", "alias (dB)", "Msamples/s");
+	for(int inputRate : sourceRates){
+		if(inputRate == outputRate)
+			continue;
+		Resampler resampler(inputRate, outputRate);
+		double lowerNyquist = 0.5 * min(inputRate, outputRate);
+
+		// One second of each test tone
+		int inputLength = inputRate;
+		int outputLength = resampler.getOutputLength(inputLength);
+		vector<float> input(inputLength);
+		vector<float> output(outputLength);
+		int margin = resampler.tapsPerPhase;
+
+		// Passband: gain deviation and everything that isn't the tone (images, aliases, noise)
+		double minGain = 1e9, maxGain = -1e9, worstSpurious = -1e9;
+		for(double fraction = 0.05; fraction <= 0.8 + 1e-9; fraction += 0.05){
+			double frequency = fraction * lowerNyquist;
+			for(int n = 0; n < inputLength; n++){
+				input[n] = float(toneAmplitude * sin(2.0 * M_PI * frequency * n / inputRate));
+			}
+			resampler.process(input.data(), inputLength, output.data());
+			double amplitude, residual;
+			fitSinusoid(output.data(), margin, outputLength - margin, frequency / outputRate, amplitude, residual);
+			double gain = toDecibels(amplitude / toneAmplitude);
+			minGain = min(minGain, gain);
+			maxGain = max(maxGain, gain);
+			worstSpurious = max(worstSpurious, toDecibels(residual * sqrt(2.0) / toneAmplitude));
+		}
+
+		// Stopband (only when going down): tones above the output Nyquist frequency must disappear
+		double worstAlias = -1e9;
+		if(inputRate > outputRate){
+			for(double fraction = 1.0; fraction < 0.98 * inputRate / (2.0 * lowerNyquist); fraction += 0.02){
+				double frequency = fraction * lowerNyquist;
+				for(int n = 0; n < inputLength; n++){
+					input[n] = float(toneAmplitude * sin(2.0 * M_PI * frequency * n / inputRate));
+				}
+				resampler.process(input.data(), inputLength, output.data());
+				double energy = 0.0;
+				for(int n = margin; n < outputLength - margin; n++){
+					energy += output[n] * output[n];
+				}
+				double rms = sqrt(energy / (outputLength - 2 * margin));
+				worstAlias = max(worstAlias, toDecibels(rms * sqrt(2.0) / toneAmplitude));
+			}
+		}
+
+		// Throughput on ten seconds of noise
+		int benchmarkLength = 10 * inputRate;
+		vector<float> noise(benchmarkLength);
+		for(auto& sample : noise){
+			sample = float(rand()) / RAND_MAX - 0.5f;
+		}
+		vector<float> benchmarkOutput(resampler.getOutputLength(benchmarkLength));
+		auto start = chrono::steady_clock::now();
+		resampler.process(noise.data(), benchmarkLength, benchmarkOutput.data());
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		char alias[16] = "-";
+		if(inputRate > outputRate)
+			snprintf(alias, sizeof(alias), "%.1f", worstAlias);
+		printf("%8d %6d %14.4f %16.1f %14s %12.2f\n", inputRate, resampler.tapsPerPhase,
+			maxGain - minGain, worstSpurious, alias, benchmarkOutput.size() / seconds * 1e-6);
+	}
+}
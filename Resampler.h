@@ -0,0 +1,63 @@
+/*****
+ * Resampler.h
+ * Polyphase windowed-sinc sample rate converter
+ *
+ * The grain engine assumes the source songs are at the audio device rate (grain lengths,
+ * overtone bins), so songs at other rates are converted once when they are decoded.
+ * The ratio is reduced to L / M and the Kaiser windowed sinc is split into L phases, so every
+ * output sample is one dot product of tapsPerPhase coefficients with the input.
+ * The cutoff follows the lower of the two Nyquist frequencies, which removes aliasing
+ * when going down and imaging when going up
+*****/
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <vector>
+
+// Taps per phase when the rate goes up (scaled by the ratio when going down)
+const int RESAMPLER_BASE_TAPS = 96;
+// Cutoff relative to the lower Nyquist frequency
+const float RESAMPLER_ROLLOFF = 0.9f;
+// Kaiser window shape (about 80dB stopband attenuation)
+const float RESAMPLER_KAISER_BETA = 8.0f;
+// Upper limit for the number of phases, ratios that don't reduce further use the nearest phase
+const int RESAMPLER_MAX_PHASES = 1024;
+
+class Resampler {
+	public:
+		Resampler(int inputRate, int outputRate);
+
+		// Number of output samples for inputLength input samples
+		int getOutputLength(int inputLength);
+
+		// Convert a whole signal, output has to hold getOutputLength(inputLength) samples
+		void process(const float* input, int inputLength, float* output);
+
+		// Convert a signal in chunks (same result as process() on the whole signal):
+		// push() every chunk and flush() after the last one, both replace output with the samples they completed
+		void push(const float* input, int inputLength, std::vector<float>& output);
+		void flush(std::vector<float>& output);
+
+		// Measure passband ripple, aliasing and throughput for common source rates and print them
+		static void printReport(int outputRate);
+
+	private:
+		// Reduced ratio: L output samples for every M input samples
+		int upFactor;
+		int downFactor;
+		int numPhases;
+		int tapsPerPhase;
+		// numPhases rows of tapsPerPhase coefficients, each row in input order
+		std::vector<float> coefficients;
+
+		// State of the chunked conversion: the input (zero padded like in process()) the next outputs still need,
+		// starting at padded position historyStart, the number of input samples pushed and the next output sample
+		std::vector<float> history;
+		long long historyStart = 0;
+		long long inputPushed = 0;
+		long long nextOutput = 0;
+		// Compute the outputs whose taps are all in history, up to outputEnd
+		void convertHistory(long long outputEnd, std::vector<float>& output);
+};
+
+#endif
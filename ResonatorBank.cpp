@@ -0,0 +1,81 @@
+/***** ResonatorBank.cpp *****/
+#include "ResonatorBank.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESONATOR_BANK_NEON
+#endif
+
+ResonatorBank::ResonatorBank(int maxResonators){
+	capacity = (std::max(maxResonators, 1) + 3) & ~3;
+	gain.assign(capacity, 0.0f);
+	a1.assign(capacity, 0.0f);
+	a2.assign(capacity, 0.0f);
+	y1.assign(capacity, 0.0f);
+	y2.assign(capacity, 0.0f);
+}
+
+void ResonatorBank::tuneHarmonics(float fundamental, int numHarmonics, float bandwidth, float maxFrequency, float sampleRate){
+	// Pole radius from the bandwidth, the same for all harmonics
+	float r = expf(-float(M_PI) * bandwidth / sampleRate);
+	numActive = 0;
+	for(int i = 0; i < capacity; i++){
+		float frequency = fundamental * (i + 1);
+		if(i >= numHarmonics || frequency >= maxFrequency){
+			gain[i] = a1[i] = a2[i] = 0.0f;
+			y1[i] = y2[i] = 0.0f;
+			continue;
+		}
+		gain[i] = 0.5f * (1.0f - r * r);
+		a1[i] = -2.0f * r * cosf(2.0f * float(M_PI) * frequency / sampleRate);
+		a2[i] = r * r;
+		numActive = i + 1;
+	}
+}
+
+void ResonatorBank::reset(){
+	std::fill(y1.begin(), y1.end(), 0.0f);
+	std::fill(y2.begin(), y2.end(), 0.0f);
+	x1 = x2 = 0.0f;
+}
+
+float ResonatorBank::process(float input){
+	float difference = input - x2;
+	x2 = x1;
+	x1 = input;
+	// Only the groups of four holding tuned resonators
+	int active = (numActive + 3) & ~3;
+#ifdef RESONATOR_BANK_NEON
+	float32x4_t difference4 = vdupq_n_f32(difference);
+	float32x4_t sum4 = vdupq_n_f32(0.0f);
+	for(int i = 0; i < active; i += 4){
+		float32x4_t previous = vld1q_f32(&y1[i]);
+		float32x4_t y = vmulq_f32(vld1q_f32(&gain[i]), difference4);
+		y = vmlsq_f32(y, vld1q_f32(&a1[i]), previous);
+		y = vmlsq_f32(y, vld1q_f32(&a2[i]), vld1q_f32(&y2[i]));
+		vst1q_f32(&y2[i], previous);
+		vst1q_f32(&y1[i], y);
+		sum4 = vaddq_f32(sum4, y);
+	}
+	float32x2_t sum2 = vadd_f32(vget_low_f32(sum4), vget_high_f32(sum4));
+	return vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+#else
+	float sum = 0.0f;
+	for(int i = 0; i < active; i++){
+		float y = gain[i] * difference - a1[i] * y1[i] - a2[i] * y2[i];
+		y2[i] = y1[i];
+		y1[i] = y;
+		sum += y;
+	}
+	return sum;
+#endif
+}
+
+int ResonatorBank::getNumActive(){
+	return numActive;
+}
+
+int ResonatorBank::getMemoryUsage(){
+	return sizeof(ResonatorBank) + 5 * capacity * sizeof(float);
+}
@@ -0,0 +1,52 @@
+/*****
+ * ResonatorBank.h
+ * Bank of two-pole bandpass resonators tuned to the harmonics of a note
+ *
+ * All resonators see the same input sample, so the bank is vectorised across resonators
+ * (four at a time with NEON). Each resonator is a constant peak gain resonator
+ *   y[n] = g * (x[n] - x[n-2]) - a1 * y[n-1] - a2 * y[n-2]
+ * with unity gain at its centre frequency. The only state is two samples per resonator
+ * (plus the shared input history), so a voice using it needs no buffer and no preparation
+*****/
+#ifndef RESONATOR_BANK_H
+#define RESONATOR_BANK_H
+
+#include <vector>
+
+class ResonatorBank {
+	public:
+		ResonatorBank(int maxResonators);
+
+		// Tune the first numHarmonics resonators to the harmonics of fundamental (harmonics above
+		// maxFrequency are left out) with the given bandwidth in Hz, the others are silenced
+		// Does not allocate, can be called from the audio thread
+		void tuneHarmonics(float fundamental, int numHarmonics, float bandwidth, float maxFrequency, float sampleRate);
+
+		// Clear the filter state
+		void reset();
+
+		// Feed one input sample, returns the sum of all resonator outputs
+		float process(float input);
+
+		// Number of resonators tuned by the last tuneHarmonics()
+		int getNumActive();
+
+		// Bytes used by the coefficients and the state
+		int getMemoryUsage();
+
+	private:
+		// Number of resonators rounded up to a multiple of four (the padding stays silent)
+		int capacity = 0;
+		int numActive = 0;
+		// Coefficients and state, one entry per resonator
+		std::vector<float> gain;
+		std::vector<float> a1;
+		std::vector<float> a2;
+		std::vector<float> y1;
+		std::vector<float> y2;
+		// Input history shared by all resonators
+		float x1 = 0.0f;
+		float x2 = 0.0f;
+};
+
+#endif
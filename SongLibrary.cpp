@@ -0,0 +1,607 @@
+/***** SongLibrary.cpp *****/
+#include "SongLibrary.h"
+#include "VectorOps.h"
+#include "Resampler.h"
+#include <libraries/sndfile/sndfile.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Layout of the float32 cache files: a 64 byte header followed by the mono samples
+const char SONG_CACHE_MAGIC[8] = "PAGSONG";
+const unsigned int SONG_CACHE_VERSION = 3;
+const int SONG_CACHE_HEADER_SIZE = 64;
+
+struct SongCacheHeader {
+	char magic[8];
+	unsigned int version;
+	// Rate of the cached samples (the song is resampled if the source file has another rate)
+	int sampleRate;
+	long long sampleLen;
+	// Size and modification time of the source file the cache was decoded from
+	long long sourceSize;
+	long long sourceModified;
+	int sourceSampleRate;
+	// AnalysisCache::hashSamples() of the cached samples, so the analysis cache is matched without reading them again
+	unsigned long long contentHash;
+	char reserved[SONG_CACHE_HEADER_SIZE - 56];
+};
+static_assert(sizeof(SongCacheHeader) == SONG_CACHE_HEADER_SIZE, "Song cache header must be 64 bytes");
+
+// Number of frames decoded at once when writing the cache file
+const int DECODE_CHUNK_FRAMES = 65536;
+
+// File extensions picked up when scanning a directory
+static bool isAudioFile(const string& name){
+	const char* extensions[] = { ".wav", ".flac", ".aif", ".aiff", ".ogg" };
+	for(auto extension : extensions){
+		size_t length = strlen(extension);
+		if(name.size() > length && strcasecmp(name.c_str() + name.size() - length, extension) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Name of the cache files of a song: the file name (for finding them) and a hash of the whole path,
+// so songs with the same file name in different folders never share a cache
+static string cacheNameFor(const string& path){
+	// FNV-1a over the characters of the path
+	unsigned long long hash = 14695981039346656037ULL;
+	for(unsigned char character : path){
+		hash ^= character;
+		hash *= 1099511628211ULL;
+	}
+	char suffix[20];
+	snprintf(suffix, sizeof(suffix), "-%016llx", hash);
+	return path.substr(path.rfind('/') + 1) + suffix;
+}
+
+static bool isDirectory(const string& path){
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+SongLibrary::SongLibrary()
+	: sampleRate (0), quality (QUALITY_TIERS[DEFAULT_QUALITY_TIER]), qualityGeneration (0), lastRequested (-1), useCounter (0),
+	pendingRequests (false), pendingAnalyses (false), nextAnalysisRetry (0), nextToPrepare (0), numPreparationThreads (0), finishedPreparationThreads (0), stopPreparation (false) {
+}
+
+int SongLibrary::scan(const string& location, const string& cacheDirectory){
+	vector<string> paths;
+
+	if(isDirectory(location)){
+		// All audio files in the directory, sorted by name
+		DIR* directory = opendir(location.c_str());
+		if(directory != nullptr){
+			struct dirent* entry;
+			while((entry = readdir(directory)) != nullptr){
+				string name = entry->d_name;
+				if(isAudioFile(name))
+					paths.push_back(location + "/" + name);
+			}
+			closedir(directory);
+		}
+		sort(paths.begin(), paths.end());
+	} else {
+		// Manifest: one file per line, relative paths are relative to the manifest, # starts a comment
+		ifstream manifest(location);
+		if(!manifest){
+			cout << "Couldn't open song manifest " << location << endl;
+			return 0;
+		}
+		string base = location.find('/') == string::npos ? "" : location.substr(0, location.rfind('/') + 1);
+		string line;
+		while(getline(manifest, line)){
+			line.erase(line.find_last_not_of(" \t\r") + 1);
+			if(line.empty() || line[0] == '#')
+				continue;
+			paths.push_back(line[0] == '/' ? line : base + line);
+		}
+	}
+
+	mkdir(cacheDirectory.c_str(), 0755);
+
+	for(auto& path : paths){
+		unique_ptr<Song> song(new Song());
+		song->path = path;
+		// Cache files named after the source file and its path
+		string name = cacheNameFor(path);
+		song->cachePath = cacheDirectory + "/" + name + ".f32";
+		song->analysisBase = cacheDirectory + "/" + name;
+		song->analysisPath = analysisPathFor(*song);
+		songs.push_back(move(song));
+	}
+
+	cout << "Song library: " << songs.size() << " songs in " << location << endl;
+	return songs.size();
+}
+
+void SongLibrary::setSampleRate(int rate){
+	sampleRate = rate;
+}
+
+void SongLibrary::setQuality(const QualityTier& quality){
+	lock_guard<mutex> lock(analysisMutex);
+	this->quality = quality;
+	qualityGeneration++;
+	for(auto& song : songs){
+		song->analysis.close();
+		song->analysisPath = analysisPathFor(*song);
+		song->analysisFailures = 0;
+		if(song->state.load() == ready)
+			song->analysisStale = !song->analysis.open(song->analysisPath, song->contentHash, quality);
+	}
+	pendingAnalyses = true;
+}
+
+string SongLibrary::analysisPathFor(const Song& song){
+	return song.analysisBase + "." + to_string(quality.fftSize) + "-" + to_string(quality.hopSize) + ".stft";
+}
+
+int SongLibrary::size(){
+	return songs.size();
+}
+
+const string& SongLibrary::getName(int index){
+	return songs[index]->path;
+}
+
+SampleData* SongLibrary::get(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return nullptr;
+	Song& song = *songs[index];
+	if(song.state.load(memory_order_acquire) != ready)
+		return nullptr;
+	return &song.data;
+}
+
+AnalysisCache* SongLibrary::getAnalysis(int index){
+	if(get(index) == nullptr)
+		return nullptr;
+	AnalysisCache& analysis = songs[index]->analysis;
+	return analysis.isReady() ? &analysis : nullptr;
+}
+
+void SongLibrary::request(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return;
+	lastRequested = index;
+
+	// The song itself and its neighbours
+	for(int i = index - SONG_PREFETCH_NEIGHBOURS; i <= index + SONG_PREFETCH_NEIGHBOURS; i++){
+		if(i < 0 || i >= int(songs.size()))
+			continue;
+		Song& song = *songs[i];
+		song.lastUsed = ++useCounter;
+		if(song.state.load() != ready && song.state.load() != failed)
+			song.requested = true;
+	}
+	pendingRequests = true;
+}
+
+void SongLibrary::retain(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return;
+	songs[index]->users++;
+	songs[index]->lastUsed = ++useCounter;
+}
+
+void SongLibrary::release(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return;
+	songs[index]->users--;
+	songs[index]->lastUsed = ++useCounter;
+}
+
+bool SongLibrary::hasPendingRequests(){
+	return pendingRequests;
+}
+
+void SongLibrary::processRequests(){
+	pendingRequests = false;
+
+	// The explicitly requested song goes first
+	int first = lastRequested;
+	if(first >= 0 && songs[first]->requested){
+		songs[first]->requested = false;
+		load(first);
+	}
+
+	// Then the prefetched neighbours
+	for(int i = 0; i < int(songs.size()); i++){
+		if(songs[i]->requested){
+			songs[i]->requested = false;
+			load(i);
+		}
+	}
+
+	evict();
+}
+
+bool SongLibrary::hasPendingAnalyses(){
+	if(pendingAnalyses)
+		return true;
+	long long retry = nextAnalysisRetry;
+	return retry != 0 && chrono::steady_clock::now().time_since_epoch().count() >= retry;
+}
+
+void SongLibrary::processAnalyses(){
+	pendingAnalyses = false;
+	nextAnalysisRetry = 0;
+
+	// Analyse the songs being played and the requested one first, then the other loaded songs
+	for(int i = 0; i < int(songs.size()); i++){
+		if(songs[i]->users > 0)
+			rebuildAnalysis(i);
+	}
+	rebuildAnalysis(lastRequested);
+	for(int i = 0; i < int(songs.size()); i++){
+		rebuildAnalysis(i);
+	}
+
+	// Come back for the songs whose build failed once the earliest of their retries is due
+	lock_guard<mutex> lock(analysisMutex);
+	long long retry = 0;
+	for(auto& song : songs){
+		if(song->state.load() != ready || !song->analysisStale || song->analysisFailures == 0)
+			continue;
+		long long songRetry = song->analysisRetry.time_since_epoch().count();
+		if(retry == 0 || songRetry < retry)
+			retry = songRetry;
+	}
+	nextAnalysisRetry = retry;
+}
+
+void SongLibrary::rebuildAnalysis(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return;
+	Song& song = *songs[index];
+
+	// Take what the build needs under the lock, evict() does not unmap the song while it is analysed
+	string path;
+	SampleData data;
+	unsigned long long contentHash;
+	QualityTier tier;
+	unsigned int generation;
+	{
+		lock_guard<mutex> lock(analysisMutex);
+		if(song.state.load() != ready || !song.analysisStale)
+			return;
+		if(song.analysisFailures > 0 && chrono::steady_clock::now() < song.analysisRetry)
+			return;
+		song.analysing = true;
+		path = song.analysisPath;
+		data = song.data;
+		contentHash = song.contentHash;
+		tier = quality;
+		generation = qualityGeneration;
+	}
+
+	// Song loads, other songs and setQuality() go on meanwhile
+	auto start = chrono::steady_clock::now();
+	AnalysisCache built;
+	bool ok = built.build(path, data, contentHash, tier);
+	built.close();
+	if(ok){
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		printf("Analysis cache for %s built in %.2f seconds\n", song.path.c_str(), seconds);
+	}
+
+	// Only used if the tier is still the one it was built for, otherwise setQuality() has marked the song again
+	lock_guard<mutex> lock(analysisMutex);
+	if(generation == qualityGeneration){
+		if(ok && song.analysis.open(path, contentHash, tier)){
+			song.analysisStale = false;
+			song.analysisFailures = 0;
+		}
+		else{
+			// Stays stale, retried later rather than on every pass (the disk may be full or read-only)
+			double delay = min(ANALYSIS_RETRY_SECONDS * (1 << min(song.analysisFailures, 16)), ANALYSIS_RETRY_MAX_SECONDS);
+			song.analysisFailures++;
+			song.analysisRetry = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(delay));
+			printf("Analysis cache for %s failed %d times, retrying in %.0f seconds\n", song.path.c_str(), song.analysisFailures, delay);
+		}
+	}
+	song.analysing = false;
+}
+
+bool SongLibrary::load(int index){
+	if(index < 0 || index >= int(songs.size()))
+		return false;
+	Song& song = *songs[index];
+
+	int state = song.state.load();
+	if(state == ready)
+		return true;
+	if(state == failed)
+		return false;
+	song.state = loading;
+
+	// Decode once, afterwards only map the cache file
+	if(!ensureCache(song)){
+		song.state = failed;
+		return false;
+	}
+	if(!mapCache(song)){
+		song.state = failed;
+		return false;
+	}
+
+	// Use the persistent analysis if it matches, otherwise it is rebuilt by processAnalyses()
+	{
+		lock_guard<mutex> lock(analysisMutex);
+		song.analysisStale = !song.analysis.open(song.analysisPath, song.contentHash, quality);
+		if(song.analysisStale)
+			pendingAnalyses = true;
+	}
+
+	song.state.store(ready, memory_order_release);
+	return true;
+}
+
+bool SongLibrary::ensureCache(Song& song){
+	// The preparation threads and the loader may get to the same song at the same time
+	lock_guard<mutex> lock(song.decodeMutex);
+	return isCacheValid(song) || decode(song);
+}
+
+void SongLibrary::prepareAll(int numThreads){
+	nextToPrepare = 0;
+	numPreparationThreads = numThreads;
+	preparationStart = chrono::steady_clock::now();
+	for(int i = 0; i < numThreads; i++){
+		preparationThreads.push_back(thread(&SongLibrary::prepareWorker, this));
+	}
+}
+
+void SongLibrary::waitForPreparation(){
+	for(auto& worker : preparationThreads){
+		if(worker.joinable())
+			worker.join();
+	}
+	preparationThreads.clear();
+}
+
+void SongLibrary::prepareWorker(){
+	// Take the next song until all are done
+	int decoded = 0;
+	while(!stopPreparation){
+		int index = nextToPrepare++;
+		if(index >= int(songs.size()))
+			break;
+		if(ensureCache(*songs[index]))
+			decoded++;
+	}
+
+	// The last worker to finish reports the total time
+	if(++finishedPreparationThreads == numPreparationThreads){
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - preparationStart).count();
+		printf("Song library: prepared %d songs on %d threads in %.2f seconds\n", int(songs.size()), numPreparationThreads, seconds);
+	}
+}
+
+bool SongLibrary::isCacheValid(Song& song){
+	struct stat source;
+	if(stat(song.path.c_str(), &source) != 0)
+		return false;
+
+	FILE* file = fopen(song.cachePath.c_str(), "rb");
+	if(file == nullptr)
+		return false;
+	SongCacheHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, SONG_CACHE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == SONG_CACHE_VERSION
+		&& header.sourceSize == (long long)source.st_size
+		&& header.sourceModified == (long long)source.st_mtime
+		&& (sampleRate == 0 || header.sampleRate == sampleRate);
+	fclose(file);
+	return valid;
+}
+
+bool SongLibrary::decode(Song& song){
+	SNDFILE *sndfile;
+	SF_INFO sfinfo;
+	sfinfo.format = 0;
+	if (!(sndfile = sf_open (song.path.c_str(), SFM_READ, &sfinfo))) {
+		cout << "Couldn't open file " << song.path << ": " << sf_strerror(sndfile) << endl;
+		return false;
+	}
+
+	// Write to a temporary file first so that an interrupted decode never leaves a valid looking cache
+	string temporaryPath = song.cachePath + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb+");
+	if(file == nullptr){
+		cout << "Couldn't create cache file " << temporaryPath << endl;
+		sf_close(sndfile);
+		return false;
+	}
+
+	// The header is written again with the final length once all samples are in
+	struct stat source;
+	stat(song.path.c_str(), &source);
+	SongCacheHeader header = {};
+	memcpy(header.magic, SONG_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SONG_CACHE_VERSION;
+	header.sampleRate = sfinfo.samplerate;
+	header.sourceSize = source.st_size;
+	header.sourceModified = source.st_mtime;
+	header.sourceSampleRate = sfinfo.samplerate;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	// The grain engine assumes the song is at the audio rate
+	unique_ptr<Resampler> resampler;
+	if(sampleRate > 0 && sfinfo.samplerate != sampleRate){
+		resampler.reset(new Resampler(sfinfo.samplerate, sampleRate));
+		header.sampleRate = sampleRate;
+	}
+	auto start = chrono::steady_clock::now();
+
+	// Decode, downmix and resample in chunks straight into the cache file, so a decoder never holds more than
+	// a chunk of the song; the peak of the mono signal is computed in the same pass
+	int numChan = sfinfo.channels;
+	vector<float> chunk(DECODE_CHUNK_FRAMES * numChan);
+	vector<float> mono(DECODE_CHUNK_FRAMES);
+	vector<float> resampled;
+	float peak = 0.0f;
+	long long written = 0;
+	sf_count_t position = 0;
+	while(ok && position < sfinfo.frames){
+		int frames = (int)min<sf_count_t>(sfinfo.frames - position, DECODE_CHUNK_FRAMES);
+		sf_count_t readcount = sf_readf_float(sndfile, chunk.data(), frames);
+		// Pad with zeros in case we couldn't read whole file
+		if(readcount <= 0)
+			readcount = 0;
+		peak = max(peak, downmixToMono(chunk.data(), mono.data(), (int)readcount, numChan));
+		fill(mono.begin() + readcount, mono.begin() + frames, 0.0f);
+		const float* output = mono.data();
+		int outputLength = frames;
+		if(resampler){
+			resampler->push(mono.data(), frames, resampled);
+			output = resampled.data();
+			outputLength = resampled.size();
+		}
+		ok = fwrite(output, sizeof(float), outputLength, file) == (size_t)outputLength;
+		written += outputLength;
+		position += frames;
+	}
+	if(ok && resampler){
+		resampler->flush(resampled);
+		ok = fwrite(resampled.data(), sizeof(float), resampled.size(), file) == resampled.size();
+		written += resampled.size();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		printf("Resampled %s from %d Hz to %d Hz in %.2f seconds\n", song.path.c_str(), sfinfo.samplerate, sampleRate, seconds);
+	}
+	int subformat = sfinfo.format & SF_FORMAT_SUBMASK;
+	sf_close(sndfile);
+
+	header.sampleLen = written;
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+
+	// Float files are scaled by their peak value, in place in the cache file (the peak is only known at the end)
+	float scale = 1.0f;
+	if (ok && (subformat == SF_FORMAT_FLOAT || subformat == SF_FORMAT_DOUBLE)) {
+		scale = peak < 1e-10 ? 1.0f : 32700.0f / peak;
+		cout << "File samples scale = " << scale << endl;
+	}
+	ok = ok && finishCacheFile(temporaryPath, scale);
+
+	if(!ok || rename(temporaryPath.c_str(), song.cachePath.c_str()) != 0){
+		cout << "Couldn't write cache file " << song.cachePath << endl;
+		unlink(temporaryPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool SongLibrary::finishCacheFile(const string& path, float scale){
+	int fd = open(path.c_str(), O_RDWR);
+	if(fd < 0)
+		return false;
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size < SONG_CACHE_HEADER_SIZE){
+		close(fd);
+		return false;
+	}
+	void* mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+		return false;
+	// Page by page through the page cache, the song is never held in memory as a whole
+	SongCacheHeader* header = (SongCacheHeader*) mapping;
+	float* samples = (float*)((char*)mapping + SONG_CACHE_HEADER_SIZE);
+	long long available = (info.st_size - SONG_CACHE_HEADER_SIZE) / sizeof(float);
+	if(scale != 1.0f)
+		scaleInPlace(samples, available, scale);
+	// Over the samples as mapCache() maps them
+	SampleData data = { samples, (int)min(header->sampleLen, available) };
+	header->contentHash = AnalysisCache::hashSamples(data);
+	return munmap(mapping, info.st_size) == 0;
+}
+
+bool SongLibrary::mapCache(Song& song){
+	int fd = open(song.cachePath.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size < SONG_CACHE_HEADER_SIZE){
+		close(fd);
+		return false;
+	}
+	void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the file open
+	close(fd);
+	if(mapping == MAP_FAILED){
+		cout << "Couldn't map cache file " << song.cachePath << endl;
+		return false;
+	}
+
+	const SongCacheHeader* header = (const SongCacheHeader*) mapping;
+	long long available = (info.st_size - SONG_CACHE_HEADER_SIZE) / sizeof(float);
+	song.mapping = mapping;
+	song.mappingLength = info.st_size;
+	song.data.samples = (float*)((char*)mapping + SONG_CACHE_HEADER_SIZE);
+	song.data.sampleLen = (int)min(header->sampleLen, available);
+	song.contentHash = header->contentHash;
+	return true;
+}
+
+void SongLibrary::unmapCache(Song& song){
+	song.state = unloaded;
+	{
+		lock_guard<mutex> lock(analysisMutex);
+		song.analysis.close();
+	}
+	if(song.mapping != nullptr)
+		munmap(song.mapping, song.mappingLength);
+	song.mapping = nullptr;
+	song.mappingLength = 0;
+	song.contentHash = 0;
+	song.data.samples = nullptr;
+	song.data.sampleLen = 0;
+}
+
+void SongLibrary::evict(){
+	while(true){
+		int mapped = 0;
+		int oldest = -1;
+		{
+			// Under the lock so that processAnalyses() never starts on a song being unmapped
+			lock_guard<mutex> lock(analysisMutex);
+			for(int i = 0; i < int(songs.size()); i++){
+				if(songs[i]->state != ready)
+					continue;
+				mapped++;
+				// Never unmap the songs being played or analysed or the one about to be played
+				if(songs[i]->users > 0 || songs[i]->analysing || i == lastRequested)
+					continue;
+				if(oldest < 0 || songs[i]->lastUsed < songs[oldest]->lastUsed)
+					oldest = i;
+			}
+			if(mapped <= MAX_MAPPED_SONGS || oldest < 0)
+				break;
+			songs[oldest]->state = unloaded;
+		}
+		unmapCache(*songs[oldest]);
+	}
+}
+
+SongLibrary::~SongLibrary(){
+	stopPreparation = true;
+	waitForPreparation();
+	for(auto& song : songs){
+		unmapCache(*song);
+	}
+}
@@ -0,0 +1,204 @@
+/*****
+ * SongLibrary.h
+ * Library of source songs that replaces the three fixed files loaded at startup
+ *
+ * The library is built from a manifest (one audio file per line) or by scanning a directory.
+ * Songs are decoded on first use into a float32 cache file which is then memory-mapped,
+ * so switching songs is a pointer swap and resident memory follows the songs in use.
+ * Songs at another rate than the audio device are resampled once while decoding.
+ * Loading happens on a background task: the audio thread only requests songs and polls get()
+*****/
+#ifndef SONG_LIBRARY_H
+#define SONG_LIBRARY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "SampleData.h"
+#include "AnalysisCache.h"
+
+// Maximum number of songs kept memory-mapped at the same time
+// Songs that were used least recently are unmapped first (the cache files stay on disk)
+const int MAX_MAPPED_SONGS = 8;
+
+// How many songs on either side of a requested song are prefetched
+const int SONG_PREFETCH_NEIGHBOURS = 1;
+
+// Seconds before a failed analysis cache build is retried, doubled with every further failure of the song
+const double ANALYSIS_RETRY_SECONDS = 10.0;
+const double ANALYSIS_RETRY_MAX_SECONDS = 600.0;
+
+class SongLibrary {
+	public:
+		SongLibrary();
+		~SongLibrary();
+
+		// Build the library from a manifest file (one path per line, relative to the manifest)
+		// or from all audio files in a directory (sorted by name)
+		// Decoded songs are cached in cacheDirectory
+		// Returns the number of songs found
+		int scan(const std::string& location, const std::string& cacheDirectory);
+
+		// Rate all songs are converted to when they are decoded (0 keeps the rate of the source file)
+		// Has to be set before songs are loaded
+		void setSampleRate(int rate);
+
+		// Quality tier of the analysis caches
+		// Songs that are loaded already switch to the cache of the new tier (rebuilt by processAnalyses() if missing)
+		// Not called from the audio thread, and only while no task reads the analysis of a song
+		void setQuality(const QualityTier& quality);
+
+		// Number of songs in the library
+		int size();
+
+		// Name of the song file (for printing)
+		const std::string& getName(int index);
+
+		// Sample data of a song if it is loaded, nullptr otherwise
+		// Never blocks, can be called from the audio thread
+		SampleData* get(int index);
+
+		// Persistent STFT of a song if it is loaded and its analysis cache is valid, nullptr otherwise
+		// Never blocks, can be called from the audio thread
+		AnalysisCache* getAnalysis(int index);
+
+		// Ask for a song (and its neighbours) to be loaded by processRequests()
+		// Never blocks, can be called from the audio thread
+		void request(int index);
+
+		// Tell the library that a song is played (or read as grain source slice) by one more / one less engine instance
+		// Songs that are played are never unmapped
+		// Never blocks, can be called from the audio thread
+		void retain(int index);
+		void release(int index);
+
+		// Whether there are requests that processRequests() has not handled yet
+		bool hasPendingRequests();
+
+		// Load all requested songs (requested song first, then the prefetched neighbours)
+		// and unmap songs that were not used for the longest time
+		// Called from a background task
+		void processRequests();
+
+		// Whether loaded songs have a missing or stale analysis cache that processAnalyses() has not rebuilt yet
+		// (a song whose build failed only once its retry is due)
+		bool hasPendingAnalyses();
+
+		// Rebuild the stale analysis caches of the loaded songs (played songs first, then the requested one, then the others)
+		// Takes one FFT per hop of every song, so it is called from a task below the one calling processRequests(),
+		// which is never held up by it; the songs are analysed without holding the library locks
+		void processAnalyses();
+
+		// Decode (if necessary) and map a song right away, blocking the calling thread
+		bool load(int index);
+
+		// Decode the cache files of all songs without a valid one on numThreads background threads
+		// Returns immediately, songs loaded in the meantime are never decoded twice
+		void prepareAll(int numThreads);
+
+		// Wait until prepareAll() is done
+		void waitForPreparation();
+
+	private:
+		enum SongState {
+			unloaded = 0,
+			loading,
+			ready,
+			failed
+		};
+
+		struct Song {
+			// Path of the source audio file
+			std::string path;
+			// Path of the decoded float32 cache file
+			std::string cachePath;
+			// Path of the analysis cache files without the tier suffix
+			std::string analysisBase;
+			// Path of the analysis cache file of the current quality tier and the mapped analysis
+			std::string analysisPath;
+			AnalysisCache analysis;
+			// Set when the song was loaded but its analysis cache is missing or stale (until a build succeeds)
+			std::atomic<bool> analysisStale;
+			// Failed builds of the analysis cache of the current tier and when the next one may start
+			int analysisFailures = 0;
+			std::chrono::steady_clock::time_point analysisRetry;
+			// Set while processAnalyses() reads the samples (the song is not unmapped meanwhile)
+			std::atomic<bool> analysing;
+			// Samples point into the memory-mapped cache file once the song is ready
+			SampleData data = { nullptr, 0 };
+			// Start and length of the mapping
+			void* mapping = nullptr;
+			size_t mappingLength = 0;
+			// Content hash of the samples recorded when the song was decoded (matched against the analysis cache)
+			unsigned long long contentHash = 0;
+			// SongState, written by the loader and read by the audio thread
+			std::atomic<int> state;
+			// Set by request(), cleared by processRequests()
+			std::atomic<bool> requested;
+			// Counter value of the last time the song was requested or played (for unmapping)
+			std::atomic<unsigned int> lastUsed;
+			// Number of engine instances playing the song
+			std::atomic<int> users;
+			// Held while checking / writing the cache file
+			std::mutex decodeMutex;
+
+			Song() : analysisStale (false), analysing (false), state (unloaded), requested (false), lastUsed (0), users (0) {}
+		};
+
+		std::vector<std::unique_ptr<Song>> songs;
+
+		// Rate of the decoded songs
+		int sampleRate;
+
+		// Quality tier of the analysis caches
+		QualityTier quality;
+		// Held while an analysis is opened, closed or switched to another tier (not while it is built)
+		std::mutex analysisMutex;
+		// Incremented by setQuality(), an analysis built for an older tier is not opened
+		unsigned int qualityGeneration;
+		// Analysis cache file of a song for the current tier (every tier has its own file)
+		std::string analysisPathFor(const Song& song);
+
+		// Song that was requested last (is loaded before its neighbours)
+		std::atomic<int> lastRequested;
+		// Counter used to order song usage
+		std::atomic<unsigned int> useCounter;
+		// Whether any song is waiting to be loaded
+		std::atomic<bool> pendingRequests;
+		// Whether any loaded song may have a stale analysis
+		std::atomic<bool> pendingAnalyses;
+		// Earliest retry of a failed analysis build (steady_clock ticks, 0 if none is waiting)
+		std::atomic<long long> nextAnalysisRetry;
+
+		// Threads started by prepareAll() and their progress
+		std::vector<std::thread> preparationThreads;
+		std::atomic<int> nextToPrepare;
+		int numPreparationThreads;
+		std::atomic<int> finishedPreparationThreads;
+		std::atomic<bool> stopPreparation;
+		std::chrono::steady_clock::time_point preparationStart;
+		void prepareWorker();
+
+		// Decode the song unless its cache file is up to date
+		bool ensureCache(Song& song);
+		// Decode the source audio file into the cache file (multichannel files are downmixed to mono, other rates are resampled)
+		bool decode(Song& song);
+		// Multiply the samples of a written cache file by scale in place and record their content hash in its header
+		bool finishCacheFile(const std::string& path, float scale);
+		// Whether the cache file exists, matches the source file and is at the requested rate
+		bool isCacheValid(Song& song);
+		// Memory-map the cache file
+		bool mapCache(Song& song);
+		// Unmap the song (its cache file stays on disk)
+		void unmapCache(Song& song);
+		// Unmap the least recently used songs so that at most MAX_MAPPED_SONGS stay mapped
+		void evict();
+		// Rebuild the analysis cache of a loaded song if it is stale
+		void rebuildAnalysis(int index);
+};
+
+#endif
@@ -0,0 +1,601 @@
+/***** StressTest.cpp *****/
+#include "StressTest.h"
+#include "Globals.h"
+#include "LaneFft.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+StressTest::StressTest(int blockSize, float sampleRate, float budget, const QualityTier& quality, int numWorkerThreads)
+	: blockSize (blockSize), sampleRate (sampleRate), budget (budget), quality (quality), pool (numWorkerThreads),
+	synthesisScheduled (false), sourceScheduled (false) {
+	// The song: noise long enough for the source position to move around
+	noise.resize(int(STRESS_NOISE_SECONDS * sampleRate));
+	unsigned int state = 1;
+	for (auto& sample : noise){
+		state = state * 1664525u + 1013904223u;
+		sample = float(state >> 8) / float(1 << 24) - 0.5f;
+	}
+	noiseData = { noise.data(), int(noise.size()) };
+
+	// One engine for all notes, set up like setup() in render.cpp does
+	grainSourceCache.reset(new GrainSourceCache(quality, sampleRate, gMultiResolution, pool));
+	EngineParameters parameters;
+	parameters.grainLength = int(0.1f * sampleRate);
+	parameters.grainFrequency = int(sampleRate);
+	engines.push_back(unique_ptr<Engine>(new Engine(sampleRate, quality, 1, { -1, 0, 127 }, parameters, &noiseData, nullptr)));
+	engines[0]->updateWindow();
+	engines[0]->takeWindowUpdate();
+	Engine::updateGrainSources(engines, *grainSourceCache);
+
+	synthesisThread = thread(&StressTest::synthesisWorker, this);
+	sourceThread = thread(&StressTest::sourceWorker, this);
+}
+
+void StressTest::synthesisWorker(){
+	while(true){
+		{
+			unique_lock<mutex> lock(workerMutex);
+			workerCondition.wait_for(lock, chrono::milliseconds(1), [this]{ return stopWorkers || synthesisScheduled; });
+			if(stopWorkers)
+				return;
+		}
+		if(!synthesisScheduled)
+			continue;
+		Engine::synthesise(engines, pool);
+		synthesisScheduled = false;
+	}
+}
+
+void StressTest::sourceWorker(){
+	while(true){
+		{
+			unique_lock<mutex> lock(workerMutex);
+			workerCondition.wait_for(lock, chrono::milliseconds(1), [this]{ return stopWorkers || sourceScheduled; });
+			if(stopWorkers)
+				return;
+		}
+		if(!sourceScheduled)
+			continue;
+		// A new source position or a level a note waits for
+		Engine::updateGrainSources(engines, *grainSourceCache);
+		sourceScheduled = false;
+	}
+}
+
+void StressTest::releaseAll(){
+	for (int note = 0; note < 128; note++){
+		engines[0]->noteOff(note);
+	}
+}
+
+void StressTest::waitForWorkers(){
+	while(synthesisScheduled || sourceScheduled){
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+}
+
+StressResult StressTest::run(const StressConfig& config, float seconds){
+	// Configure the engine like render.cpp does when the UI changes (the number of overtones has no control,
+	// it is set on the voices while no note plays and the workers are idle)
+	Engine& engine = *engines[0];
+	releaseAll();
+	waitForWorkers();
+	for (auto& voice : engine.getVoices()){
+		voice->setNumOvertones(config.overtones);
+	}
+	EngineParameters& parameters = engine.getParameters();
+	parameters.grainLength = min(int(config.grainLengthMs * 0.001f * sampleRate), MAX_GRAIN_LENGTH);
+	parameters.grainFrequency = int(sampleRate / config.grainsPerSecond);
+	parameters.scatter = config.scatter;
+	if(engine.applyParameters() & ENGINE_UPDATE_WINDOW){
+		engine.takeWindowUpdate();
+		engine.updateWindow();
+	}
+
+	// Event pattern: a new chord every 500ms, one retrigger every 50ms and a source position change every 200ms
+	double period = blockSize / sampleRate;
+	int numBlocks = int(seconds / period);
+	int chordInterval = max(1, int(0.5 / period));
+	int retriggerInterval = max(1, int(0.05 / period));
+	int scrubInterval = max(1, int(0.2 / period));
+	int maxPosition = noiseData.sampleLen - (quality.sourceSamples() + quality.fftSize);
+	int chordNumber = 0;
+	int retrigger = 0;
+	int scrub = 0;
+
+	// Notes waiting to be played (a busy voice is retried in the next block, like in render.cpp)
+	// and the voices waiting for their first hop
+	bool pendingNotes[128] = {};
+	bool latencyPending[NUM_VOICES] = {};
+	chrono::steady_clock::time_point noteOnTimes[NUM_VOICES];
+
+	StressResult result;
+	vector<double> blockTimes;
+	blockTimes.reserve(numBlocks);
+	double latencySum = 0.0;
+	volatile float sink = 0.0f;
+
+	auto deadline = chrono::steady_clock::now();
+	for (int block = 0; block < numBlocks; block++){
+		auto start = chrono::steady_clock::now();
+
+		if(block % scrubInterval == scrubInterval / 2){
+			parameters.sourcePosition = (++scrub * 7 * quality.hopSize) % max(1, maxPosition);
+		}
+		if(engine.applyParameters() & ENGINE_UPDATE_SOURCE)
+			sourceScheduled = true;
+
+		if(block % chordInterval == 0){
+			releaseAll();
+			for (int i = 0; i < config.polyphony; i++){
+				pendingNotes[48 + (chordNumber * 5 + i * 4) % 40] = true;
+			}
+			chordNumber++;
+		} else if(block % retriggerInterval == 0){
+			pendingNotes[48 + ((chordNumber - 1) * 5 + (retrigger++ % config.polyphony) * 4) % 40] = true;
+		}
+		for (int note = 0; note < 128; note++){
+			if(!pendingNotes[note] || !engine.noteOn(note, powf(2, (note - 69) / 12.f) * 440))
+				continue;
+			pendingNotes[note] = false;
+			int voice = engine.getNoteVoice(note);
+			if(voice != NOT_PLAYING_I){
+				noteOnTimes[voice] = start;
+				latencyPending[voice] = true;
+			}
+		}
+
+		// Latency until the first hop can be played
+		for (int i = 0; i < NUM_VOICES; i++){
+			if(latencyPending[i] && engine.getVoices()[i]->getReadySamples() > 0){
+				double latency = chrono::duration<double, milli>(start - noteOnTimes[i]).count();
+				latencySum += latency;
+				result.maxNoteOnLatency = max(result.maxNoteOnLatency, latency);
+				result.noteOns++;
+				latencyPending[i] = false;
+			}
+		}
+
+		// The per-frame work of render()
+		for (int n = 0; n < blockSize; n++){
+			float frame[1] = { 0.0f };
+			engine.process(frame);
+			sink = sink + frame[0];
+		}
+		if(!synthesisScheduled && engine.needsSynthesis())
+			synthesisScheduled = true;
+		if(!sourceScheduled && engine.requestLevels())
+			sourceScheduled = true;
+
+		double blockTime = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+		blockTimes.push_back(blockTime);
+		if(blockTime > period * 1e6)
+			result.xruns++;
+
+		// Wake the workers and wait for the next period
+		if(synthesisScheduled || sourceScheduled)
+			workerCondition.notify_all();
+		deadline += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(period));
+		this_thread::sleep_until(deadline);
+	}
+
+	result.blocks = blockTimes.size();
+	if(result.blocks > 0){
+		double sum = 0.0;
+		for (double time : blockTimes){
+			sum += time;
+		}
+		result.meanBlockTime = sum / result.blocks;
+		sort(blockTimes.begin(), blockTimes.end());
+		result.p99BlockTime = blockTimes[min(result.blocks - 1, int(result.blocks * 0.99))];
+		result.maxBlockTime = blockTimes.back();
+	}
+	if(result.noteOns > 0)
+		result.meanNoteOnLatency = latencySum / result.noteOns;
+	result.passed = result.xruns == 0 && result.p99BlockTime <= budget * period * 1e6;
+	return result;
+}
+
+bool StressTest::runSweep(float secondsPerConfig){
+	const int polyphonies[] = { 1, 4, NUM_VOICES };
+	const int densities[] = { 5, 15, 30 };
+	const int lengths[] = { 50, 200, 500 };
+	const int scatters[] = { 0, 50 };
+	const int overtones[] = { 10, 20, 40 };
+
+	double period = blockSize / sampleRate * 1e6;
+	printf("Stress sweep: %d frames per block at %.0f Hz, period %.0f us, budget %.0f us (%.0f%%), FFT %d / hop %d, %d worker threads\n",
+		blockSize, sampleRate, period, budget * period, budget * 100.0f, quality.fftSize, quality.hopSize, pool.getNumWorkers());
+	printf("%5s %8s %7s %7s %9s | %9s %9s %9s %6s | %11s %11s | %s\n", "voices", "grains/s", "length", "scatter", "overtones",
+		"mean us", "p99 us", "max us", "xruns", "noteOn ms", "max ms", "result");
+
+	int passed = 0;
+	int total = 0;
+	for (int polyphony : polyphonies){
+		for (int density : densities){
+			for (int length : lengths){
+				for (int scatter : scatters){
+					for (int numOvertones : overtones){
+						StressConfig config = { polyphony, density, length, scatter, numOvertones };
+						StressResult result = run(config, secondsPerConfig);
+						printf("%5d %8d %7d %7d %9d | %9.1f %9.1f %9.1f %6d | %11.2f %11.2f | %s\n", polyphony, density, length, scatter, numOvertones,
+							result.meanBlockTime, result.p99BlockTime, result.maxBlockTime, result.xruns,
+							result.meanNoteOnLatency, result.maxNoteOnLatency, result.passed ? "pass" : "FAIL");
+						fflush(stdout);
+						if(result.passed)
+							passed++;
+						total++;
+					}
+				}
+			}
+		}
+	}
+	releaseAll();
+	printf("%d of %d configurations within budget: %s\n", passed, total, passed == total ? "PASS" : "FAIL");
+	return passed == total;
+}
+
+bool StressTest::runSoak(float seconds){
+	// The heaviest configuration the UI allows with all voices
+	StressConfig config = { NUM_VOICES, 30, 500, 50, 20 };
+	int intervals = max(2, int(ceil(seconds / SOAK_INTERVAL_SECONDS)));
+
+	printf("Soak run: %d voices, %d grains/s, %d ms grains, scatter %d, %d overtones for %d x %.0f s\n",
+		config.polyphony, config.grainsPerSecond, config.grainLengthMs, config.scatter, config.overtones, intervals, SOAK_INTERVAL_SECONDS);
+	printf("%8s | %9s %9s %9s %6s | %11s %11s | %10s\n", "time s", "mean us", "p99 us", "max us", "xruns", "noteOn ms", "max ms", "memory kB");
+
+	bool passed = true;
+	StressResult first, last;
+	long firstMemory = 0;
+	for (int i = 0; i < intervals; i++){
+		StressResult result = run(config, SOAK_INTERVAL_SECONDS);
+		long memory = residentMemory();
+		printf("%8.0f | %9.1f %9.1f %9.1f %6d | %11.2f %11.2f | %10ld\n", (i + 1) * SOAK_INTERVAL_SECONDS,
+			result.meanBlockTime, result.p99BlockTime, result.maxBlockTime, result.xruns,
+			result.meanNoteOnLatency, result.maxNoteOnLatency, memory / 1024);
+		fflush(stdout);
+		passed = passed && result.passed;
+		// The first interval is the warm-up (allocations of the first notes)
+		if(i == 0){
+			first = result;
+			firstMemory = memory;
+		}
+		last = result;
+	}
+	releaseAll();
+
+	double blockDrift = (last.meanBlockTime - first.meanBlockTime) / first.meanBlockTime;
+	double latencyDrift = first.meanNoteOnLatency > 0.0 ? (last.meanNoteOnLatency - first.meanNoteOnLatency) / first.meanNoteOnLatency : 0.0;
+	long memoryGrowth = residentMemory() - firstMemory;
+	printf("Block time drift %+.1f%%, noteOn latency drift %+.1f%%, memory growth %ld kB\n",
+		100.0 * blockDrift, 100.0 * latencyDrift, memoryGrowth / 1024);
+
+	passed = passed && blockDrift <= SOAK_MAX_DRIFT && latencyDrift <= SOAK_MAX_DRIFT && memoryGrowth <= SOAK_MAX_MEMORY_GROWTH;
+	printf("Soak run: %s\n", passed ? "PASS" : "FAIL");
+	return passed;
+}
+
+StressTest::BenchmarkVariant StressTest::defaultVariant(const std::string& name){
+	BenchmarkVariant variant;
+	variant.name = name;
+	variant.quality = quality;
+	variant.parameters.grainLength = int(0.2f * sampleRate);
+	variant.parameters.grainFrequency = int(sampleRate / 15);
+	variant.parameters.scatter = 50;
+	return variant;
+}
+
+StressTest::BenchmarkResult StressTest::measure(const BenchmarkVariant& variant, float seconds, int numIntervals){
+	// The engine of the variant on the noise, with every level of its pyramid analysed before the chord
+	GrainSourceCache variantCache(variant.quality, sampleRate, gMultiResolution, pool);
+	vector<unique_ptr<Engine>> variantEngines;
+	variantEngines.push_back(unique_ptr<Engine>(new Engine(sampleRate, variant.quality, variant.numOutputChannels,
+		{ -1, 0, 127 }, variant.parameters, &noiseData, nullptr)));
+	Engine& engine = *variantEngines[0];
+	engine.updateWindow();
+	Engine::updateGrainSources(variantEngines, variantCache);
+	for (int level = 0; level < engine.getPyramid()->getNumLevels(); level++){
+		engine.getPyramid()->request(level);
+	}
+	Engine::updateGrainSources(variantEngines, variantCache);
+
+	int numBlocks = int(seconds * sampleRate / blockSize);
+	int blocksPerInterval = max(1, numBlocks / numIntervals);
+	int cacheMisses = openCacheMissCounter();
+	BenchmarkResult result;
+	result.output.reserve(numBlocks * blockSize);
+
+	// Note to sound: the chord, the preparation the voice synthesis task runs before the first hop can be played
+	// and the frames until the first non-zero output
+	srand(1);
+	for (int i = 0; i < variant.chordSize; i++){
+		int note = 48 + i * 4;
+		engine.noteOn(note, powf(2, (note - 69) / 12.f) * 440);
+	}
+	long long preparationMisses = 0;
+	if(cacheMisses >= 0 && read(cacheMisses, &preparationMisses, sizeof(preparationMisses)) != sizeof(preparationMisses))
+		preparationMisses = 0;
+	auto start = chrono::steady_clock::now();
+	if(variant.sequential){
+		for (auto& voice : engine.getVoices()){
+			while(voice->synthesiseAhead(1));
+		}
+	} else {
+		Engine::synthesise(variantEngines, pool);
+	}
+	result.preparation = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	long long missesAfterPreparation = 0;
+	if(cacheMisses >= 0 && read(cacheMisses, &missesAfterPreparation, sizeof(missesAfterPreparation)) == sizeof(missesAfterPreparation))
+		result.preparationCacheMisses = double(missesAfterPreparation - preparationMisses);
+
+	int firstSample = -1;
+	long long misses = 0;
+	double audioTime = 0.0;
+	double synthesisTime = 0.0;
+	float frame[MAX_OUTPUT_CHANNELS];
+	for (int block = 0; block < numBlocks; block++){
+		// The remaining hops (voice synthesis task), then the block (audio thread)
+		auto synthesisStart = chrono::steady_clock::now();
+		if(block > 0)
+			Engine::synthesise(variantEngines, pool);
+		auto blockStart = chrono::steady_clock::now();
+		synthesisTime += chrono::duration<double, micro>(blockStart - synthesisStart).count();
+
+		long long missesBefore = 0;
+		if(cacheMisses >= 0 && read(cacheMisses, &missesBefore, sizeof(missesBefore)) != sizeof(missesBefore))
+			missesBefore = 0;
+		blockStart = chrono::steady_clock::now();
+		for (int n = 0; n < blockSize; n++){
+			fill(frame, frame + MAX_OUTPUT_CHANNELS, 0.0f);
+			engine.process(frame);
+			result.output.push_back(frame[0]);
+		}
+		audioTime += chrono::duration<double, micro>(chrono::steady_clock::now() - blockStart).count();
+		long long missesAfter = 0;
+		if(cacheMisses >= 0 && read(cacheMisses, &missesAfter, sizeof(missesAfter)) == sizeof(missesAfter))
+			misses += missesAfter - missesBefore;
+
+		if((block + 1) % blocksPerInterval == 0){
+			result.intervalAudioTimes.push_back(audioTime / blocksPerInterval);
+			result.intervalSynthesisTimes.push_back(synthesisTime / blocksPerInterval);
+			result.audioTime += audioTime;
+			result.synthesisTime += synthesisTime;
+			audioTime = 0.0;
+			synthesisTime = 0.0;
+		}
+	}
+	result.audioTime = (result.audioTime + audioTime) / numBlocks;
+	result.synthesisTime = (result.synthesisTime + synthesisTime) / numBlocks;
+	for (unsigned int n = 0; n < result.output.size() && firstSample < 0; n++){
+		if(result.output[n] != 0.0f)
+			firstSample = n;
+	}
+	result.noteToSound = result.preparation + (firstSample < 0 ? 0.0 : 1000.0 * firstSample / sampleRate);
+	result.voiceMemory = engine.getVoices()[0]->getMemoryUsage();
+	if(cacheMisses >= 0){
+		result.cacheMisses = double(misses) / numBlocks;
+		close(cacheMisses);
+	}
+	return result;
+}
+
+void StressTest::compare(const vector<BenchmarkVariant>& variants, bool compareOutputs){
+	printf("%14s | %14s %18s %8s | %14s %16s | %10s %18s %18s | %8s\n", "variant", "audio us/block", "synthesis us/block", "vs first",
+		"preparation ms", "note-to-sound ms", "voice kB", "cache misses/block", "preparation misses", "SNR dB");
+	BenchmarkResult first;
+	for (unsigned int i = 0; i < variants.size(); i++){
+		BenchmarkResult result = measure(variants[i], BENCHMARK_SECONDS);
+		if(i == 0)
+			first = result;
+
+		char missesText[32] = "n/a";
+		if(result.cacheMisses >= 0.0)
+			snprintf(missesText, sizeof(missesText), "%.1f", result.cacheMisses);
+		char preparationMissesText[32] = "n/a";
+		if(result.preparationCacheMisses >= 0.0)
+			snprintf(preparationMissesText, sizeof(preparationMissesText), "%.0f", result.preparationCacheMisses);
+		char snrText[32] = "-";
+		if(compareOutputs && i > 0){
+			double signal = 0.0;
+			double noise = 0.0;
+			for (unsigned int n = 0; n < result.output.size() && n < first.output.size(); n++){
+				signal += double(first.output[n]) * first.output[n];
+				noise += double(result.output[n] - first.output[n]) * (result.output[n] - first.output[n]);
+			}
+			snprintf(snrText, sizeof(snrText), "%.1f", noise > 0.0 ? 10.0 * log10(signal / noise) : INFINITY);
+		}
+		printf("%14s | %14.2f %18.2f %7.2fx | %14.3f %16.3f | %10.1f %18s %18s | %8s\n", variants[i].name.c_str(),
+			result.audioTime, result.synthesisTime, first.audioTime > 0.0 ? result.audioTime / first.audioTime : 0.0,
+			result.preparation, result.noteToSound, result.voiceMemory / 1024.0, missesText, preparationMissesText, snrText);
+		fflush(stdout);
+	}
+	printf("%d voices, %d frames per block, FFT %d / hop %d; vs first: audio thread time against the first variant\n",
+		NUM_VOICES, blockSize, quality.fftSize, quality.hopSize);
+}
+
+bool StressTest::runBenchmark(Benchmark benchmark){
+	vector<BenchmarkVariant> variants;
+	switch(benchmark){
+		case BENCHMARK_VOICE_MODES:
+			printf("Voice modes: 200 ms grains, 15 grains/s, scatter 50\n");
+			for (int mode = 0; mode < NUM_VOICE_MODES; mode++){
+				variants.push_back(defaultVariant(VOICE_MODE_NAMES[mode]));
+				variants.back().parameters.voiceMode = VoiceMode(mode);
+			}
+			compare(variants, false);
+			return true;
+		case BENCHMARK_STORAGE:
+			printf("Storage formats of the voice buffers and spectra: 200 ms grains, 15 grains/s, scatter 50\n");
+			for (int format = 0; format < NUM_SAMPLE_FORMATS; format++){
+				variants.push_back(defaultVariant(SAMPLE_FORMAT_NAMES[format]));
+				variants.back().quality.storage = SampleFormat(format);
+			}
+			compare(variants, true);
+			return true;
+		case BENCHMARK_CHANNELS:
+			printf("Output channels: 200 ms grains, 15 grains/s, scatter 50, spread 100\n");
+			for (int numChannels : { 1, 2, 4, MAX_OUTPUT_CHANNELS }){
+				variants.push_back(defaultVariant(to_string(numChannels)));
+				variants.back().numOutputChannels = numChannels;
+				variants.back().parameters.spread = 100;
+			}
+			compare(variants, false);
+			return true;
+		case BENCHMARK_INTERPOLATION:
+			printf("Interpolation kernels: 200 ms grains, 15 grains/s, scatter 50, a fifth up with 10 cents jitter against rate 1\n");
+			variants.push_back(defaultVariant("rate 1"));
+			for (int kernel = 0; kernel < NUM_INTERPOLATION_KERNELS; kernel++){
+				variants.push_back(defaultVariant(INTERPOLATION_KERNEL_NAMES[kernel]));
+				variants.back().parameters.playbackRate = powf(2.0f, 7.0f / 12.0f);
+				variants.back().parameters.rateJitter = 10.0f;
+				variants.back().parameters.interpolation = InterpolationKernel(kernel);
+			}
+			compare(variants, false);
+			return true;
+		case BENCHMARK_SCANNING: {
+			// The song (the noise) is shorter than the notes, so the scan loops over it
+			printf("Scanning: rate 1 through %.0f s of noise for %.0f s, 200 ms grains, 15 grains/s, scatter 50\n",
+				STRESS_NOISE_SECONDS, SCAN_BENCHMARK_SECONDS);
+			BenchmarkVariant variant = defaultVariant("scanning");
+			variant.parameters.scanRate = 1.0f;
+			int numIntervals = int(SCAN_BENCHMARK_SECONDS / SCAN_BENCHMARK_INTERVAL_SECONDS);
+			BenchmarkResult result = measure(variant, SCAN_BENCHMARK_SECONDS, numIntervals);
+			printf("%8s | %14s %18s\n", "held s", "audio us/block", "synthesis us/block");
+			for (unsigned int i = 0; i < result.intervalAudioTimes.size(); i++){
+				printf("%8.0f | %14.2f %18.2f\n", (i + 1) * SCAN_BENCHMARK_INTERVAL_SECONDS, result.intervalAudioTimes[i],
+					result.intervalSynthesisTimes[i]);
+			}
+			double firstAudio = result.intervalAudioTimes.front();
+			double firstSynthesis = result.intervalSynthesisTimes.front();
+			double audioDrift = firstAudio > 0.0 ? result.intervalAudioTimes.back() / firstAudio - 1.0 : 0.0;
+			double synthesisDrift = firstSynthesis > 0.0 ? result.intervalSynthesisTimes.back() / firstSynthesis - 1.0 : 0.0;
+			bool flat = fabs(audioDrift) <= SOAK_MAX_DRIFT && fabs(synthesisDrift) <= SOAK_MAX_DRIFT;
+			printf("Drift from the first to the last interval: audio %+.1f%%, synthesis %+.1f%% -> %s\n", 100.0 * audioDrift,
+				100.0 * synthesisDrift, flat ? "flat" : "DRIFT");
+			return flat;
+		}
+		case BENCHMARK_SCALING: {
+			int numCores = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+			printf("Source position changes: %d voices playing, FFT %d / hop %d, %d hops, %s, %d cores\n", NUM_VOICES,
+				quality.fftSize, quality.hopSize, quality.sourceHops, gMultiResolution ? "one resolution per register" : "single resolution", numCores);
+			printf("%8s | %12s %15s %10s | %8s\n", "threads", "analysis ms", "resynthesis ms", "total ms", "speedup");
+			double singleThread = 0.0;
+			for (int numThreads = 1; numThreads <= numCores; numThreads++){
+				double analysisTime = 0.0;
+				double synthesisTime = 0.0;
+				measureSourceChange(numThreads - 1, &analysisTime, &synthesisTime);
+				double total = analysisTime + synthesisTime;
+				if(numThreads == 1)
+					singleThread = total;
+				printf("%8d | %12.2f %15.2f %10.2f | %7.2fx\n", numThreads, analysisTime, synthesisTime, total, singleThread / total);
+				fflush(stdout);
+			}
+			printf("Mean of %d changes; threads: the task calling the pool and its helpers (--worker-threads)\n", SCALING_SOURCE_CHANGES);
+			return true;
+		}
+		case BENCHMARK_CHORDS:
+			// Preparation: the hops the first grains need, synthesised right after the chord
+			printf("Chord preparation: %s, one voice after the other against one batch (%d voices per inverse FFT)\n",
+				gSnapOvertones ? "snapped overtones" : "nominal overtones", LANE_FFT_LANES);
+			for (int chordSize : { 4, 6, 8 }){
+				variants.clear();
+				variants.push_back(defaultVariant(to_string(chordSize) + " sequential"));
+				variants.back().chordSize = chordSize;
+				variants.back().sequential = true;
+				variants.push_back(defaultVariant(to_string(chordSize) + " batched"));
+				variants.back().chordSize = chordSize;
+				compare(variants, true);
+			}
+			return true;
+		case BENCHMARK_BIN_MAJOR:
+			// The overtone lines are extracted in the preparation (and again on every source position change)
+			printf("Overtone extraction: 200 ms grains, 15 grains/s, scatter 50, lines read from the bin-major view "
+				"against gathered from the hop-major frames\n");
+			variants.push_back(defaultVariant("bin-major"));
+			variants.push_back(defaultVariant("hop-major"));
+			variants.back().quality.binMajor = false;
+			compare(variants, true);
+			return true;
+		default:
+			return false;
+	}
+}
+
+void StressTest::measureSourceChange(int numWorkerThreads, double* analysisTime, double* synthesisTime){
+	// An engine of its own with a chord playing, like in measure()
+	WorkerPool threadPool(numWorkerThreads);
+	GrainSourceCache cache(quality, sampleRate, gMultiResolution, threadPool);
+	vector<unique_ptr<Engine>> changeEngines;
+	BenchmarkVariant variant = defaultVariant("scaling");
+	changeEngines.push_back(unique_ptr<Engine>(new Engine(sampleRate, quality, 1, { -1, 0, 127 },
+		variant.parameters, &noiseData, nullptr)));
+	Engine& engine = *changeEngines[0];
+	engine.updateWindow();
+	Engine::updateGrainSources(changeEngines, cache);
+	for (int i = 0; i < NUM_VOICES; i++){
+		int note = 48 + i * 4;
+		engine.noteOn(note, powf(2, (note - 69) / 12.f) * 440);
+	}
+	engine.requestLevels();
+	Engine::updateGrainSources(changeEngines, cache);
+	Engine::synthesise(changeEngines, threadPool);
+
+	// Every change moves to a slice no pyramid holds, so the levels in use are analysed again
+	int maxPosition = noiseData.sampleLen - (quality.sourceSamples() + quality.fftSize);
+	*analysisTime = 0.0;
+	*synthesisTime = 0.0;
+	for (int change = 0; change < SCALING_SOURCE_CHANGES; change++){
+		engine.getParameters().sourcePosition = ((change + 1) * 7 * quality.hopSize) % max(1, maxPosition);
+		engine.applyParameters();
+		auto start = chrono::steady_clock::now();
+		Engine::updateGrainSources(changeEngines, cache);
+		auto analysed = chrono::steady_clock::now();
+		Engine::synthesise(changeEngines, threadPool);
+		*analysisTime += chrono::duration<double, milli>(analysed - start).count();
+		*synthesisTime += chrono::duration<double, milli>(chrono::steady_clock::now() - analysed).count();
+	}
+	*analysisTime /= SCALING_SOURCE_CHANGES;
+	*synthesisTime /= SCALING_SOURCE_CHANGES;
+}
+
+int StressTest::openCacheMissCounter(){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long StressTest::residentMemory(){
+	long pages = 0;
+	long resident = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if(file == nullptr)
+		return 0;
+	if(fscanf(file, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(file);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+StressTest::~StressTest(){
+	{
+		lock_guard<mutex> lock(workerMutex);
+		stopWorkers = true;
+	}
+	workerCondition.notify_all();
+	synthesisThread.join();
+	sourceThread.join();
+}
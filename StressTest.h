@@ -0,0 +1,191 @@
+/*****
+ * StressTest.h
+ * Synthetic load generator for finding the polyphony / grain density ceiling of the engine
+ *
+ * Runs an Engine outside of Bela with the same thread layout as render.cpp: a paced "audio" loop
+ * that applies the parameters, plays the notes and calls Engine::process() block by block, a voice synthesis
+ * worker running Engine::synthesise() and a grain source worker running Engine::updateGrainSources(),
+ * the same functions the auxiliary tasks run. The engine plays from noise, and every configuration is driven
+ * with chords, rapid retriggers and source position changes while the render time of every block,
+ * xruns (blocks that took longer than their period) and the noteOn latency (until the first hop of the voice
+ * can be played) are recorded.
+ * The sweep prints a capacity table with a pass/fail verdict against the block budget,
+ * the soak run repeats one heavy configuration and looks for latency drift and memory growth.
+ * The benchmarks compare variants of the engine (voice modes, storage formats, output channels,
+ * interpolation kernels) playing the same chord, each on an Engine of its own with the synthesis running
+ * between the blocks on the calling thread, and print the audio thread and synthesis time per block,
+ * preparation and note-to-sound latency, memory and cache misses of every variant; the scanning benchmark
+ * holds its chord for a minute and prints the same times for every interval, and the scaling benchmark times
+ * source position changes (analysis and resynthesis of the playing voices) with 1 to one thread per core;
+ * the chords benchmark prepares chords of 4, 6 and 8 notes voice after voice and batched (lane-interleaved FFTs),
+ * the bin-major benchmark extracts the overtone lines with and without the bin-major view of the grain sources
+*****/
+#ifndef STRESS_TEST_H
+#define STRESS_TEST_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "Engine.h"
+
+// Length of one soak interval (one line of the soak report) in seconds
+const float SOAK_INTERVAL_SECONDS = 10.0f;
+// Relative change of the mean block time or noteOn latency between the first and the last soak interval that counts as drift
+const float SOAK_MAX_DRIFT = 0.2f;
+// Growth of the resident memory during a soak run that counts as a leak (bytes)
+const long SOAK_MAX_MEMORY_GROWTH = 1024 * 1024;
+// Length of the noise the engine plays from in seconds (the source position changes move through it)
+const float STRESS_NOISE_SECONDS = 30.0f;
+// Length of the chord played by the benchmarks in seconds
+const float BENCHMARK_SECONDS = 2.0f;
+// Length of the scanning chord and of one line of its report in seconds
+const float SCAN_BENCHMARK_SECONDS = 60.0f;
+const float SCAN_BENCHMARK_INTERVAL_SECONDS = 10.0f;
+
+// Benchmarks run by StressTest::runBenchmark() (--benchmark name)
+enum Benchmark {
+	BENCHMARK_VOICE_MODES = 0,
+	BENCHMARK_STORAGE,
+	BENCHMARK_CHANNELS,
+	BENCHMARK_INTERPOLATION,
+	BENCHMARK_SCANNING,
+	BENCHMARK_SCALING,
+	BENCHMARK_CHORDS,
+	BENCHMARK_BIN_MAJOR,
+	NUM_BENCHMARKS
+};
+const char* const BENCHMARK_NAMES[NUM_BENCHMARKS] = { "voice-modes", "storage", "channels", "interpolation", "scanning", "scaling", "chords",
+	"bin-major" };
+// Source position changes timed per worker count by the scaling benchmark
+const int SCALING_SOURCE_CHANGES = 10;
+
+struct StressConfig {
+	int polyphony;
+	int grainsPerSecond;
+	int grainLengthMs;
+	int scatter;
+	int overtones;
+};
+
+struct StressResult {
+	int blocks = 0;
+	// Render time of one block in microseconds
+	double meanBlockTime = 0.0;
+	double p99BlockTime = 0.0;
+	double maxBlockTime = 0.0;
+	// Blocks that took longer than one period
+	int xruns = 0;
+	// Time from noteOn until the first hop of the voice was synthesised, in milliseconds
+	int noteOns = 0;
+	double meanNoteOnLatency = 0.0;
+	double maxNoteOnLatency = 0.0;
+	// Whether the 99th percentile block time is within the budget and there were no xruns
+	bool passed = false;
+};
+
+class StressTest {
+	public:
+		// budget is the fraction of the block period the render time may use
+		// The engine is built with the given quality tier, numWorkerThreads helpers share the FFTs (see WorkerPool)
+		StressTest(int blockSize, float sampleRate, float budget, const QualityTier& quality, int numWorkerThreads);
+		~StressTest();
+
+		// Run every configuration of the sweep for secondsPerConfig and print the capacity table
+		// Returns true if all configurations passed
+		bool runSweep(float secondsPerConfig);
+
+		// Run the heaviest configuration for the given time, reporting every SOAK_INTERVAL_SECONDS
+		// Returns true if there were no failures, no drift and no memory growth
+		bool runSoak(float seconds);
+
+		// Run a benchmark and print its table
+		// Returns false if it found a regression (the scanning notes getting slower over time)
+		bool runBenchmark(Benchmark benchmark);
+
+	private:
+		int blockSize;
+		float sampleRate;
+		float budget;
+		QualityTier quality;
+
+		// The engine, playing from noise, and the pyramids of its slices
+		WorkerPool pool;
+		std::vector<float> noise;
+		SampleData noiseData;
+		std::unique_ptr<GrainSourceCache> grainSourceCache;
+		std::vector<std::unique_ptr<Engine>> engines;
+
+		// Voice synthesis worker (processVoiceSynthesisBackground() in render.cpp)
+		std::thread synthesisThread;
+		std::atomic<bool> synthesisScheduled;
+		void synthesisWorker();
+
+		// Grain source worker (processGrainSrcBufferUpdate() in render.cpp)
+		std::thread sourceThread;
+		std::atomic<bool> sourceScheduled;
+		void sourceWorker();
+
+		// Wakes the workers
+		std::mutex workerMutex;
+		std::condition_variable workerCondition;
+		bool stopWorkers = false;
+
+		// One engine of a benchmark
+		struct BenchmarkVariant {
+			std::string name;
+			QualityTier quality;
+			int numOutputChannels = 1;
+			EngineParameters parameters;
+			// Number of notes of the chord
+			int chordSize = NUM_VOICES;
+			// Prepare the chord one voice after the other with its own FFTs (the notes played one by one)
+			// instead of in one batch (Engine::synthesise())
+			bool sequential = false;
+		};
+		struct BenchmarkResult {
+			// Audio thread (Engine::process()) and synthesis (Engine::synthesise()) time per block in microseconds
+			double audioTime = 0.0;
+			double synthesisTime = 0.0;
+			// First synthesis after the chord and the time until the first output sample that is not zero, in milliseconds
+			double preparation = 0.0;
+			double noteToSound = 0.0;
+			// Bytes of one voice
+			int voiceMemory = 0;
+			// Cache misses of the audio thread per block and of the preparation (negative if the kernel provides no counter)
+			double cacheMisses = -1.0;
+			double preparationCacheMisses = -1.0;
+			// First output channel
+			std::vector<float> output;
+			// Audio thread and synthesis time per block of every interval
+			std::vector<double> intervalAudioTimes;
+			std::vector<double> intervalSynthesisTimes;
+		};
+		// Variant with the defaults of the benchmarks: the quality of the test, 200 ms grains, 15 grains/s, scatter 50
+		BenchmarkVariant defaultVariant(const std::string& name);
+		// Play a chord of variant.chordSize notes on an engine built for variant for the given time, split into numIntervals
+		// (the levels of its pyramid are analysed before, the rand() sequence of the grains is the same for every variant)
+		BenchmarkResult measure(const BenchmarkVariant& variant, float seconds, int numIntervals = 1);
+		// Measure every variant and print one line each, times relative to the first variant and,
+		// if compareOutputs is set, the SNR of the output against the one of the first variant
+		void compare(const std::vector<BenchmarkVariant>& variants, bool compareOutputs);
+		// Mean time of a source position change with a chord playing on a pool of numWorkerThreads helpers, in milliseconds:
+		// the analysis of the new slice (Engine::updateGrainSources()) and the resynthesis of the voices (Engine::synthesise())
+		void measureSourceChange(int numWorkerThreads, double* analysisTime, double* synthesisTime);
+
+		// Run one configuration for the given time
+		StressResult run(const StressConfig& config, float seconds);
+		// Release all notes of the engine
+		void releaseAll();
+		// Wait until the workers are idle
+		void waitForWorkers();
+		// Resident memory of the process in bytes
+		static long residentMemory();
+		// Hardware cache miss counter of the calling thread (-1 if the kernel does not provide one)
+		static int openCacheMissCounter();
+};
+
+#endif
@@ -0,0 +1,113 @@
+/***** Trace.cpp *****/
+#include "Trace.h"
+
+#ifdef ENABLE_TRACE
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Maximum number of distinct threads that can be named in the trace
+const int MAX_TRACE_THREADS = 32;
+
+// A single begin or end event
+struct TraceEvent {
+	const char* name;
+	long long timestampNs;
+	int threadId;
+	char phase;
+};
+
+// Preallocated event storage, filled from any thread without locking
+static TraceEvent traceEvents[MAX_TRACE_EVENTS];
+static std::atomic<int> traceEventCount(0);
+static std::atomic<int> traceEventsDropped(0);
+
+// Names of the threads that recorded events (audio thread, MIDI parser, auxiliary tasks)
+struct TraceThread {
+	int threadId;
+	char name[32];
+};
+static TraceThread traceThreads[MAX_TRACE_THREADS];
+static std::atomic<int> traceThreadCount(0);
+
+// Per-thread id, looked up once
+static thread_local int traceThreadId = 0;
+
+// Timestamp of the first event so that the timeline starts at 0
+static std::atomic<long long> traceStartNs(0);
+
+static long long traceNow(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Register the calling thread together with its name the first time it records an event
+static int traceRegisterThread(){
+	int threadId = (int)syscall(SYS_gettid);
+	int slot = traceThreadCount.fetch_add(1);
+	if(slot < MAX_TRACE_THREADS){
+		traceThreads[slot].threadId = threadId;
+		if(pthread_getname_np(pthread_self(), traceThreads[slot].name, sizeof(traceThreads[slot].name)) != 0)
+			snprintf(traceThreads[slot].name, sizeof(traceThreads[slot].name), "thread-%d", threadId);
+	}
+	return threadId;
+}
+
+void traceEvent(const char* name, char phase){
+	long long now = traceNow();
+	long long expected = 0;
+	traceStartNs.compare_exchange_strong(expected, now);
+
+	if(traceThreadId == 0)
+		traceThreadId = traceRegisterThread();
+
+	int idx = traceEventCount.fetch_add(1, std::memory_order_relaxed);
+	if(idx >= MAX_TRACE_EVENTS){
+		traceEventsDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	traceEvents[idx].name = name;
+	traceEvents[idx].timestampNs = now;
+	traceEvents[idx].threadId = traceThreadId;
+	traceEvents[idx].phase = phase;
+}
+
+void traceWrite(const char* path){
+	FILE* file = fopen(path, "w");
+	if(file == nullptr){
+		printf("Could not open trace file %s\n", path);
+		return;
+	}
+
+	int numEvents = std::min(traceEventCount.load(), MAX_TRACE_EVENTS);
+	int numThreads = std::min(traceThreadCount.load(), MAX_TRACE_THREADS);
+	long long startNs = traceStartNs.load();
+	int pid = (int)getpid();
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	const char* separator = "\n";
+	// Thread names as metadata events so the timeline rows are labelled
+	for(int i = 0; i < numThreads; i++){
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			separator, pid, traceThreads[i].threadId, traceThreads[i].name);
+		separator = ",\n";
+	}
+	for(int i = 0; i < numEvents; i++){
+		const TraceEvent& event = traceEvents[i];
+		fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+			separator, event.name, event.phase, pid, event.threadId, (event.timestampNs - startNs) * 0.001);
+		separator = ",\n";
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	printf("Wrote %d trace events to %s (%d dropped)\n", numEvents, path, traceEventsDropped.load());
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*****
+ * Trace.h
+ * Optional timeline tracing of the audio thread, the MIDI callback and the auxiliary tasks
+ * Events are recorded into a preallocated buffer and written out as Chrome trace-event JSON
+ * (open the file in chrome://tracing or https://ui.perfetto.dev)
+ *
+ * Tracing is compiled out unless ENABLE_TRACE is defined, e.g. by building with
+ * make CPPFLAGS=-DENABLE_TRACE
+ * In that case all TRACE_* macros expand to nothing
+*****/
+#ifndef TRACE_H
+#define TRACE_H
+
+// Maximum number of events held in the trace buffer
+// 262144 events * 24 bytes = 6MB, which is roughly one minute of playing with 16 sample blocks
+// Events arriving once the buffer is full are dropped (and counted)
+const int MAX_TRACE_EVENTS = 262144;
+
+#ifdef ENABLE_TRACE
+
+// Record the beginning ('B') or end ('E') of an event with the given name
+// The name must be a string literal (only the pointer is stored)
+void traceEvent(const char* name, char phase);
+
+// Write all recorded events to the given file as Chrome trace-event JSON
+void traceWrite(const char* path);
+
+// Helper that records a begin event on construction and the matching end event on destruction
+class TraceScope {
+	public:
+		TraceScope(const char* name) : name(name) { traceEvent(name, 'B'); }
+		~TraceScope() { traceEvent(name, 'E'); }
+	private:
+		const char* name;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_BEGIN(name) traceEvent(name, 'B')
+#define TRACE_END(name) traceEvent(name, 'E')
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_WRITE(path) traceWrite(path)
+
+#else
+
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_SCOPE(name)
+#define TRACE_WRITE(path)
+
+#endif
+
+#endif
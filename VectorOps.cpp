@@ -0,0 +1,89 @@
+/***** VectorOps.cpp *****/
+#include "VectorOps.h"
+#include <cmath>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VECTOR_OPS_NEON
+#endif
+
+float downmixToMono(const float* interleaved, float* mono, int frames, int channels){
+	int n = 0;
+#ifdef VECTOR_OPS_NEON
+	float32x4_t peak4 = vdupq_n_f32(0.0f);
+	if(channels == 1){
+		for(; n + 4 <= frames; n += 4){
+			float32x4_t x = vld1q_f32(interleaved + n);
+			vst1q_f32(mono + n, x);
+			peak4 = vmaxq_f32(peak4, vabsq_f32(x));
+		}
+	} else if(channels == 2){
+		// De-interleave four stereo frames at a time
+		float32x4_t half = vdupq_n_f32(0.5f);
+		for(; n + 4 <= frames; n += 4){
+			float32x4x2_t x = vld2q_f32(interleaved + 2 * n);
+			float32x4_t sum = vmulq_f32(vaddq_f32(x.val[0], x.val[1]), half);
+			vst1q_f32(mono + n, sum);
+			peak4 = vmaxq_f32(peak4, vabsq_f32(sum));
+		}
+	}
+	float32x2_t peak2 = vpmax_f32(vget_low_f32(peak4), vget_high_f32(peak4));
+	float peak = vget_lane_f32(vpmax_f32(peak2, peak2), 0);
+#else
+	float peak = 0.0f;
+#endif
+	// Remaining frames (and any channel count without a dedicated kernel)
+	float gain = 1.0f / channels;
+	for(; n < frames; n++){
+		const float* frame = interleaved + n * channels;
+		float sum = 0.0f;
+		for(int channel = 0; channel < channels; channel++){
+			sum += frame[channel];
+		}
+		sum *= gain;
+		mono[n] = sum;
+		peak = fmaxf(peak, fabsf(sum));
+	}
+	return peak;
+}
+
+void scaleInPlace(float* data, int length, float gain){
+	int n = 0;
+#ifdef VECTOR_OPS_NEON
+	float32x4_t gain4 = vdupq_n_f32(gain);
+	for(; n + 4 <= length; n += 4){
+		vst1q_f32(data + n, vmulq_f32(vld1q_f32(data + n), gain4));
+	}
+#endif
+	for(; n < length; n++){
+		data[n] *= gain;
+	}
+}
+
+float dotProduct(const float* a, const float* b, int length){
+	int n = 0;
+#ifdef VECTOR_OPS_NEON
+	// Two accumulators hide the latency of the multiply-accumulate
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	for(; n + 8 <= length; n += 8){
+		sum0 = vmlaq_f32(sum0, vld1q_f32(a + n), vld1q_f32(b + n));
+		sum1 = vmlaq_f32(sum1, vld1q_f32(a + n + 4), vld1q_f32(b + n + 4));
+	}
+	float32x4_t sum4 = vaddq_f32(sum0, sum1);
+	float32x2_t sum2 = vadd_f32(vget_low_f32(sum4), vget_high_f32(sum4));
+	float sum = vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+#else
+	// Independent partial sums, a single accumulator can't be vectorised without reassociating
+	float partial[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for(; n + 4 <= length; n += 4){
+		for(int k = 0; k < 4; k++){
+			partial[k] += a[n + k] * b[n + k];
+		}
+	}
+	float sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+	for(; n < length; n++){
+		sum += a[n] * b[n];
+	}
+	return sum;
+}
@@ -0,0 +1,20 @@
+/*****
+ * VectorOps.h
+ * Small vectorised kernels for bulk sample processing outside of the grain engine
+ * (decoding, normalisation, downmixing, resampling)
+ * Uses NEON intrinsics when available and plain loops the compiler can vectorise otherwise
+*****/
+#ifndef VECTOR_OPS_H
+#define VECTOR_OPS_H
+
+// Average the channels of interleaved frames into one mono channel
+// Returns the peak absolute value of the mono result (fused into the same pass)
+float downmixToMono(const float* interleaved, float* mono, int frames, int channels);
+
+// Multiply length samples by gain in place
+void scaleInPlace(float* data, int length, float gain);
+
+// Sum of a[i] * b[i] for i < length
+float dotProduct(const float* a, const float* b, int length);
+
+#endif
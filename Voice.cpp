@@ -1,18 +1,81 @@
 /***** Voice.cpp *****/
 #include "Voice.h"
+#include "Trace.h"
 
-Voice::Voice(float sampleRate, Window& window) 
-	: window (window) {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VOICE_NEON
+#endif
+
+// Resolution of the pseudorandom grain positions on the output bus and of the grain rate jitter
+const int PAN_RANDOM_STEPS = 1000;
+
+// An overtone moves onto a spectral peak within a quarter tone of its nominal frequency
+// (and within a quarter of the fundamental, so neighbouring overtones never take the same peak)
+const float OVERTONE_SNAP_RANGE = 0.0293f;
+
+// Kernels of the grains playing at fractional rates (shared by all voices)
+static const Interpolator interpolator;
+
+// Add sample * gains to the first numChannels channels of bus
+// (rounded up to a multiple of 4, the gains of the unused channels are zero)
+static inline void panSample(float* bus, const float* gains, float sample, int numChannels){
+#ifdef VOICE_NEON
+	for (int channel = 0; channel < numChannels; channel += 4){
+		vst1q_f32(bus + channel, vmlaq_n_f32(vld1q_f32(bus + channel), vld1q_f32(gains + channel), sample));
+	}
+#else
+	for (int channel = 0; channel < numChannels; channel++){
+		bus[channel] += gains[channel] * sample;
+	}
+#endif
+}
+
+Voice::Voice(float sampleRate, Window& window, const QualityTier& quality, VoiceMode mode) 
+	: mode (mode), storage (quality.storage), quality (quality), voiceQuality (quality), cfg (nullptr), readySamples (0), preparationPending (false), requiredSamples (0), bufferGeneration (0),
+	  sourceData (nullptr), sourceStart (0), sourceAnalysis (nullptr), oldestNeeded (0), window (window) {
 	
 	this->sampleRate = sampleRate;
-	cfg = ne10_fft_alloc_c2c_float32_neon (N_FFT);
-	
-	// Initialise frequency representation grain buffer
-	// This will be used to mask the current buffer coming from the main loop
-	currentMask = (ne10_fft_cpx_float32_t*) NE10_MALLOC (N_FFT * sizeof(ne10_fft_cpx_float32_t));
+	bufferLength = quality.sourceSamples();
 	
-	// Initialise time representation grain buffer
-	timeDomainGrainBuffer = (ne10_fft_cpx_float32_t*) NE10_MALLOC (N_FFT * sizeof(ne10_fft_cpx_float32_t));
+	if(mode == VOICE_MODE_RESONATOR){
+		// Only the filter state, the grains envelope the filtered source directly
+		resonators.reset(new ResonatorBank(nOvertones));
+		currentMask = nullptr;
+		timeDomainGrainBuffer = nullptr;
+	} else {
+		windowedGrain.resize(MAX_GRAIN_LENGTH);
+		cfg = ne10_fft_alloc_c2c_float32_neon (quality.fftSize);
+		cfgSize = quality.fftSize;
+		
+		// The mask and IFFT buffers fit every level of a grain pyramid
+		int maxFftSize = std::max(quality.fftSize, QUALITY_TIERS[NUM_QUALITY_TIERS - 1].fftSize);
+		
+		if(storage == SAMPLE_FORMAT_FLOAT32){
+			buffer.resize(bufferLength);
+		} else {
+			compactBuffer.allocate(bufferLength, storage);
+		}
+		overlap.assign(maxFftSize, 0.0f);
+		
+		// Initialise frequency representation grain buffer
+		// This will be used to mask the current buffer coming from the main loop
+		currentMask = (ne10_fft_cpx_float32_t*) NE10_MALLOC (maxFftSize * sizeof(ne10_fft_cpx_float32_t));
+		
+		for (int k = 0; k < maxFftSize; k++){
+			currentMask[k].r = 0.0f;
+			currentMask[k].i = 0.0f;
+		}
+		
+		// Room for the overtone bins and their values
+		overtoneBins.reserve(nOvertones);
+		overtoneLines.resize(nOvertones * quality.sourceHops);
+		overtoneHopBins.resize(nOvertones * quality.sourceHops);
+		maskedBins.reserve(nOvertones);
+		
+		// Initialise time representation grain buffer
+		timeDomainGrainBuffer = (ne10_fft_cpx_float32_t*) NE10_MALLOC (maxFftSize * sizeof(ne10_fft_cpx_float32_t));
+	}
 	
 	// Initialise grain buffers
 	// Vectors are used to allow for dynamic adjustment of the number of grains that
@@ -21,7 +84,7 @@ Voice::Voice(float sampleRate, Window& window)
 	grainPositions = {};
 	for (int i = 0; i < numberOfGrains; i++){
 		// Create grain
-		Grain* grain = new Grain(MAX_GRAIN_SAMPLES);
+		Grain* grain = new Grain(bufferLength);
 		grains.push_back(*grain);
 		
 		// Initialise grain buffer position as well
@@ -32,29 +95,32 @@ Voice::Voice(float sampleRate, Window& window)
 	srand (time(NULL));
 }
 
-void Voice::noteOn(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grainSrcBuffer, float frequency, int grainLength){
-	this->frequency = frequency;
-	this->bufferPosition = 0;
+bool Voice::noteOn(GrainSource& grainSrcBuffer, float frequency, int grainLength){
+	std::unique_lock<std::mutex> lock(synthesisMutex, std::try_to_lock);
+	if(!lock.owns_lock())
+		return false;
 	
-	// Clear main buffer
-	for (int i = 0; i < MAX_GRAIN_SAMPLES; i++){
-		buffer[i] = 0.0f;
-	}
-	
-	// Clear overtone bins
-	overtones.clear();
-	for (int i = 0; i < nOvertones; i++){
-		// Extract frequencies from grain source buffer
-		// With the current FFT settings the frequency resolution is ~10Hz / bin
-		auto current = int(round(map(frequency * (i + 1), 0.0f, float(sampleRate) / 2.0f, 0.0f, float(N_FFT / 2 + 1))));
-		if(current >= N_FFT)
-			break;
-		overtones.insert(current);
+	// Nothing synthesised yet for this note, grains read silence until the first hops are in
+	resetSynthesis();
+	this->frequency = frequency;
+	noteFrequency = frequency;
+	if(mode == VOICE_MODE_RESONATOR){
+		// The resonators ring up from silence, nothing to prepare
+		resonators->tuneHarmonics(frequency, nOvertones, frequency / RESONATOR_Q, 0.5f * sampleRate * RESONATOR_MAX_FREQUENCY, sampleRate);
+		resonators->reset();
+		sourceReadPosition = 0;
+	} else {
+		// A scanning note reads the song itself, at the FFT size of the voice
+		scanning = scanRate > 0.0f && sourceData.load(std::memory_order_acquire) != nullptr;
+		quality = scanning ? voiceQuality : grainSrcBuffer.getQuality();
+		if(scanning){
+			scanFirstFrame = (sourceStart.load(std::memory_order_relaxed) + quality.hopSize / 2) / quality.hopSize;
+			scanPosition = 0.0;
+			oldestNeeded.store(0, std::memory_order_relaxed);
+		}
+		updateOvertoneBins();
 	}
 
-	// Update grain source buffer
-	updateGrainSrcBuffer(grainSrcBuffer);
-	
 	// Default starting position is buffer start
 	int grainStartPosition = 0;
 	
@@ -64,12 +130,12 @@ void Voice::noteOn(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grai
 		}
 		// If scatter > 0 pseudorandomly spread out the grain start positions
 		else {
-			int random = getRandomInRange(MAX_GRAIN_SAMPLES);
+			int random = getRandomInRange(bufferLength);
 			grainStartPosition = int(0.01 * scatter * random);
 		}
 		// Check if length would go past buffer limit and wrap around if necessary (start from the beginning)
-		if(grainStartPosition + grainLength >= MAX_GRAIN_SAMPLES){
-			grainStartPosition = grainStartPosition + grainLength - MAX_GRAIN_SAMPLES;
+		if(grainStartPosition + grainLength >= bufferLength){
+			grainStartPosition = grainStartPosition + grainLength - bufferLength;
 		}
 		// Update grain length (can be set dynamically in the user interface)
 		grains[i].updateLength(grainLength);
@@ -77,15 +143,39 @@ void Voice::noteOn(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grai
 		// Assign grain start idx
 		grains[i].bufferStartIdx = grainStartPosition;
 	}
+	updateRequiredSamples();
+	if(scanning)
+		requiredSamples.store(grainLength + quality.hopSize);
+	
+	// Extraction and synthesis happen on the voice synthesis task (batched with the other notes of a chord)
+	if(mode == VOICE_MODE_FFT){
+		grainSrc = &grainSrcBuffer;
+		preparationPending = true;
+	}
 	
 	// Start playing first grain
-	grainPositions[0] = 0;
+	startGrain(0);
+	return true;
 }
 
-float Voice::play(){
+float Voice::play(float* bus){
+	if(mode == VOICE_MODE_RESONATOR)
+		return playResonators(bus);
+	if(scanning)
+		return playScanning(bus);
+	if(playbackRate != 1.0f || rateJitter > 0.0f)
+		return playResampled(bus);
+	if(storage != SAMPLE_FORMAT_FLOAT32)
+		return playCompact(bus);
+	
 	// Output
 	float mix = 0.0f;
 	
+	// Only the first readySamples samples of the buffer are synthesised, everything after reads as silence
+	int ready = readySamples.load(std::memory_order_acquire);
+	
+	refreshWindowedGrain();
+	
 	// Iterate over the grains currently playing and add their
 	// sample values to the mix
 	for (int grainIdx = 0; grainIdx < numberOfGrains; grainIdx++){
@@ -93,10 +183,23 @@ float Voice::play(){
 			// Get current sample for grain
 			int grainStartIdx = grains[grainIdx].bufferStartIdx;
 			auto currentGrainPos = grainPositions[grainIdx];
-			auto currentSample = buffer[grainStartIdx + currentGrainPos] * window.getAt(currentGrainPos);
+			int bufferIdx = grainStartIdx + currentGrainPos;
+			float currentSample = 0.0f;
+			if(grainStartIdx == 0 && currentGrainPos < windowedGrainFilled){
+				// Grains starting at the buffer start all produce the same windowed waveform
+				currentSample = windowedGrain[currentGrainPos];
+			} else if(bufferIdx < ready){
+				currentSample = buffer[bufferIdx] * window.getAt(currentGrainPos);
+				// The leading grain extends the memoized waveform
+				if(grainStartIdx == 0 && currentGrainPos == windowedGrainFilled){
+					windowedGrain[windowedGrainFilled++] = currentSample;
+				}
+			}
 			
 			// Add current sample to mix
 			mix += currentSample;
+			if(bus != nullptr)
+				panSample(bus, grains[grainIdx].gains, currentSample, numOutputChannels);
 			
 			// Update sample position for grain buffer
 			grainPositions[grainIdx]++;
@@ -108,6 +211,205 @@ float Voice::play(){
 		}
 	}
 	
+	triggerGrains();
+	
+	// Attenuate mix by number of currently playing grains
+	
+	return mix;
+}
+
+float Voice::playCompact(float* bus){
+	float mix = 0.0f;
+	int ready = readySamples.load(std::memory_order_acquire);
+	refreshWindowedGrain();
+	
+	for (int grainIdx = 0; grainIdx < numberOfGrains; grainIdx++){
+		if(grainPositions[grainIdx] > NOT_PLAYING_I){
+			int grainStartIdx = grains[grainIdx].bufferStartIdx;
+			auto currentGrainPos = grainPositions[grainIdx];
+			int bufferIdx = grainStartIdx + currentGrainPos;
+			// The leading grain decodes and windows the next chunk of the memoized grain in one go
+			if(grainStartIdx == 0 && currentGrainPos == windowedGrainFilled && bufferIdx < ready){
+				int chunk = std::min(COMPACT_DECODE_CHUNK, std::min(ready, grains[grainIdx].length) - currentGrainPos);
+				compactBuffer.loadWindowed(currentGrainPos, window.getData() + currentGrainPos, &windowedGrain[currentGrainPos], chunk);
+				windowedGrainFilled += chunk;
+			}
+			float currentSample = 0.0f;
+			if(grainStartIdx == 0 && currentGrainPos < windowedGrainFilled){
+				currentSample = windowedGrain[currentGrainPos];
+			} else if(bufferIdx < ready){
+				currentSample = compactBuffer.get(bufferIdx) * window.getAt(currentGrainPos);
+			}
+			mix += currentSample;
+			if(bus != nullptr)
+				panSample(bus, grains[grainIdx].gains, currentSample, numOutputChannels);
+			
+			grainPositions[grainIdx]++;
+			if(grainPositions[grainIdx] >= grains[grainIdx].length){
+				grainPositions[grainIdx] = NOT_PLAYING_I;
+			}
+		}
+	}
+	
+	triggerGrains();
+	
+	return mix;
+}
+
+void Voice::refreshWindowedGrain(){
+	// Invalidate the memoized windowed grain if the window, grain length or buffer changed
+	int windowVersion = window.getVersion();
+	int generation = bufferGeneration.load(std::memory_order_acquire);
+	if(windowVersion != windowedGrainWindowVersion || generation != windowedGrainGeneration){
+		windowedGrainFilled = 0;
+		windowedGrainWindowVersion = windowVersion;
+		windowedGrainGeneration = generation;
+	}
+}
+
+float Voice::playResampled(float* bus){
+	float mix = 0.0f;
+	int ready = readySamples.load(std::memory_order_acquire);
+	float taps[INTERPOLATION_TAPS];
+	
+	for (int grainIdx = 0; grainIdx < numberOfGrains; grainIdx++){
+		if(grainPositions[grainIdx] > NOT_PLAYING_I){
+			Grain& grain = grains[grainIdx];
+			int currentGrainPos = grainPositions[grainIdx];
+			int bufferIdx = grain.bufferStartIdx + currentGrainPos;
+			float currentSample = 0.0f;
+			if(bufferIdx < ready){
+				// Read the taps straight from the buffer, gather them only at its edges (or from the compact buffer)
+				int firstTap = bufferIdx + INTERPOLATION_FIRST_TAP;
+				const float* source = taps;
+				if(storage == SAMPLE_FORMAT_FLOAT32 && firstTap >= 0 && firstTap + INTERPOLATION_TAPS <= ready){
+					source = &buffer[firstTap];
+				} else {
+					for (int k = 0; k < INTERPOLATION_TAPS; k++){
+						int idx = firstTap + k;
+						taps[k] = idx >= 0 && idx < ready ? sampleAt(idx) : 0.0f;
+					}
+				}
+				// The window is indexed by the same fractional phase as the buffer
+				float window0 = window.getAt(currentGrainPos);
+				float window1 = window.getAt(std::min(currentGrainPos + 1, grain.length - 1));
+				float grainWindow = window0 + grain.fraction * (window1 - window0);
+				currentSample = interpolator.read(interpolation, source, grain.fraction) * grainWindow;
+			}
+			mix += currentSample;
+			if(bus != nullptr)
+				panSample(bus, grain.gains, currentSample, numOutputChannels);
+			
+			// Advance the read position by the rate of the grain
+			float position = grain.fraction + grain.rate;
+			int step = int(position);
+			grain.fraction = position - step;
+			grainPositions[grainIdx] += step;
+			if(grainPositions[grainIdx] >= grain.length){
+				grainPositions[grainIdx] = NOT_PLAYING_I;
+			}
+		}
+	}
+	
+	triggerGrains();
+	
+	return mix;
+}
+
+float Voice::playScanning(float* bus){
+	float mix = 0.0f;
+	int ready = readySamples.load(std::memory_order_acquire);
+	// Samples before this were overwritten by later hops (or were never synthesised at the start of the note)
+	int oldest = std::max(0, ready - bufferLength);
+	int needed = int(scanPosition);
+	float taps[INTERPOLATION_TAPS];
+	
+	for (int grainIdx = 0; grainIdx < numberOfGrains; grainIdx++){
+		if(grainPositions[grainIdx] > NOT_PLAYING_I){
+			Grain& grain = grains[grainIdx];
+			int currentGrainPos = grainPositions[grainIdx];
+			int bufferIdx = grain.bufferStartIdx + currentGrainPos;
+			needed = std::min(needed, bufferIdx + INTERPOLATION_FIRST_TAP);
+			float currentSample = 0.0f;
+			if(grain.rate == 1.0f){
+				if(bufferIdx >= oldest && bufferIdx < ready)
+					currentSample = sampleAt(bufferIdx % bufferLength) * window.getAt(currentGrainPos);
+			} else if(bufferIdx < ready){
+				// The taps are gathered across the wrap of the ring
+				int firstTap = bufferIdx + INTERPOLATION_FIRST_TAP;
+				for (int k = 0; k < INTERPOLATION_TAPS; k++){
+					int idx = firstTap + k;
+					taps[k] = idx >= oldest && idx < ready ? sampleAt(idx % bufferLength) : 0.0f;
+				}
+				float window0 = window.getAt(currentGrainPos);
+				float window1 = window.getAt(std::min(currentGrainPos + 1, grain.length - 1));
+				float grainWindow = window0 + grain.fraction * (window1 - window0);
+				currentSample = interpolator.read(interpolation, taps, grain.fraction) * grainWindow;
+			}
+			mix += currentSample;
+			if(bus != nullptr)
+				panSample(bus, grain.gains, currentSample, numOutputChannels);
+			
+			float position = grain.fraction + grain.rate;
+			int step = int(position);
+			grain.fraction = position - step;
+			grainPositions[grainIdx] += step;
+			if(grainPositions[grainIdx] >= grain.length){
+				grainPositions[grainIdx] = NOT_PLAYING_I;
+			}
+		}
+	}
+	oldestNeeded.store(needed, std::memory_order_relaxed);
+	
+	// Move the scan head on, new grains start there (scattered ahead of it by up to a grain length)
+	scanPosition += scanRate;
+	triggerGrains();
+	int span = scatter > 0 ? 2 * grainLength : grainLength;
+	requiredSamples.store(int(scanPosition) + span + quality.hopSize, std::memory_order_relaxed);
+	
+	return mix;
+}
+
+float Voice::sampleAt(int index){
+	return storage == SAMPLE_FORMAT_FLOAT32 ? buffer[index] : compactBuffer.get(index);
+}
+
+float Voice::playResonators(float* bus){
+	// Next sample of the source span, looped like the voice buffer of the FFT mode
+	float input = 0.0f;
+	const SampleData* data = sourceData.load(std::memory_order_acquire);
+	if(data != nullptr){
+		int idx = sourceStart.load(std::memory_order_relaxed) + sourceReadPosition;
+		if(idx < data->sampleLen)
+			input = data->samples[idx];
+	}
+	if(++sourceReadPosition >= bufferLength)
+		sourceReadPosition = 0;
+	// Same scaling as the overtone bins of the FFT mode
+	float filtered = resonators->process(input) / float(nOvertones);
+	
+	// Every playing grain adds its window to the envelope of the filtered stream
+	// (the grains share one stream, so scatter has no effect in this mode)
+	float envelope = 0.0f;
+	for (int grainIdx = 0; grainIdx < numberOfGrains; grainIdx++){
+		if(grainPositions[grainIdx] > NOT_PLAYING_I){
+			float grainWindow = window.getAt(grainPositions[grainIdx]);
+			envelope += grainWindow;
+			if(bus != nullptr)
+				panSample(bus, grains[grainIdx].gains, filtered * grainWindow, numOutputChannels);
+			grainPositions[grainIdx]++;
+			if(grainPositions[grainIdx] >= grains[grainIdx].length){
+				grainPositions[grainIdx] = NOT_PLAYING_I;
+			}
+		}
+	}
+	
+	triggerGrains();
+	
+	return filtered * envelope;
+}
+
+void Voice::triggerGrains(){
 	// Check if a new grain should be triggered, i.e. if grainFrequency samples elapsed
 	if(sampleCounter >= grainFrequency){
 		// Trigger new grain
@@ -115,10 +417,10 @@ float Voice::play(){
 		if(scatter > 0){
 			// Add randomness to the next grain triggered
 			nextFree += getRandomInRange(numberOfGrains);
-			if(nextFree > numberOfGrains)
-				nextFree -= numberOfGrains + 1;
+			if(nextFree >= numberOfGrains)
+				nextFree -= numberOfGrains;
 		}
-		grainPositions[nextFree] = 0;
+		startGrain(nextFree);
 		
 		// Reset sample counter
 		sampleCounter = 0;
@@ -126,54 +428,493 @@ float Voice::play(){
 	
 	// Update sample counter
 	sampleCounter++;
+}
+
+void Voice::setSourceSamples(const SampleData* sampleData, int startIdx, AnalysisCache* analysis){
+	sourceStart.store(startIdx, std::memory_order_relaxed);
+	sourceAnalysis.store(analysis, std::memory_order_relaxed);
+	sourceData.store(sampleData, std::memory_order_release);
+}
+
+void Voice::updateGrainSrcBuffer(GrainSource& grainSrcBuffer){
+	if(mode == VOICE_MODE_RESONATOR)
+		return;
+	std::lock_guard<std::mutex> lock(synthesisMutex);
+	// A scanning note reads the song and does not follow the slice
+	if(scanning)
+		return;
 	
-	// Attenuate mix by number of currently playing grains
+	// Start over from the new source (which may be another level with another FFT size)
+	resetSynthesis();
+	grainSrc = &grainSrcBuffer;
+	quality = grainSrcBuffer.getQuality();
+	updateOvertoneBins();
+	preparationPending = true;
+}
+
+void Voice::updateOvertoneBins(){
+	// Remove the previous overtone bins from the mask
+	for (int bin : overtoneBins){
+		currentMask[bin].r = 0.0f;
+		currentMask[bin].i = 0.0f;
+	}
+	for (int bin : maskedBins){
+		currentMask[bin].r = 0.0f;
+		currentMask[bin].i = 0.0f;
+	}
+	maskedBins.clear();
 	
-	return mix;
+	// Clear overtone bins
+	overtoneBins.clear();
+	if(frequency == NOT_PLAYING)
+		return;
+	for (int i = 0; i < nOvertones; i++){
+		// Extract frequencies from grain source buffer
+		auto current = nominalBin(i);
+		if(current >= quality.fftSize)
+			break;
+		overtoneBins.push_back(current);
+	}
+	// Neighbouring overtones of low notes can round to the same bin
+	std::sort(overtoneBins.begin(), overtoneBins.end());
+	overtoneBins.erase(std::unique(overtoneBins.begin(), overtoneBins.end()), overtoneBins.end());
+}
+
+void Voice::reserveOvertoneLines(){
+	size_t required = nOvertones * quality.sourceHops;
+	if(overtoneLines.size() < required)
+		overtoneLines.resize(required);
+	if(snapOvertones && overtoneHopBins.size() < required)
+		overtoneHopBins.resize(required);
+}
+
+int Voice::getNumMaskBins(){
+	return snapOvertones ? numSnappedOvertones : int(overtoneBins.size());
+}
+
+int Voice::getMaskBin(int i, int hop){
+	return snapOvertones ? overtoneHopBins[i * quality.sourceHops + hop] : overtoneBins[i];
 }
 
-void Voice::updateGrainSrcBuffer(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grainSrcBuffer){
-	bufferPosition = 0;
-	// Clear buffer
-	for (int i = 0; i < MAX_GRAIN_SAMPLES; i++){
-		buffer[i] = 0.0f;
+void Voice::prepareBatch(std::vector<std::unique_ptr<Voice>>& voices, WorkerPool& pool){
+	// Lock every voice waiting for preparation (always in index order)
+	Voice* batch[NUM_VOICES];
+	std::unique_lock<std::mutex> locks[NUM_VOICES];
+	int batchSize = 0;
+	for (auto& voice : voices){
+		if(!voice->preparationPending || batchSize >= NUM_VOICES)
+			continue;
+		std::unique_lock<std::mutex> lock(voice->synthesisMutex);
+		// Voices on a pyramid level that is still being analysed wait for the next batch
+		if(!voice->preparationPending || (!voice->scanning && (voice->grainSrc == nullptr || !voice->grainSrc->isReady())))
+			continue;
+		voice->reserveOvertoneLines();
+		locks[batchSize] = std::move(lock);
+		batch[batchSize++] = voice.get();
+	}
+	if(batchSize == 0)
+		return;
+	
+	TRACE_SCOPE("batch-preparation");
+	
+	// Voices snapping their overtones to the peaks of the source read other bins in every hop,
+	// so they extract on their own (in parallel), scanning voices read their bins from the song hop by hop
+	bool extracted[NUM_VOICES] = {};
+	pool.run(batchSize, [&](int, int v){
+		if(batch[v]->snapOvertones && !batch[v]->scanning)
+			batch[v]->extractOvertones();
+	});
+	for (int v = 0; v < batchSize; v++){
+		if(batch[v]->snapOvertones || batch[v]->scanning){
+			extracted[v] = true;
+			batch[v]->preparationPending = false;
+		}
+	}
+	
+	// Merge the sorted overtone bin lists of all voices sharing a grain source (one pass per source, e.g. per
+	// level of a grain pyramid) so that each line of the bin-major view is read once, however many voices use it
+	for (int first = 0; first < batchSize; first++){
+		if(extracted[first])
+			continue;
+		GrainSource* source = batch[first]->grainSrc;
+		auto sharesSource = [&](int v){ return !extracted[v] && batch[v]->grainSrc == source; };
+		int numBins = source->getQuality().fftSize;
+		int cursors[NUM_VOICES] = {};
+		while(true){
+			int bin = numBins;
+			for (int v = first; v < batchSize; v++){
+				if(sharesSource(v) && cursors[v] < int(batch[v]->overtoneBins.size()))
+					bin = std::min(bin, batch[v]->overtoneBins[cursors[v]]);
+			}
+			if(bin == numBins)
+				break;
+			
+			// The first voice using the bin reads it from the source, the others copy from that voice
+			const ne10_fft_cpx_float32_t* line = nullptr;
+			for (int v = first; v < batchSize; v++){
+				Voice* voice = batch[v];
+				if(sharesSource(v) && cursors[v] < int(voice->overtoneBins.size()) && voice->overtoneBins[cursors[v]] == bin){
+					ne10_fft_cpx_float32_t* destination = &voice->overtoneLines[cursors[v] * voice->quality.sourceHops];
+					if(line == nullptr)
+						source->copyBinLine(bin, destination);
+					else
+						std::copy(line, line + voice->quality.sourceHops, destination);
+					line = destination;
+					cursors[v]++;
+				}
+			}
+		}
+		for (int v = first; v < batchSize; v++){
+			if(sharesSource(v)){
+				batch[v]->preparationPending = false;
+				extracted[v] = true;
+			}
+		}
+	}
+}
+
+// Lane-interleaved inverse FFT of the given size of the calling thread (the synthesis task and the helpers of its pool),
+// allocated on first use
+static LaneFft& laneFftFor(int fftSize){
+	static thread_local std::vector<std::unique_ptr<LaneFft>> laneFfts;
+	for (auto& laneFft : laneFfts){
+		if(laneFft->getSize() == fftSize)
+			return *laneFft;
+	}
+	laneFfts.push_back(std::unique_ptr<LaneFft>(new LaneFft(fftSize)));
+	return *laneFfts.back();
+}
+
+// Voices synthesised with one LaneFft in a round (fftSize 0: a single voice synthesising on its own)
+struct LaneBatch {
+	Voice* voices[LANE_FFT_LANES];
+	int count;
+	int fftSize;
+};
+
+void Voice::synthesiseRounds(const std::vector<Voice*>& voices, WorkerPool& pool){
+	std::vector<LaneBatch> batches;
+	batches.reserve(voices.size());
+	std::atomic<bool> pending(true);
+	while(pending){
+		pending = false;
+		// Fill the lanes in voice order, so that the voices of a batch are locked in the same order everywhere
+		batches.clear();
+		for (Voice* voice : voices){
+			if(!voice->needsSynthesis())
+				continue;
+			int fftSize = voice->getLaneHopSize();
+			LaneBatch* batch = nullptr;
+			for (auto& candidate : batches){
+				if(fftSize > 0 && candidate.fftSize == fftSize && candidate.count < LANE_FFT_LANES)
+					batch = &candidate;
+			}
+			if(batch == nullptr){
+				batches.push_back({ {}, 0, fftSize });
+				batch = &batches.back();
+			}
+			batch->voices[batch->count++] = voice;
+		}
+		// A voice alone in its batch is cheaper with its own (NE10) FFT
+		pool.run(batches.size(), [&](int, int b){
+			LaneBatch& batch = batches[b];
+			bool more = batch.count == 1 ? batch.voices[0]->synthesiseAhead(1) : synthesiseLaneHop(batch.voices, batch.count, batch.fftSize);
+			if(more)
+				pending = true;
+		});
+	}
+}
+
+int Voice::getLaneHopSize(){
+	if(mode != VOICE_MODE_FFT || frequency == NOT_PLAYING || preparationPending || scanning || grainSrc == nullptr
+	|| synthesisedHops >= quality.sourceHops)
+		return 0;
+	return quality.fftSize;
+}
+
+bool Voice::synthesiseLaneHop(Voice* const* voices, int count, int fftSize){
+	std::unique_lock<std::mutex> locks[LANE_FFT_LANES];
+	Voice* lanes[LANE_FFT_LANES];
+	int numLanes = 0;
+	for (int v = 0; v < count; v++){
+		std::unique_lock<std::mutex> lock(voices[v]->synthesisMutex);
+		// Retriggered, released or moved to another pyramid level since the batch was built
+		if(voices[v]->getLaneHopSize() != fftSize || !voices[v]->needsSynthesis())
+			continue;
+		locks[numLanes] = std::move(lock);
+		lanes[numLanes++] = voices[v];
+	}
+	if(numLanes == 0)
+		return false;
+	
+	TRACE_SCOPE("lane-inverse-fft-hop");
+	
+	LaneFft& laneFft = laneFftFor(fftSize);
+	for (int lane = 0; lane < numLanes; lane++){
+		Voice* voice = lanes[lane];
+		int hop = voice->synthesisedHops;
+		for (int i = 0; i < voice->getNumMaskBins(); i++){
+			laneFft.setBin(lane, voice->getMaskBin(i, hop), voice->overtoneLines[i * voice->quality.sourceHops + hop]);
+		}
+	}
+	laneFft.inverse();
+	
+	bool pending = false;
+	for (int lane = 0; lane < numLanes; lane++){
+		lanes[lane]->addHop(laneFft.getReal(lane), LANE_FFT_LANES);
+		if(lanes[lane]->needsSynthesis())
+			pending = true;
+	}
+	return pending;
+}
+
+bool Voice::needsSynthesis(){
+	if(frequency == NOT_PLAYING || mode == VOICE_MODE_RESONATOR)
+		return false;
+	if(preparationPending)
+		return true;
+	if(scanning){
+		// Hops go on as long as the note is held, but never overwrite samples a playing grain still reads
+		int ready = readySamples.load();
+		return ready < requiredSamples.load() && ready + quality.hopSize <= oldestNeeded.load() + bufferLength;
+	}
+	// Sample s is final once all hops starting at or before s are added
+	int requiredHops = (requiredSamples.load() + quality.hopSize - 1) / quality.hopSize;
+	return readySamples.load() < bufferLength && readySamples.load() < requiredHops * quality.hopSize;
+}
+
+bool Voice::synthesiseAhead(int maxHops){
+	std::lock_guard<std::mutex> lock(synthesisMutex);
+	
+	// Not picked up by prepareBatch() yet
+	if(preparationPending && grainSrc != nullptr){
+		if(!scanning){
+			// The pyramid level is still being analysed
+			if(!grainSrc->isReady())
+				return false;
+			extractOvertones();
+		}
+		preparationPending = false;
+	}
+	
+	for (int i = 0; i < maxHops && needsSynthesis(); i++){
+		synthesiseHop();
+	}
+	return needsSynthesis();
+}
+
+void Voice::synthesiseHop(){
+	TRACE_SCOPE("inverse-fft-hop");
+	
+	if(scanning){
+		synthesiseScanHop();
+		return;
+	}
+	if(grainSrc == nullptr || synthesisedHops >= quality.sourceHops)
+		return;
+	
+	int fftSize = quality.fftSize;
+	if(cfgSize != fftSize){
+		NE10_FREE(cfg);
+		cfg = ne10_fft_alloc_c2c_float32_neon (fftSize);
+		cfgSize = fftSize;
+	}
+	int hop = synthesisedHops;
+	
+	// Create a mask for the frequency domain representation based on the current fundamental frequency
+	// Only the overtone bins are non-zero, all other bins stay zero from the constructor / noteOn
+	if(snapOvertones){
+		// The overtones follow the peaks of the source from hop to hop: clear the bins of the previous hop first
+		for (int bin : maskedBins){
+			currentMask[bin].r = 0.0f;
+			currentMask[bin].i = 0.0f;
+		}
+		maskedBins.clear();
+	}
+	for (int i = 0; i < getNumMaskBins(); i++){
+		int bin = getMaskBin(i, hop);
+		currentMask[bin] = overtoneLines[i * quality.sourceHops + hop];
+		if(snapOvertones)
+			maskedBins.push_back(bin);
+	}
+	
+	// Run the inverse FFT -> indicated by the "1" for the last function parameter 
+	ne10_fft_c2c_1d_float32_neon (timeDomainGrainBuffer, currentMask, cfg, 1);
+	addHop(&timeDomainGrainBuffer[0].r, 2);
+}
+
+void Voice::addHop(const float* real, int stride){
+	int fftSize = quality.fftSize;
+	int hop = synthesisedHops;
+	int bufferPosition = hop * quality.hopSize;
+	
+	// Clear the part of the buffer this hop writes to for the first time
+	// (the rest was already written by the previous hops)
+	if(storage == SAMPLE_FORMAT_FLOAT32){
+		int clearStart = hop == 0 ? 0 : bufferPosition + fftSize - quality.hopSize;
+		int clearEnd = std::min(bufferPosition + fftSize, bufferLength);
+		for (int i = clearStart; i < clearEnd; i++){
+			buffer[i] = 0.0f;
+		}
+	} else if(hop == 0){
+		std::fill(overlap.begin(), overlap.end(), 0.0f);
 	}
 	
 	// Scale factor is derived from the number of overtones
 	float scaleFactor = 1.0f / float(nOvertones);
 	
-	// Create a mask for the frequency domain representation based on the current fundamental frequency
-	for (int hop = 0; hop < GRAIN_FFT_INTERVAL; hop++){
-		for (int k = 0; k < N_FFT; k++){
-			// Check if current bin should be included
-			auto search = overtones.find(k);
-			if (search == overtones.end()) {
-				// Current k is not in bins -> exclude
-    			currentMask[k].r = 0.0f;
-				currentMask[k].i = 0.0f;
-			} else {
-				// Include current bin in mask
-				currentMask[k].r = grainSrcBuffer[hop][k].r;
-				currentMask[k].i = grainSrcBuffer[hop][k].i;
+	// Copy the output of the inverse FFT into final time-domain grain buffer
+	// using overlap-and-add
+	if(storage == SAMPLE_FORMAT_FLOAT32){
+		for (int i = 0; i < fftSize; i++){
+			if(bufferPosition + i + 1 >= bufferLength){
+				break;
 			}
+			buffer[bufferPosition + i] += real[i * stride] * scaleFactor;
 		}
-		
-		// Run the inverse FFT -> indicated by the "1" for the last function parameter 
-		ne10_fft_c2c_1d_float32_neon (timeDomainGrainBuffer, currentMask, cfg, 1);
-		
-		// Copy current timeDomainGrainBuffer into final time-domain grain buffer
-		// using overlap-and-add
-		for (int i = 0; i < N_FFT; i++){
-			if(bufferPosition + i + 1 >= MAX_GRAIN_SAMPLES){
+	} else {
+		// overlap starts at bufferPosition
+		for (int i = 0; i < fftSize; i++){
+			if(bufferPosition + i + 1 >= bufferLength){
 				break;
 			}
-			buffer[bufferPosition + i] += timeDomainGrainBuffer[i].r * scaleFactor;
+			overlap[i] += real[i * stride] * scaleFactor;
 		}
-		bufferPosition += FFT_HOP_SIZE;
-		if (bufferPosition >= MAX_GRAIN_SAMPLES){
-			break;
+		// No later hop adds to the samples before the start of the next one: encode them and move the rest up
+		int hopSize = quality.hopSize;
+		compactBuffer.store(bufferPosition, overlap.data(), hopSize);
+		std::copy(overlap.begin() + hopSize, overlap.begin() + fftSize, overlap.begin());
+		std::fill(overlap.begin() + fftSize - hopSize, overlap.begin() + fftSize, 0.0f);
+	}
+	
+	// Everything before the start of the next hop is final now
+	synthesisedHops++;
+	int ready = synthesisedHops >= quality.sourceHops ? bufferLength : std::min(synthesisedHops * quality.hopSize, bufferLength);
+	readySamples.store(ready, std::memory_order_release);
+}
+
+void Voice::synthesiseScanHop(){
+	int fftSize = quality.fftSize;
+	int hopSize = quality.hopSize;
+	int bufferPosition = synthesisedHops * hopSize;
+	// The final samples of the hop would overwrite samples a playing grain still reads
+	if(bufferPosition + hopSize > oldestNeeded.load() + bufferLength)
+		return;
+	if(cfgSize != fftSize){
+		NE10_FREE(cfg);
+		cfg = ne10_fft_alloc_c2c_float32_neon (fftSize);
+		cfgSize = fftSize;
+	}
+	if(synthesisedHops == 0)
+		std::fill(overlap.begin(), overlap.end(), 0.0f);
+	
+	// Song frame under this hop, looped over the song (frame f starts at sample f * hopSize like in the analysis cache)
+	const SampleData* data = sourceData.load(std::memory_order_acquire);
+	int songFrames = std::max(1, (data->sampleLen + hopSize - 1) / hopSize);
+	int frame = (scanFirstFrame + synthesisedHops) % songFrames;
+	AnalysisCache* analysis = sourceAnalysis.load(std::memory_order_relaxed);
+	if(analysis != nullptr && analysis->getNumBins() == quality.numBins() && analysis->getNumFrames() == songFrames){
+		for (int bin : overtoneBins){
+			currentMask[bin] = analysis->getBin(frame, bin);
+		}
+	} else {
+		// Same analysis as the analysis cache: Hann window, zeros past the end of the song
+		if(int(scanWindow.size()) != fftSize){
+			scanWindow.resize(fftSize);
+			for (int n = 0; n < fftSize; n++){
+				scanWindow[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(fftSize - 1)));
+			}
+			scanSpectrum.resize(fftSize);
+		}
+		int start = frame * hopSize;
+		for (int n = 0; n < fftSize; n++){
+			timeDomainGrainBuffer[n].r = start + n < data->sampleLen ? data->samples[start + n] * scanWindow[n] : 0.0f;
+			timeDomainGrainBuffer[n].i = 0.0f;
+		}
+		ne10_fft_c2c_1d_float32_neon (scanSpectrum.data(), timeDomainGrainBuffer, cfg, 0);
+		for (int bin : overtoneBins){
+			currentMask[bin] = scanSpectrum[bin];
 		}
 	}
+	
+	ne10_fft_c2c_1d_float32_neon (timeDomainGrainBuffer, currentMask, cfg, 1);
+	float scaleFactor = 1.0f / float(nOvertones);
+	for (int i = 0; i < fftSize; i++){
+		overlap[i] += timeDomainGrainBuffer[i].r * scaleFactor;
+	}
+	
+	// No later hop adds to the samples before the start of the next one: move them into the ring
+	// (hopSize divides bufferLength, so a hop never wraps)
+	int ringPosition = bufferPosition % bufferLength;
+	if(storage == SAMPLE_FORMAT_FLOAT32)
+		std::copy(overlap.begin(), overlap.begin() + hopSize, buffer.begin() + ringPosition);
+	else
+		compactBuffer.store(ringPosition, overlap.data(), hopSize);
+	std::copy(overlap.begin() + hopSize, overlap.begin() + fftSize, overlap.begin());
+	std::fill(overlap.begin() + fftSize - hopSize, overlap.begin() + fftSize, 0.0f);
+	
+	synthesisedHops++;
+	readySamples.store(synthesisedHops * hopSize, std::memory_order_release);
+}
+
+void Voice::extractOvertones(){
+	TRACE_SCOPE("overtone-extraction");
+	reserveOvertoneLines();
+	if(snapOvertones){
+		extractSnappedOvertones();
+		return;
+	}
+	
+	// One contiguous line of sourceHops values per overtone
+	for (int i = 0; i < int(overtoneBins.size()); i++){
+		grainSrc->copyBinLine(overtoneBins[i], &overtoneLines[i * quality.sourceHops]);
+	}
+}
+
+void Voice::extractSnappedOvertones(){
+	int numHops = quality.sourceHops;
+	float binsPerHz = quality.fftSize / sampleRate;
+	// Same overtones as updateOvertoneBins()
+	numSnappedOvertones = 0;
+	while(numSnappedOvertones < nOvertones && nominalBin(numSnappedOvertones) < quality.fftSize){
+		numSnappedOvertones++;
+	}
+	
+	// Hop by hop, so that every frame is read while it is in the cache
+	for (int hop = 0; hop < numHops; hop++){
+		for (int i = 0; i < numSnappedOvertones; i++){
+			float target = noteFrequency * (i + 1) * binsPerHz;
+			float maxDistance = std::min(0.25f * noteFrequency * binsPerHz, OVERTONE_SNAP_RANGE * target);
+			const SpectralPeak* peak = grainSrc->findPeak(hop, target, maxDistance);
+			// No partial near the overtone in this hop: keep the nominal bin
+			int bin = peak != nullptr ? peak->bin : nominalBin(i);
+			overtoneHopBins[i * numHops + hop] = bin;
+			overtoneLines[i * numHops + hop] = grainSrc->getBin(hop, bin);
+		}
+	}
+}
+
+int Voice::nominalBin(int overtone){
+	// With the medium quality tier the frequency resolution is ~10Hz / bin
+	// (the frequency mapped from 0 ... Nyquist onto 0 ... numBins)
+	return int(round(noteFrequency * (overtone + 1) * float(quality.numBins()) / (float(sampleRate) / 2.0f)));
+}
+
+void Voice::resetSynthesis(){
+	readySamples.store(0, std::memory_order_release);
+	synthesisedHops = 0;
+	bufferGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void Voice::updateRequiredSamples(){
+	// Scanning notes follow the scan head (see playScanning())
+	if(scanning)
+		return;
+	int required = 0;
+	for (auto& grain : grains){
+		required = std::max(required, grain.bufferStartIdx + grain.length);
+	}
+	requiredSamples.store(std::min(required, bufferLength));
 }
 
 void Voice::noteOff(){
@@ -189,37 +930,122 @@ void Voice::setGrainLength(int grainLengthSamples){
 	this->grainLength = grainLengthSamples;
 	
 	for(auto& grain : grains){
+		// Grains of a scanning note keep their position relative to the scan head
+		if(scanning){
+			grain.updateLength(grainLength);
+			continue;
+		}
 		auto grainStartPosition = grain.bufferStartIdx;
 		// Check if length would go past buffer limit and adjust accordingly
-		if(grainStartPosition + grainLength >= MAX_GRAIN_SAMPLES){
-			grainStartPosition = grainStartPosition + grainLength - MAX_GRAIN_SAMPLES;
+		if(grainStartPosition + grainLength >= bufferLength){
+			grainStartPosition = grainStartPosition + grainLength - bufferLength;
 		}
 		// Update grain length (can be set dynamically in the user interface)
 		grain.bufferStartIdx = grainStartPosition;
 		grain.updateLength(grainLength);
 	}
+	updateRequiredSamples();
+	bufferGeneration.fetch_add(1, std::memory_order_release);
 }
 
 void Voice::setGrainFrequency(int grainFrequencySamples){
 	this->grainFrequency = grainFrequencySamples;
 }
 
+void Voice::setPan(float pan, int spread){
+	this->pan = pan;
+	this->spread = spread;
+}
+
+void Voice::setPlaybackRate(float rate, float jitterCents){
+	this->playbackRate = rate;
+	this->rateJitter = jitterCents;
+}
+
+void Voice::setInterpolation(InterpolationKernel kernel){
+	this->interpolation = kernel;
+}
+
+void Voice::setScanRate(float rate){
+	this->scanRate = std::max(0.0f, rate);
+}
+
+int Voice::getNumPlayingGrains(){
+	int playing = 0;
+	for (auto position : grainPositions){
+		if(position > NOT_PLAYING_I)
+			playing++;
+	}
+	return playing;
+}
+
+void Voice::setNumOutputChannels(int numOutputChannels){
+	this->numOutputChannels = std::max(1, std::min(numOutputChannels, MAX_OUTPUT_CHANNELS));
+}
+
 void Voice::setScatter(int scatter){
 	this->scatter = scatter;
+	// New grains of a scanning note are scattered around the scan head when they start
+	if(scanning)
+		return;
 	
 	for(auto& grain : grains){
 		auto grainStartPosition = 0;
 		// If scatter > 0 pseudorandomly spread out the grain start positions
 		if(scatter > 0) {
-			int random = getRandomInRange(MAX_GRAIN_SAMPLES);
+			int random = getRandomInRange(bufferLength);
 			grainStartPosition = int(0.01 * scatter * random);
 		}
 		// Check if length would go past buffer limit and wrap around if necessary (start from the beginning)
-		if(grainStartPosition + grainLength >= MAX_GRAIN_SAMPLES){
-			grainStartPosition = grainStartPosition + grainLength - MAX_GRAIN_SAMPLES;
+		if(grainStartPosition + grainLength >= bufferLength){
+			grainStartPosition = grainStartPosition + grainLength - bufferLength;
 		}
 		grain.bufferStartIdx = grainStartPosition;
 	}
+	updateRequiredSamples();
+}
+
+void Voice::setNumOvertones(int numOvertones){
+	std::lock_guard<std::mutex> lock(synthesisMutex);
+	nOvertones = numOvertones;
+	if(mode == VOICE_MODE_RESONATOR){
+		resonators.reset(new ResonatorBank(nOvertones));
+		return;
+	}
+	overtoneBins.reserve(nOvertones);
+	overtoneLines.resize(nOvertones * quality.sourceHops);
+	overtoneHopBins.resize(nOvertones * quality.sourceHops);
+	maskedBins.reserve(nOvertones);
+}
+
+void Voice::setOvertoneSnapping(bool snap){
+	std::lock_guard<std::mutex> lock(synthesisMutex);
+	snapOvertones = snap;
+}
+
+int Voice::getReadySamples(){
+	return readySamples.load(std::memory_order_acquire);
+}
+
+int Voice::getMemoryUsage(){
+	int bytes = sizeof(Voice);
+	bytes += buffer.capacity() * sizeof(float) + windowedGrain.capacity() * sizeof(float);
+	bytes += compactBuffer.getMemoryUsage() + overlap.capacity() * sizeof(float);
+	bytes += overtoneBins.capacity() * sizeof(int) + overtoneLines.capacity() * sizeof(ne10_fft_cpx_float32_t);
+	bytes += (overtoneHopBins.capacity() + maskedBins.capacity()) * sizeof(int);
+	bytes += grains.capacity() * sizeof(Grain) + grainPositions.capacity() * sizeof(int);
+	if(currentMask != nullptr)
+		bytes += 2 * std::max(quality.fftSize, QUALITY_TIERS[NUM_QUALITY_TIERS - 1].fftSize) * sizeof(ne10_fft_cpx_float32_t);
+	// The FFT config holds about one twiddle factor per point
+	if(cfg != nullptr)
+		bytes += cfgSize * sizeof(ne10_fft_cpx_float32_t);
+	if(resonators)
+		bytes += resonators->getMemoryUsage();
+	return bytes;
+}
+
+VoiceMode Voice::getMode(){
+	return mode;
 }
 
 int Voice::findNextFreeGrainIdx(){
@@ -232,10 +1058,57 @@ int Voice::findNextFreeGrainIdx(){
 	return NOT_PLAYING_I;
 }
 
+void Voice::startGrain(int grainIdx){
+	// All grains are playing already
+	if(grainIdx < 0 || grainIdx >= numberOfGrains)
+		return;
+	grainPositions[grainIdx] = 0;
+	
+	// Grains of a scanning note start at the scan head, scattered ahead of it by up to a grain length
+	if(scanning){
+		int offset = scatter > 0 ? int(0.01 * scatter * getRandomInRange(std::max(1, grains[grainIdx].length))) : 0;
+		grains[grainIdx].bufferStartIdx = int(scanPosition) + offset;
+	}
+	
+	// Read rate, pseudorandomly detuned by up to rateJitter cents
+	Grain& grain = grains[grainIdx];
+	grain.fraction = 0.0f;
+	grain.rate = playbackRate;
+	if(rateJitter > 0.0f){
+		float random = float(getRandomInRange(PAN_RANDOM_STEPS) - 1) / float(PAN_RANDOM_STEPS - 1);
+		grain.rate *= powf(2.0f, rateJitter * (2.0f * random - 1.0f) / 1200.0f);
+	}
+	
+	// Position on the bus, pseudorandomly spread around the pan position
+	float position = pan;
+	if(spread > 0){
+		float random = float(getRandomInRange(PAN_RANDOM_STEPS) - 1) / float(PAN_RANDOM_STEPS - 1);
+		position += 0.01f * spread * (2.0f * random - 1.0f);
+	}
+	position = std::min(1.0f, std::max(-1.0f, position));
+	
+	float* gains = grains[grainIdx].gains;
+	std::fill(gains, gains + MAX_OUTPUT_CHANNELS, 0.0f);
+	if(numOutputChannels == 1){
+		gains[0] = 1.0f;
+		return;
+	}
+	// The channels are laid out on a line, the grain is panned between the two channels next to
+	// its position with constant power
+	float channelPosition = 0.5f * (position + 1.0f) * (numOutputChannels - 1);
+	int channel = std::min(int(channelPosition), numOutputChannels - 2);
+	float fraction = channelPosition - channel;
+	gains[channel] = cosf(0.5f * float(M_PI) * fraction);
+	gains[channel + 1] = sinf(0.5f * float(M_PI) * fraction);
+}
+
 int Voice::getRandomInRange(int upperLimit){
 	return rand() % upperLimit + 1;
 }
 
 Voice::~Voice(){
-	//grains.clear();
+	// Voices are recreated when the quality tier changes
+	NE10_FREE(cfg);
+	NE10_FREE(currentMask);
+	NE10_FREE(timeDomainGrainBuffer);
 }
\ No newline at end of file
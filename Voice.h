@@ -1,61 +1,241 @@
 /***** Voice.h *****/
-#include <Bela.h>
+#ifndef VOICE_H
+#define VOICE_H
+
 #include <cmath>
 #include <memory>
-#include <set>
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include <stdlib.h>
 #include <algorithm>
 #include <time.h>
 #include <libraries/ne10/NE10.h>
 #include <numeric>
-#include <libraries/Midi/Midi.h>
 #include "Constants.h"
 #include "Grain.h"
 #include "Window.h"
+#include "GrainSource.h"
+#include "AnalysisCache.h"
+#include "ResonatorBank.h"
+#include "SampleData.h"
+#include "WorkerPool.h"
+#include "LaneFft.h"
+#include "CompactBuffer.h"
+#include "Interpolator.h"
 
 class Voice {
 	public:
-		Voice(float sampleRate, Window& window);
+		// The length of the voice buffer follows the given quality tier
+		// FFT and hop size follow the grain source the voice is synthesised from (any level of a GrainPyramid)
+		// In VOICE_MODE_RESONATOR the voice has no buffer and no FFT state, only a ResonatorBank
+		// The voice buffer is stored in quality.storage
+		Voice(float sampleRate, Window& window, const QualityTier& quality, VoiceMode mode);
 		~Voice();
 		
 		// Trigger a voice with specified frequency and grain length
-		void noteOn(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grainSrcBuffer, float frequency, int grainLength);
+		// The voice buffer is not synthesised here but by prepareBatch() / synthesiseRounds() on the
+		// voice synthesis task, so that all notes of a chord are prepared together
+		// Called from the audio thread: returns false without waiting if the synthesis task
+		// is working on this voice right now (the caller retries later)
+		bool noteOn(GrainSource& grainSrcBuffer, float frequency, int grainLength);
 		// Release a note (stops playback)
 		void noteOff();
 		// Query active grains for next sample
-		float play();
+		// If bus is given (MAX_OUTPUT_CHANNELS samples) every grain is also added to it with its own channel gains
+		float play(float* bus = nullptr);
 		// Update this voice's grain source buffer
 		// This method is called from render.cpp if the grain window source position is changed
 		// via the user interface
-		void updateGrainSrcBuffer(std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL>& grainSrcBuffer);
+		// Like noteOn the actual resynthesis is deferred to prepareBatch() / synthesiseRounds()
+		// Ignored in VOICE_MODE_RESONATOR
+		void updateGrainSrcBuffer(GrainSource& grainSrcBuffer);
+		// Set the song samples a VOICE_MODE_RESONATOR voice filters: bufferLength samples from startIdx on, looped
+		// A scanning voice starts its scan at startIdx and reads the frames from analysis if given
+		// (and analysed with the FFT size of the voice), otherwise it runs a forward FFT per hop on the samples
+		// Can be called from any thread, the voice picks the new position up on its next sample (or hop)
+		void setSourceSamples(const SampleData* sampleData, int startIdx, AnalysisCache* analysis = nullptr);
+		// Extract the overtones of all voices that were triggered (or got a new source) since the last call in one batch:
+		// every overtone line of a grain source is read once for all voices using it (voices snapping their
+		// overtones to the peaks of the source extract on their own, split across the threads of pool)
+		static void prepareBatch(std::vector<std::unique_ptr<Voice>>& voices, WorkerPool& pool);
+		// Synthesise the remaining hops of voices in rounds of one hop per voice, so that all of them make progress
+		// together. The voices whose next hop has the same FFT size share lane-interleaved inverse FFTs (LaneFft,
+		// LANE_FFT_LANES voices per transform), the transforms of a round are split across the threads of pool
+		static void synthesiseRounds(const std::vector<Voice*>& voices, WorkerPool& pool);
+		// Whether the grains of this voice will read past the part of the buffer that is synthesised so far
+		bool needsSynthesis();
+		// Synthesise up to maxHops further IFFT hops of the voice buffer if the grains need them
+		// Called from the voice synthesis auxiliary task in render.cpp
+		// Returns true if more hops are still required afterwards
+		bool synthesiseAhead(int maxHops);
 		// Set the grain lengths for all grains of this voice
 		void setGrainLength(int grainLengthSamples);
 		// Set the number of grains that should be played every second
 		void setGrainFrequency(int grainFrequencySamples);
 		// Set the severity of the pseudorandom grain scatter process in the range [0...100]
 		void setScatter(int scatter);
+		// Set the position of the grains on the output bus in [-1 (first channel)...1 (last channel)]
+		// and how far [0...100] new grains are pseudorandomly spread around it
+		// Only grains started afterwards move
+		void setPan(float pan, int spread);
+		// Set the number of output channels (at most MAX_OUTPUT_CHANNELS) the grains are panned across
+		void setNumOutputChannels(int numOutputChannels);
+		// Set the rate new grains read the voice buffer at (2 = an octave up, half as long) and
+		// the pseudorandom deviation of every grain from it in cents
+		// Grains always cover grainLength samples of the buffer, the window follows their read position
+		// Ignored in VOICE_MODE_RESONATOR
+		void setPlaybackRate(float rate, float jitterCents);
+		// Set how grains playing at a rate other than 1 read between the samples of the buffer
+		void setInterpolation(InterpolationKernel kernel);
+		// Set the rate the notes scan through the song (1 = as fast as the song plays, 0 = no scanning)
+		// A scanning note keeps synthesising hops of the song from the start of the slice on as long as it
+		// is held: new grains start at the scan head, which moves on by rate samples per output sample
+		// Whether a note scans is decided on noteOn, a scanning note follows rate changes right away (0 holds the head)
+		// Ignored in VOICE_MODE_RESONATOR
+		void setScanRate(float rate);
+		// Number of grains playing right now
+		int getNumPlayingGrains();
+		// Set the number of overtones extracted on noteOn
+		// Allocates, so only call it while the voice is not playing
+		void setNumOvertones(int numOvertones);
+		// Whether every overtone is moved, hop by hop, onto the strongest spectral peak of the grain source
+		// near its nominal frequency (see GrainSource::findPeak()) instead of masking the nominal bin (default: true)
+		// Only call it while the voice is not playing
+		void setOvertoneSnapping(bool snap);
+		// Number of samples at the start of the voice buffer that grains can play already
+		// (for a scanning note: number of samples synthesised since noteOn)
+		int getReadySamples();
+		// Bytes held by this voice (buffers, FFT state, filter state)
+		int getMemoryUsage();
+		VoiceMode getMode();
 	private:
 		// Sample rate of the system
 		float sampleRate = 0.0f;
 		
+		// FFT resynthesis or resonator bank
+		VoiceMode mode;
+		// Format of the voice buffer (quality.storage of the constructor tier)
+		SampleFormat storage;
+		
+		// Quality tier of the grain source the buffer is synthesised from (FFT size, hop size, number of hops)
+		QualityTier quality;
+		// Length of the voice buffer in samples (sourceSamples() of the tier the voice was created with)
+		int bufferLength = 0;
+		// Tier the voice was created with (scanning notes are synthesised with its FFT and hop size)
+		QualityTier voiceQuality;
+		
 		// Current frequency if the voice is playing
 		float frequency = NOT_PLAYING;
+		// Frequency of the last note, set by noteOn() under synthesisMutex and kept by noteOff(), which does not
+		// lock: the overtones of a note released while the synthesis task prepares it are still those of the note
+		float noteFrequency = NOT_PLAYING;
 		
 		// Buffer which will hold the masked frequency domain representation
-		// Filled once for each noteOn event and updated by updateGrainSrcBuffer()
+		// All bins are zero except the overtone bins, which are refilled for every hop
 		ne10_fft_cpx_float32_t* currentMask;
 		
 		// Buffer which will hold the masked time domain representation
 		ne10_fft_cpx_float32_t* timeDomainGrainBuffer;
-		// FFT config
+		// FFT config and the size it was allocated for (reallocated when the grain source uses another size)
 		ne10_fft_cfg_float32_t cfg;
+		int cfgSize = 0;
 		
 		// Buffer into which will hold the IFFT of the 
 		// desired frequency bands for this note
-		// This buffer will be filled once for every noteOn event
+		// This buffer will be filled progressively (hop by hop) for every noteOn event
 		// and subsequently used to generate grains for this voice :)
-		float buffer[MAX_GRAIN_SAMPLES];
-		int bufferPosition = NOT_PLAYING_I;
+		std::vector<float> buffer;
+		// The buffer in a compact format (instead of buffer, see CompactBuffer)
+		// Hops are overlap-added in float into overlap, samples are encoded once no further hop adds to them
+		// (scanning notes overlap-add there in every format)
+		CompactBuffer compactBuffer;
+		std::vector<float> overlap;
+		// play() for the compact formats: the leading grain decodes COMPACT_DECODE_CHUNK samples at a time
+		float playCompact(float* bus);
+		
+		// Grain source the buffer is currently synthesised from (set on noteOn and updateGrainSrcBuffer)
+		GrainSource* grainSrc = nullptr;
+		// Number of IFFT hops already overlap-added into the buffer
+		int synthesisedHops = 0;
+		// Number of samples at the start of the buffer that are final and may be read by grains
+		// Written by the synthesising thread, read by the audio thread
+		std::atomic<int> readySamples;
+		// Set by noteOn / updateGrainSrcBuffer until the overtone lines were extracted from the grain source
+		std::atomic<bool> preparationPending;
+		// Furthest position in the buffer any grain of this voice will read (start + length)
+		std::atomic<int> requiredSamples;
+		// Serialises noteOn, source updates and background synthesis of this voice
+		// (the audio thread only tries to take it in noteOn and never waits for it)
+		std::mutex synthesisMutex;
+		
+		// Memoized windowed grain, i.e. buffer[i] * window.getAt(i) for grains starting at the beginning of the buffer
+		// With scatter == 0 all grains start there, so overlapping grains become offset reads of this array
+		// Filled lazily (in order) by the leading grain, entries below windowedGrainFilled are valid
+		// (MAX_GRAIN_LENGTH samples, only allocated in VOICE_MODE_FFT)
+		std::vector<float> windowedGrain;
+		int windowedGrainFilled = 0;
+		// Window version and buffer generation the memoized grain was computed for
+		int windowedGrainWindowVersion = -1;
+		int windowedGrainGeneration = -1;
+		// Incremented whenever the buffer is resynthesised or the grain length changes
+		std::atomic<int> bufferGeneration;
+		// Forget the memoized grain if the window or the buffer changed since it was computed
+		void refreshWindowedGrain();
+		
+		// Overlap-add the next IFFT hop into the buffer (synthesisMutex must be held)
+		void synthesiseHop();
+		// Clear the part of the buffer the next hop writes to first, overlap-add the output of its inverse FFT
+		// (sample n at real[n * stride]) and mark the samples before the following hop ready
+		void addHop(const float* real, int stride);
+		// FFT size of the next hop if it can run in a lane of a LaneFft (prepared, not scanning, hops left), 0 otherwise
+		int getLaneHopSize();
+		// Synthesise the next hop of up to LANE_FFT_LANES voices whose getLaneHopSize() was fftSize with one LaneFft
+		// The voices are locked in the given order, the ones that changed meanwhile are left out
+		// Returns true if any of them needs further hops
+		static bool synthesiseLaneHop(Voice* const* voices, int count, int fftSize);
+		// Forget everything synthesised so far (synthesisMutex must be held)
+		void resetSynthesis();
+		// Recalculate requiredSamples from the current grain start positions and lengths
+		void updateRequiredSamples();
+		
+		// Resonators tuned to the overtones of the note (VOICE_MODE_RESONATOR only)
+		std::unique_ptr<ResonatorBank> resonators;
+		// Song samples the resonators filter and the start of the grain source span in them
+		std::atomic<const SampleData*> sourceData;
+		std::atomic<int> sourceStart;
+		// Position of the next source sample within the span
+		int sourceReadPosition = 0;
+		// Output of the resonator bank, enveloped by the windows of the playing grains
+		float playResonators(float* bus);
+		// Analysis cache of the song (nullptr if there is none yet)
+		std::atomic<AnalysisCache*> sourceAnalysis;
+		
+		// Scanning notes (see setScanRate()): the buffer is a ring of bufferLength samples, sample s since noteOn
+		// is at s % bufferLength. Hop h is masked from song frame scanFirstFrame + h (looped over the song)
+		// and only its final hopSize samples go to the ring, so every hop costs the same however long the note is held
+		bool scanning = false;
+		float scanRate = 0.0f;
+		int scanFirstFrame = 0;
+		// Position of the scan head since noteOn (audio thread), new grains start at it
+		double scanPosition = 0.0;
+		// Oldest sample since noteOn a playing grain still reads (published by the audio thread):
+		// a hop may only overwrite the samples before it
+		std::atomic<int> oldestNeeded;
+		// Hann window and spectrum of the forward FFT of a song frame (without analysis cache, allocated on first use)
+		std::vector<float> scanWindow;
+		std::vector<ne10_fft_cpx_float32_t> scanSpectrum;
+		// Mask the overtone bins of the next song frame, overlap-add it and move its final samples into the ring
+		// (synthesisMutex must be held)
+		void synthesiseScanHop();
+		// play() for scanning notes: reads the ring at any grain rate
+		float playScanning(float* bus);
+		// play() for grains at fractional read positions (any grain rate other than 1)
+		float playResampled(float* bus);
+		// Sample of the voice buffer in either storage format
+		float sampleAt(int index);
+		// Start a new grain if grainFrequency samples elapsed (shared by both modes)
+		void triggerGrains();
 		
 		// Reference to grain window from render.cpp
 		// This contains the data for one of the four window functions
@@ -74,6 +254,9 @@ class Voice {
 		// (depending on the grainFrequency)
 		int sampleCounter = 0;
 		
+		// Start playing the given grain and calculate its channel gains
+		void startGrain(int grainIdx);
+		
 		// Helper function to find the next non-playing grain sequentially
 		// I.e. always returns the next free grain with the lowest index 
 		int findNextFreeGrainIdx();
@@ -82,11 +265,38 @@ class Voice {
 		int getRandomInRange(int upperLimit);
 		
 		// Timbral configuration
-		// Set of fft bins used in frequency extraction
-		std::set<int> overtones;
+		// Sorted list of the (unique) fft bins used in frequency extraction
+		std::vector<int> overtoneBins;
+		// Values of the overtone bins for every hop, extracted from the grain source
+		// overtoneLines[i * quality.sourceHops + hop] holds bin overtoneBins[i] of the given hop
+		std::vector<ne10_fft_cpx_float32_t> overtoneLines;
 		// Number of overtones to include in frequency extraction process
 		int nOvertones = 20;
 		
+		// Copy the overtone bins of all hops out of the bin-major view of the grain source
+		// (or out of the frames, following the peaks, if snapOvertones is set)
+		void extractOvertones();
+		// Bin of the given overtone (0 = fundamental) of the current frequency for the FFT size of the grain source
+		int nominalBin(int overtone);
+		
+		// Move the overtones onto the peaks of the grain source: overtone i of hop is masked at
+		// overtoneHopBins[i * quality.sourceHops + hop] with the value in overtoneLines at the same index
+		bool snapOvertones = true;
+		std::vector<int> overtoneHopBins;
+		int numSnappedOvertones = 0;
+		// Bins of currentMask set by the last hop (snapOvertones only)
+		std::vector<int> maskedBins;
+		void extractSnappedOvertones();
+		// Recalculate the overtone bins of the current frequency for the FFT size of the grain source
+		// and remove the previous ones from the mask
+		void updateOvertoneBins();
+		// Make room for the overtone lines of the current grain source (synthesisMutex must be held, may allocate)
+		void reserveOvertoneLines();
+		// Number of bins masked in every hop and the bin of mask entry i in hop
+		// (its value is overtoneLines[i * quality.sourceHops + hop])
+		int getNumMaskBins();
+		int getMaskBin(int i, int hop);
+		
 		// Parameters set externally (through changes in the UI)
 		// Grain length in samples
 		int grainLength = 0;
@@ -94,4 +304,16 @@ class Voice {
 		int grainFrequency = 0;
 		// Scatter: [0...100], will pseudorandomly change grain start positions
 		int scatter = 0;
-};
\ No newline at end of file
+		// Pan [-1...1] and spread [0...100], will pseudorandomly change grain positions on the output bus
+		float pan = 0.0f;
+		int spread = 0;
+		// Number of output channels the grains are panned across
+		int numOutputChannels = 1;
+		// Playback rate of new grains and their pseudorandom deviation in cents
+		float playbackRate = 1.0f;
+		float rateJitter = 0.0f;
+		// Interpolation of the fractional read positions
+		InterpolationKernel interpolation = INTERPOLATION_CUBIC;
+};
+
+#endif
@@ -1,12 +1,14 @@
 /***** Window.cpp *****/
 #include "Window.h"
 
-Window::Window(){
+Window::Window()
+	: version (0) {
 	Window(MAX_GRAIN_LENGTH);
 }
 
 // Create a hann window
-Window::Window(int length){
+Window::Window(int length)
+	: version (0) {
 	this->length = length;
 	
 	// Calculate hann window for given length
@@ -59,7 +61,10 @@ void Window::setLength(int length){
 		
 		default:
 			break;
-	}	
+	}
+	
+	// Publish the new window data
+	version.fetch_add(1, std::memory_order_release);
 }
 
 void Window::updateWindow(int length, int type, float modifier){
@@ -74,4 +79,12 @@ float Window::getAt(int index){
 	return window[index];
 }
 
+const float* Window::getData(){
+	return window.data();
+}
+
+int Window::getVersion(){
+	return version.load(std::memory_order_acquire);
+}
+
 Window::~Window(){};
\ No newline at end of file
@@ -5,8 +5,12 @@
  * Only one instance of this will be created in render.cpp 
  * and subsequently passed to all the Voices/Grains
 *****/
+#ifndef WINDOW_H
+#define WINDOW_H
+
 #include <cmath>
 #include <array>
+#include <atomic>
 #include "Constants.h"
 
 class Window {
@@ -32,6 +36,12 @@ class Window {
 		
 		// Getter for window array data at index
 		float getAt(int index);
+		// The window data from index 0 on (for vectorised kernels)
+		const float* getData();
+		
+		// Incremented every time the window data has been recalculated
+		// Used by the voices to invalidate anything derived from the window
+		int getVersion();
 
 		~Window();
 		
@@ -47,4 +57,9 @@ class Window {
 		
 		// Array for windowData
 		std::array<float, MAX_GRAIN_LENGTH> window = {};
+		
+		// Version of the window data (see getVersion())
+		std::atomic<int> version;
 };
+
+#endif
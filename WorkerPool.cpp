@@ -0,0 +1,122 @@
+/***** WorkerPool.cpp *****/
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+WorkerPool::WorkerPool(int numThreads, int priority) : stop (false), next (0) {
+	if(numThreads < 0)
+		numThreads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)) - 1;
+	pthread_mutexattr_t mutexAttributes;
+	pthread_mutexattr_init(&mutexAttributes);
+	pthread_mutexattr_setprotocol(&mutexAttributes, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&runMutex, &mutexAttributes);
+	pthread_mutexattr_destroy(&mutexAttributes);
+	sem_init(&wake, 0, 0);
+	sem_init(&done, 0, 0);
+
+	// Reserved, the helpers keep a pointer to their entry
+	helpers.reserve(numThreads);
+	for(int i = 0; i < numThreads; i++){
+		helpers.push_back({ this, i + 1, pthread_t() });
+		Helper& helper = helpers.back();
+		int result = -1;
+		if(priority > 0){
+			pthread_attr_t attributes;
+			pthread_attr_init(&attributes);
+			pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+			pthread_attr_setschedpolicy(&attributes, SCHED_FIFO);
+			struct sched_param parameters = {};
+			parameters.sched_priority = priority;
+			pthread_attr_setschedparam(&attributes, &parameters);
+			result = pthread_create(&helper.thread, &attributes, &WorkerPool::helperEntry, &helper);
+			pthread_attr_destroy(&attributes);
+			if(result != 0 && i == 0)
+				printf("Worker pool: no real-time priority %d (%s), the helpers run as normal threads\n", priority, strerror(result));
+		}
+		if(result != 0)
+			result = pthread_create(&helper.thread, nullptr, &WorkerPool::helperEntry, &helper);
+		if(result != 0){
+			printf("Worker pool: couldn't create helper %d (%s)\n", i + 1, strerror(result));
+			helpers.pop_back();
+			break;
+		}
+	}
+}
+
+int WorkerPool::getNumWorkers(){
+	return helpers.size() + 1;
+}
+
+void WorkerPool::run(int count, const std::function<void(int, int)>& job){
+	if(count <= 0)
+		return;
+	pthread_mutex_lock(&runMutex);
+	// Nothing to share
+	if(helpers.empty() || count == 1){
+		for(int i = 0; i < count; i++){
+			job(0, i);
+		}
+		pthread_mutex_unlock(&runMutex);
+		return;
+	}
+
+	// Every helper of the previous job has posted done, so none of them still reads job or count
+	this->job = &job;
+	this->count = count;
+	next.store(0, std::memory_order_relaxed);
+	// sem_post() publishes the job to the helper it wakes
+	for(size_t i = 0; i < helpers.size(); i++){
+		sem_post(&wake);
+	}
+
+	work(0, job, count);
+
+	// All indices are taken, wait for the helpers still working on theirs
+	for(size_t i = 0; i < helpers.size(); i++){
+		while(sem_wait(&done) != 0){
+		}
+	}
+	this->job = nullptr;
+	pthread_mutex_unlock(&runMutex);
+}
+
+void* WorkerPool::helperEntry(void* helper){
+	Helper* self = (Helper*) helper;
+	self->pool->helper(self->worker);
+	return nullptr;
+}
+
+void WorkerPool::helper(int worker){
+	while(true){
+		// Retried if interrupted by a signal
+		if(sem_wait(&wake) != 0)
+			continue;
+		if(stop.load(std::memory_order_acquire))
+			return;
+		// A helper that is late may take a second post of the same job: the indices are exhausted by then
+		// and it posts done twice, while the other one (which got no post) posts nothing
+		work(worker, *job, count);
+		sem_post(&done);
+	}
+}
+
+void WorkerPool::work(int worker, const std::function<void(int, int)>& job, int count){
+	for(int index = next.fetch_add(1); index < count; index = next.fetch_add(1)){
+		job(worker, index);
+	}
+}
+
+WorkerPool::~WorkerPool(){
+	stop.store(true, std::memory_order_release);
+	for(size_t i = 0; i < helpers.size(); i++){
+		sem_post(&wake);
+	}
+	for(auto& helper : helpers){
+		pthread_join(helper.thread, nullptr);
+	}
+	sem_destroy(&wake);
+	sem_destroy(&done);
+	pthread_mutex_destroy(&runMutex);
+}
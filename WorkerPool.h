@@ -0,0 +1,67 @@
+/*****
+ * WorkerPool.h
+ * Fixed pool of helper threads splitting independent pieces of work (FFT hops, voices) across the cores
+ *
+ * run() hands out the indices of a job through an atomic counter, the calling thread works on
+ * the job as well, so with no helper threads (single core) everything runs on the caller in index order.
+ * The helpers can run as real-time (SCHED_FIFO) threads below the auxiliary tasks calling run(), so they
+ * only use the cores those tasks leave idle and never preempt them; the caller keeps taking indices itself,
+ * so a job always progresses even while the helpers are held up. The handoff uses no locks:
+ * the job is published before the helpers are woken through a semaphore, and run() waits on another one
+ * for each helper to finish (both are real-time safe under Xenomai, unlike a condition variable that
+ * normal threads signal).
+ * Every thread running a job gets its own worker number, so per-thread FFT plans and scratch
+ * buffers can be indexed with it without locking
+*****/
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <semaphore.h>
+
+class WorkerPool {
+	public:
+		// numThreads helper threads in addition to the calling thread (negative: one per core besides the caller)
+		// priority > 0 creates them as SCHED_FIFO threads with that priority (normal threads if that is not allowed),
+		// 0 as normal threads
+		WorkerPool(int numThreads, int priority = 0);
+		~WorkerPool();
+
+		// Number of threads working on a job (the helpers and the caller), i.e. the range of worker numbers
+		int getNumWorkers();
+
+		// Call job(worker, index) for every index in [0, count), returns when all calls are done
+		// worker is the number of the thread making the call: 0 for the caller, 1 ... for the helpers
+		// Calls from several threads are serialised (not for the audio thread: it may wait)
+		void run(int count, const std::function<void(int, int)>& job);
+
+	private:
+		struct Helper {
+			WorkerPool* pool;
+			int worker;
+			pthread_t thread;
+		};
+		std::vector<Helper> helpers;
+		// Serialises run() (priority inheritance, the callers are tasks of different priorities)
+		pthread_mutex_t runMutex;
+
+		// Current job, written before the helpers are woken
+		const std::function<void(int, int)>* job = nullptr;
+		int count = 0;
+		// One post per helper and job, and one post by every helper once it took its last index
+		sem_t wake;
+		sem_t done;
+		std::atomic<bool> stop;
+		// Next index to hand out
+		std::atomic<int> next;
+
+		static void* helperEntry(void* helper);
+		void helper(int worker);
+		// Take indices until the job is exhausted
+		void work(int worker, const std::function<void(int, int)>& job, int count);
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*****
+ * NE10.h (host shim)
+ * The part of the NE10 API the DSP kernels use, for building them on a machine without Bela
+ *
+ * Complex FFTs of power-of-two sizes (iterative radix-2, twiddles computed in double precision)
+ * with the NE10 conventions: forward transform unscaled, inverse transform scaled by 1 / nfft,
+ * the plan is a single allocation released with NE10_FREE. Slower than the NEON code and not
+ * bit-identical to it, so the checks compare paths built against the same FFT
+*****/
+#ifndef NE10_HOST_SHIM_H
+#define NE10_HOST_SHIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef float ne10_float32_t;
+typedef int32_t ne10_int32_t;
+
+typedef struct {
+	ne10_float32_t r;
+	ne10_float32_t i;
+} ne10_fft_cpx_float32_t;
+
+typedef struct {
+	ne10_int32_t nfft;
+	// nfft / 2 twiddles exp(-2 pi i k / nfft), stored behind the state in the same allocation
+	ne10_fft_cpx_float32_t* twiddles;
+} ne10_fft_state_float32_t;
+
+typedef ne10_fft_state_float32_t* ne10_fft_cfg_float32_t;
+
+#define NE10_MALLOC malloc
+#define NE10_FREE(p) free(p)
+
+// Plan for a complex FFT of nfft points, NULL if nfft is not a power of two
+static inline ne10_fft_cfg_float32_t ne10_fft_alloc_c2c_float32_neon(ne10_int32_t nfft){
+	if(nfft < 2 || (nfft & (nfft - 1)) != 0)
+		return NULL;
+	ne10_fft_cfg_float32_t cfg = (ne10_fft_cfg_float32_t) NE10_MALLOC (sizeof(ne10_fft_state_float32_t)
+		+ (nfft / 2) * sizeof(ne10_fft_cpx_float32_t));
+	if(cfg == NULL)
+		return NULL;
+	cfg->nfft = nfft;
+	cfg->twiddles = (ne10_fft_cpx_float32_t*) (cfg + 1);
+	for(ne10_int32_t k = 0; k < nfft / 2; k++){
+		double angle = -2.0 * M_PI * k / nfft;
+		cfg->twiddles[k].r = (ne10_float32_t) cos(angle);
+		cfg->twiddles[k].i = (ne10_float32_t) sin(angle);
+	}
+	return cfg;
+}
+
+// out = FFT of in (inverse_fft = 0) or inverse FFT scaled by 1 / nfft (inverse_fft = 1), out and in must not overlap
+static inline void ne10_fft_c2c_1d_float32_neon(ne10_fft_cpx_float32_t* out, ne10_fft_cpx_float32_t* in,
+	ne10_fft_cfg_float32_t cfg, ne10_int32_t inverse_fft){
+	ne10_int32_t nfft = cfg->nfft;
+	// Bit-reversed copy, then the butterflies in place
+	for(ne10_int32_t n = 0, reversed = 0; n < nfft; n++){
+		out[reversed] = in[n];
+		ne10_int32_t bit = nfft >> 1;
+		for(; reversed & bit; bit >>= 1)
+			reversed ^= bit;
+		reversed |= bit;
+	}
+	ne10_float32_t direction = inverse_fft ? -1.0f : 1.0f;
+	for(ne10_int32_t length = 2; length <= nfft; length <<= 1){
+		ne10_int32_t half = length / 2;
+		ne10_int32_t stride = nfft / length;
+		for(ne10_int32_t start = 0; start < nfft; start += length){
+			for(ne10_int32_t k = 0; k < half; k++){
+				ne10_fft_cpx_float32_t w = cfg->twiddles[k * stride];
+				w.i *= direction;
+				ne10_fft_cpx_float32_t* a = &out[start + k];
+				ne10_fft_cpx_float32_t* b = &out[start + k + half];
+				ne10_float32_t tr = b->r * w.r - b->i * w.i;
+				ne10_float32_t ti = b->r * w.i + b->i * w.r;
+				b->r = a->r - tr;
+				b->i = a->i - ti;
+				a->r += tr;
+				a->i += ti;
+			}
+		}
+	}
+	if(inverse_fft){
+		ne10_float32_t scale = 1.0f / nfft;
+		for(ne10_int32_t n = 0; n < nfft; n++){
+			out[n].r *= scale;
+			out[n].i *= scale;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,27 @@
+/***** verify.cpp *****/
+// Equivalence checks of the DSP kernels (the same as --verify) on a machine without Bela
+// Built by host/Makefile against the NE10 shim in host/libraries, see README.md
+
+#include <cstdio>
+#include <cstring>
+#include "../EquivalenceTest.h"
+
+int main(int argc, char *argv[])
+{
+	// Optional quality tier of the voice checks
+	int tier = DEFAULT_QUALITY_TIER;
+	if(argc > 1){
+		tier = -1;
+		for(int i = 0; i < NUM_QUALITY_TIERS; i++){
+			if(strcmp(argv[1], QUALITY_TIER_NAMES[i]) == 0)
+				tier = i;
+		}
+		if(tier < 0){
+			fprintf(stderr, "Usage: %s [low|medium|high]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	EquivalenceTest equivalenceTest(44100.0f, QUALITY_TIERS[tier]);
+	return equivalenceTest.run(EQUIVALENCE_RANDOM_RUNS) ? 0 : 1;
+}
@@ -33,74 +33,80 @@ The Bela software is distributed under the GNU Lesser General Public License
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <chrono>
+#include <thread>
 #include <libraries/sndfile/sndfile.h>				// to load audio files
 #include "SampleData.h"
 #include <Bela.h>
 #include "Globals.h"
+#include "Resampler.h"
+#include "StressTest.h"
+#include "EquivalenceTest.h"
+#include "Recorder.h"
 
 using namespace std;
 
 // Global variables used by getCurrentTime()
 unsigned long long gFirstSeconds, gFirstMicroseconds;
 
-int FILE_LENGTH1;
-int FILE_LENGTH2;
-int FILE_LENGTH3;
-
-
-
-// Load samples from file
-int initFile(string file, SampleData *smp)
-{
-	SNDFILE *sndfile;
-	SF_INFO sfinfo;
-	sfinfo.format = 0;
-	if (!(sndfile = sf_open (file.c_str(), SFM_READ, &sfinfo))) {
-		cout << "Couldn't open file " << file << ": " << sf_strerror(sndfile) << endl;
-		return 1;
-	}
-
-	int numChan = sfinfo.channels;
-	if(numChan != 1)
-	{
-		cout << "Error: " << file << " is not a mono file" << endl;
-		return 1;
-	}
-
-	smp->sampleLen = sfinfo.frames * numChan;
-	smp->samples = new float[smp->sampleLen];
-	if(smp == NULL){
-		cout << "Could not allocate buffer" << endl;
-		return 1;
-	}
-
-	int subformat = sfinfo.format & SF_FORMAT_SUBMASK;
-	int readcount = sf_read_float(sndfile, smp->samples, smp->sampleLen);
-
-	// Pad with zeros in case we couldn't read whole file
-	for(int k = readcount; k <smp->sampleLen; k++)
-		smp->samples[k] = 0;
-
-	if (subformat == SF_FORMAT_FLOAT || subformat == SF_FORMAT_DOUBLE) {
-		double	scale ;
-		int 	m ;
-
-		sf_command (sndfile, SFC_CALC_SIGNAL_MAX, &scale, sizeof (scale)) ;
-		if (scale < 1e-10)
-			scale = 1.0 ;
-		else
-			scale = 32700.0 / scale ;
-		cout << "File samples scale = " << scale << endl;
-
-		for (m = 0; m < smp->sampleLen; m++)
-			smp->samples[m] *= scale;
-	}
-
-	sf_close(sndfile);
-
-	return 0;
-}
-
+// Library of source songs
+SongLibrary gSongLibrary;
+// Default location of the songs: a manifest listing the files or a directory containing them
+string gSongLocation = "songs.txt";
+// Directory for the decoded float32 song cache files
+string gSongCacheDirectory = "song-cache";
+// Number of threads decoding the song library at startup (0 = one per core)
+int gDecodeThreads = 0;
+// Helper threads for the analysis and the voice synthesis (-1 = one per core besides the calling task)
+int gWorkerThreads = -1;
+
+// Analysis quality tier, set with --quality and --source-hops
+QualityTier gQuality = QUALITY_TIERS[DEFAULT_QUALITY_TIER];
+// Analysis at the resolution of every tier, each register played from the one that fits
+bool gMultiResolution = true;
+// Overtones moved onto the spectral peaks of the grain source, --nominal-overtones keeps the nominal bins
+bool gSnapOvertones = true;
+// Overtone extraction the engines start with, set with --voice-mode
+VoiceMode gVoiceMode = VOICE_MODE_FFT;
+// Interpolation of grains playing at a rate other than 1, set with --interpolation
+InterpolationKernel gInterpolation = INTERPOLATION_CUBIC;
+// Engine instances with their MIDI channel and key range, added with --layer
+vector<EngineRoute> gEngineRoutes;
+// Recording of the output, set with --record, --record-format and --record-rotate
+string gRecordPath = "";
+RecordFormat gRecordFormat = RECORD_FORMAT_WAV;
+float gRecordRotateSeconds = RECORDER_ROTATE_SECONDS;
+
+// Stress test instead of audio: sweep, soak duration in seconds (0 = no soak), seconds per sweep configuration and block budget
+bool gStressSweep = false;
+float gSoakSeconds = 0.0f;
+float gStressSeconds = 1.0f;
+float gStressBudget = 0.5f;
+// Benchmarks to run instead of audio (see StressTest::runBenchmark())
+vector<Benchmark> gBenchmarks;
+// Check the alternate DSP paths against their reference implementations instead of audio
+bool gVerify = false;
+
+// Long options without a short form
+enum {
+	OPT_STRESS = 1000,
+	OPT_SOAK,
+	OPT_STRESS_SECONDS,
+	OPT_STRESS_BUDGET,
+	OPT_SOURCE_HOPS,
+	OPT_SINGLE_RESOLUTION,
+	OPT_VOICE_MODE,
+	OPT_WORKER_THREADS,
+	OPT_STORAGE,
+	OPT_INTERPOLATION,
+	OPT_LAYER,
+	OPT_NOMINAL_OVERTONES,
+	OPT_VERIFY,
+	OPT_BENCHMARK,
+	OPT_RECORD,
+	OPT_RECORD_FORMAT,
+	OPT_RECORD_ROTATE
+};
 
 // Handle Ctrl-C by requesting that the audio rendering stop
 void interrupt_handler(int var)
@@ -115,6 +121,30 @@ void usage(const char * processName)
 
 	Bela_usage();
 
+	cerr << "   --songs [-s] path:          Song manifest (one file per line) or directory of songs (default: songs.txt)\n";
+	cerr << "   --decode-threads [-j] n:    Number of threads decoding the song library at startup (default: one per core)\n";
+	cerr << "   --worker-threads n:         Helper threads for the forward FFTs and the voice synthesis (default: one per core minus one, 0 = none)\n";
+	cerr << "   --resampler-report [-R] rate: Print quality and speed of the resampler converting to rate and exit\n";
+	cerr << "   --quality [-q] tier:        Analysis quality: low (FFT 2048 / hop 512), medium (4096 / 1024) or high (8192 / 2048) (default: medium)\n";
+	cerr << "   --source-hops n:            Number of hops in the grain source span (default: 100)\n";
+	cerr << "   --single-resolution:        Analyse the song with the FFT size of the quality tier only instead of one per register\n";
+	cerr << "   --nominal-overtones:        Mask the overtones at their nominal bins instead of the nearest spectral peak of the source\n";
+	cerr << "   --voice-mode mode:          Overtone extraction of the voices: fft (masked resynthesis) or resonator (bandpass bank, no preparation) (default: fft)\n";
+	cerr << "   --storage format:           Sample format of the voice buffers and spectra: float32, float16 or int16 (block-scaled) (default: float32)\n";
+	cerr << "   --interpolation kernel:     Interpolation of grains played at another pitch: linear, cubic (Hermite) or sinc (windowed, polyphase) (default: cubic)\n";
+	cerr << "   --layer channel[:low-high]: Add an engine instance playing the notes low to high of MIDI channel 1-16 or 'all' (repeat for up to 16 layers, default: one for all)\n";
+	cerr << "   --record path:              Record the output into path-000.wav, path-001.wav, ... (written in the background)\n";
+	cerr << "   --record-format format:     File format of the recording: wav (32 bit float) or flac (24 bit) (default: wav)\n";
+	cerr << "   --record-rotate seconds:    Start a new recording file every given number of seconds, 0 for a single file (default: 1800)\n";
+	cerr << "   --stress:                   Sweep polyphony, grain density, grain length, scatter and overtones without audio and print a capacity table\n";
+	cerr << "   --soak seconds:             Run the heaviest configuration for the given time and check for latency drift and memory growth\n";
+	cerr << "   --stress-seconds s:         Duration of every configuration of the sweep (default: 1)\n";
+	cerr << "   --stress-budget percent:    Share of the block period the render time may use (default: 50)\n";
+	cerr << "   --benchmark name:           Compare variants of the engine playing the same chord (repeat for several): ";
+	for(int i = 0; i < NUM_BENCHMARKS; i++)
+		cerr << (i > 0 ? ", " : "") << BENCHMARK_NAMES[i];
+	cerr << "\n";
+	cerr << "   --verify:                   Compare the alternate DSP paths with their reference implementations (max error, SNR, spectral distance)\n";
 	cerr << "   --help [-h]:                Print this menu\n";
 }
 
@@ -130,41 +160,39 @@ double getCurrentTime(void) {
 	return (double)result / 1000000.0;
 }
 
-// Array of all available source songs
-SampleData songs[3] = {};
-// First song
-string fileName1 = "betti.wav";
-SampleData gSampleData1;
-// Second song
-string fileName2 = "nicefornothing.wav";
-SampleData gSampleData2;
-// Third song
-string fileName3 = "jazzo.wav";
-SampleData gSampleData3;
-
 int main(int argc, char *argv[])
 {
+	auto startupBegin = chrono::steady_clock::now();
 	BelaInitSettings* settings = Bela_InitSettings_alloc();	// Standard audio settings
 	struct timeval tv;
-	string fileName;			// Name of the sample to load
 
 	struct option customOptions[] =
 	{
 		{"help", 0, NULL, 'h'},
-		{"file", 1, NULL, 'f'},
+		{"songs", 1, NULL, 's'},
+		{"decode-threads", 1, NULL, 'j'},
+		{"resampler-report", 1, NULL, 'R'},
+		{"worker-threads", 1, NULL, OPT_WORKER_THREADS},
+		{"quality", 1, NULL, 'q'},
+		{"source-hops", 1, NULL, OPT_SOURCE_HOPS},
+		{"single-resolution", 0, NULL, OPT_SINGLE_RESOLUTION},
+		{"nominal-overtones", 0, NULL, OPT_NOMINAL_OVERTONES},
+		{"voice-mode", 1, NULL, OPT_VOICE_MODE},
+		{"storage", 1, NULL, OPT_STORAGE},
+		{"interpolation", 1, NULL, OPT_INTERPOLATION},
+		{"layer", 1, NULL, OPT_LAYER},
+		{"verify", 0, NULL, OPT_VERIFY},
+		{"benchmark", 1, NULL, OPT_BENCHMARK},
+		{"record", 1, NULL, OPT_RECORD},
+		{"record-format", 1, NULL, OPT_RECORD_FORMAT},
+		{"record-rotate", 1, NULL, OPT_RECORD_ROTATE},
+		{"stress", 0, NULL, OPT_STRESS},
+		{"soak", 1, NULL, OPT_SOAK},
+		{"stress-seconds", 1, NULL, OPT_STRESS_SECONDS},
+		{"stress-budget", 1, NULL, OPT_STRESS_BUDGET},
 		{NULL, 0, NULL, 0}
 	};
 
-	gSampleData1.samples = 0;
-	gSampleData1.sampleLen = -1;
-	
-	gSampleData2.samples = 0;
-	gSampleData2.sampleLen = -1;
-	
-	gSampleData3.samples = 0;
-	gSampleData3.sampleLen = -1;
-	
-
 	// Set default settings
 	Bela_defaultSettings(settings);
 	settings->setup = setup;
@@ -180,7 +208,7 @@ int main(int argc, char *argv[])
 
 	// Parse command-line arguments
 	while (1) {
-		int c = Bela_getopt_long(argc, argv, "hf:", customOptions, settings);
+		int c = Bela_getopt_long(argc, argv, "hs:j:R:q:", customOptions, settings);
 		if (c < 0)
 			break;
 		int ret = -1;
@@ -189,8 +217,163 @@ int main(int argc, char *argv[])
 				usage(basename(argv[0]));
 				ret = 0;
 				break;
-			case 'f':
-				fileName = string((char *)optarg);
+			case 's':
+				gSongLocation = string((char *)optarg);
+				break;
+			case 'j':
+				gDecodeThreads = atoi(optarg);
+				break;
+			case 'R':
+				Resampler::printReport(atoi(optarg));
+				ret = 0;
+				break;
+			case 'q': {
+				int tier = -1;
+				for(int i = 0; i < NUM_QUALITY_TIERS; i++){
+					if(strcmp(optarg, QUALITY_TIER_NAMES[i]) == 0)
+						tier = i;
+				}
+				if(tier < 0){
+					cerr << "Unknown quality tier " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				int sourceHops = gQuality.sourceHops;
+				SampleFormat storage = gQuality.storage;
+				gQuality = QUALITY_TIERS[tier];
+				gQuality.sourceHops = sourceHops;
+				gQuality.storage = storage;
+				break;
+			}
+			case OPT_SOURCE_HOPS:
+				gQuality.sourceHops = atoi(optarg);
+				if(gQuality.sourceHops < MIN_SOURCE_HOPS){
+					cerr << "The grain source needs at least " << MIN_SOURCE_HOPS << " hops" << endl;
+					ret = 1;
+				}
+				break;
+			case OPT_SINGLE_RESOLUTION:
+				gMultiResolution = false;
+				break;
+			case OPT_NOMINAL_OVERTONES:
+				gSnapOvertones = false;
+				break;
+			case OPT_VOICE_MODE: {
+				int mode = -1;
+				for(int i = 0; i < NUM_VOICE_MODES; i++){
+					if(strcmp(optarg, VOICE_MODE_NAMES[i]) == 0)
+						mode = i;
+				}
+				if(mode < 0){
+					cerr << "Unknown voice mode " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				gVoiceMode = VoiceMode(mode);
+				break;
+			}
+			case OPT_STORAGE: {
+				int format = -1;
+				for(int i = 0; i < NUM_SAMPLE_FORMATS; i++){
+					if(strcmp(optarg, SAMPLE_FORMAT_NAMES[i]) == 0)
+						format = i;
+				}
+				if(format < 0){
+					cerr << "Unknown storage format " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				gQuality.storage = SampleFormat(format);
+				break;
+			}
+			case OPT_INTERPOLATION: {
+				int kernel = -1;
+				for(int i = 0; i < NUM_INTERPOLATION_KERNELS; i++){
+					if(strcmp(optarg, INTERPOLATION_KERNEL_NAMES[i]) == 0)
+						kernel = i;
+				}
+				if(kernel < 0){
+					cerr << "Unknown interpolation kernel " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				gInterpolation = InterpolationKernel(kernel);
+				break;
+			}
+			case OPT_RECORD:
+				gRecordPath = optarg;
+				break;
+			case OPT_RECORD_FORMAT: {
+				int format = -1;
+				for(int i = 0; i < NUM_RECORD_FORMATS; i++){
+					if(strcmp(optarg, RECORD_FORMAT_NAMES[i]) == 0)
+						format = i;
+				}
+				if(format < 0){
+					cerr << "Unknown recording format " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				gRecordFormat = RecordFormat(format);
+				break;
+			}
+			case OPT_RECORD_ROTATE:
+				gRecordRotateSeconds = std::max(0.0f, float(atof(optarg)));
+				break;
+			case OPT_LAYER: {
+				// channel[:low-high], channel 1-16 or all
+				EngineRoute route = { -1, 0, 127 };
+				char channel[8] = {};
+				int fields = sscanf(optarg, "%7[^:]:%d-%d", channel, &route.lowestNote, &route.highestNote);
+				bool allChannels = strcmp(channel, "all") == 0;
+				if(!allChannels)
+					route.channel = atoi(channel) - 1;
+				if(fields < 1 || fields == 2 || (!allChannels && route.channel < 0) || route.channel > 15 || route.lowestNote < 0
+				|| route.highestNote > 127 || route.lowestNote > route.highestNote || int(gEngineRoutes.size()) >= MAX_ENGINES){
+					cerr << "Invalid layer " << optarg << endl;
+					usage(basename(argv[0]));
+					ret = 1;
+					break;
+				}
+				gEngineRoutes.push_back(route);
+				break;
+			}
+			case OPT_WORKER_THREADS:
+				gWorkerThreads = atoi(optarg);
+				break;
+			case OPT_VERIFY:
+				gVerify = true;
+				break;
+			case OPT_BENCHMARK: {
+				int benchmark = -1;
+				for(int i = 0; i < NUM_BENCHMARKS; i++){
+					if(strcmp(optarg, BENCHMARK_NAMES[i]) == 0)
+						benchmark = i;
+				}
+				if(benchmark < 0){
+					usage(basename(argv[0]));
+					ret = 1;
+				} else {
+					gBenchmarks.push_back(Benchmark(benchmark));
+				}
+				break;
+			}
+			case OPT_STRESS:
+				gStressSweep = true;
+				break;
+			case OPT_SOAK:
+				gSoakSeconds = atof(optarg);
+				break;
+			case OPT_STRESS_SECONDS:
+				gStressSeconds = atof(optarg);
+				break;
+			case OPT_STRESS_BUDGET:
+				gStressBudget = atof(optarg) * 0.01f;
 				break;
 			default:
 				usage(basename(argv[0]));
@@ -204,42 +387,56 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	// Load files
-	if(initFile(fileName1, &gSampleData1) != 0)
+	// Numerical equivalence checks (no audio device, no songs needed)
+	if(gVerify)
 	{
-		cout << "Error: unable to load samples " << endl;
-		return 1;
+		Bela_InitSettings_free(settings);
+		EquivalenceTest equivalenceTest(44100.0f, gQuality);
+		return equivalenceTest.run(EQUIVALENCE_RANDOM_RUNS) ? 0 : 1;
 	}
-	
-	if(initFile(fileName2, &gSampleData2) != 0)
+
+	// Load test of the engine at the block size given with --period (no audio device, no songs needed)
+	if(gStressSweep || gSoakSeconds > 0.0f || !gBenchmarks.empty())
 	{
-		cout << "Error: unable to load samples " << endl;
-		return 1;
+		StressTest stressTest(settings->periodSize, 44100.0f, gStressBudget, gQuality, gWorkerThreads);
+		Bela_InitSettings_free(settings);
+		bool passed = true;
+		for(auto benchmark : gBenchmarks)
+			passed = stressTest.runBenchmark(benchmark) && passed;
+		if(gStressSweep)
+			passed = stressTest.runSweep(gStressSeconds) && passed;
+		if(gSoakSeconds > 0.0f)
+			passed = stressTest.runSoak(gSoakSeconds) && passed;
+		return passed ? 0 : 1;
 	}
+
+	// Analysis caches of the chosen tier
+	gSongLibrary.setQuality(gQuality);
 	
-	if(initFile(fileName3, &gSampleData3) != 0)
+	// One engine for everything unless layers were given
+	if(gEngineRoutes.empty())
+		gEngineRoutes.push_back({ -1, 0, 127 });
+
+	// Find the songs, fall back to the project directory if there is no manifest
+	if(gSongLibrary.scan(gSongLocation, gSongCacheDirectory) == 0 && gSongLibrary.scan(".", gSongCacheDirectory) == 0)
 	{
-		cout << "Error: unable to load samples " << endl;
+		cout << "Error: no songs found " << endl;
 		return 1;
 	}
-		
-	// Assign FILE_LENGTH for use in render.cpp
-	FILE_LENGTH1 = gSampleData1.sampleLen;
-	FILE_LENGTH2 = gSampleData2.sampleLen;
-	FILE_LENGTH3 = gSampleData3.sampleLen;
-
-	// Assign songs to Array
-	songs[0] = gSampleData1;
-	songs[1] = gSampleData2;
-	songs[2] = gSampleData3;
 	
 	// Initialise the PRU audio device
-	if(Bela_initAudio(settings, &songs) != 0) {
+	// (setup() loads the first song once the audio rate is known, all others are loaded on demand)
+	if(Bela_initAudio(settings, &gSongLibrary) != 0) {
 		Bela_InitSettings_free(settings);
 		cout << "Error: unable to initialise audio" << endl;
 		return 1;
 	}
 	Bela_InitSettings_free(settings);
+	
+	// Decode the rest of the library in the background so that later song changes only map the cache files
+	if(gDecodeThreads <= 0)
+		gDecodeThreads = max(1u, thread::hardware_concurrency());
+	gSongLibrary.prepareAll(gDecodeThreads);
 
 	// Initialise time
 	gettimeofday(&tv, NULL);
@@ -251,6 +448,7 @@ int main(int argc, char *argv[])
 		cout << "Error: unable to start real-time audio" << endl;
 		return 1;
 	}
+	cout << "Time to first audio: " << chrono::duration<double>(chrono::steady_clock::now() - startupBegin).count() << " seconds" << endl;
 
 	// Set up interrupt handler to catch Control-C
 	signal(SIGINT, interrupt_handler);
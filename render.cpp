@@ -6,45 +6,55 @@
 #include <libraries/Midi/Midi.h>
 #include <numeric>
 #include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unistd.h>
 #include <libraries/Gui/Gui.h>
 #include <libraries/GuiController/GuiController.h>
 
 #include "Globals.h"
 #include "SampleData.h"
-#include "Voice.h"
-#include "Lowpass.h"
-#include "Highpass.h"
+#include "Engine.h"
+#include "GrainSource.h"
+#include "GrainPyramid.h"
+#include "GrainSourceCache.h"
+#include "LiveSource.h"
+#include "WorkerPool.h"
+#include "MidiQueue.h"
+#include "Recorder.h"
+#include "Trace.h"
 
 // ---------------------------------- general ----------------------------------------
 // Expose sample rate (in setup()
 int gSampleRate = 0;
-// Which song serves as the source buffer
-// 0 = betti.wav, 1 = nicefornothing.wav, 2 = jazzo.wav
-int currentSong = 0;
+// Song of the library (gSongLibrary) all engines start with
+const int INITIAL_SONG = 0;
 
 // Audio channels
 int numAudioChannels;
+// Channels the grains are panned across (the first MAX_OUTPUT_CHANNELS audio channels)
+int numOutputChannels;
 
-// Main output buffer
-float gOutputBuffer[MAIN_BUFFER_LENGTH];
+// Main output buffer (one frame of MAX_OUTPUT_CHANNELS samples per entry)
+float gOutputBuffer[MAIN_BUFFER_LENGTH][MAX_OUTPUT_CHANNELS];
 int gOutputBufferWritePointer = 0;
 int gOutputBufferReadPointer = 0;
 // ---------------------------------- end general -------------------------------------
 // ---------------------------------- FFT related -------------------------------------
-// Window for the main FFT that creates the grain source frequency domain buffer
-float *gWindowBuffer;
+// Frequency domain representations of the slices the engines play from at several resolutions,
+// each voice plays from the level that fits its register (one level with --single-resolution)
+// Engines on the same slice of the same song share one pyramid
+GrainSourceCache* grainSourceCache = nullptr;
+// Helper threads for the forward FFTs of a source position change and the resynthesis of the voices
+// (the grain source and voice synthesis tasks wait for them, so nothing here runs on the audio thread)
+WorkerPool* workerPool = nullptr;
 
-// Neon params
-ne10_fft_cfg_float32_t cfg;
-
-// Grain src time domain input
-ne10_fft_cpx_float32_t* grainSrcTimeDomainIn;
-
-// Final frequency domain representation of current slice of GRAIN_FFT_INTERVAL FFT hops
-std::array<ne10_fft_cpx_float32_t*, GRAIN_FFT_INTERVAL> grainSrcFrequencyDomain = {};
-
-// Sample info
-SampleData* gSampleData;
+// Live audio input, analysed continuously so it can replace the song as grain source at any time (in any engine)
+LiveSource* liveSource = nullptr;
+// Mono mix of the input channels of the current block
+std::vector<float> liveInputBlock;
+// Whether the input is captured and analysed (only while an engine plays from it)
+bool liveInputCapturing = false;
 
 // ---------------------------------- end FFT related -----------------------------------
 // ---------------------------------- auxiliary tasks -----------------------------------
@@ -54,73 +64,164 @@ AuxiliaryTask updateGrainSrcBufferTask;
 // Auxiliary task for updating the grain window asnchronously
 AuxiliaryTask updateGrainWindowTask;
 
+// Auxiliary task for progressively synthesising the voice buffers ahead of the grains
+AuxiliaryTask voiceSynthesisTask;
+// Set by render() when the voice synthesis task is scheduled, cleared by the task when it is done
+std::atomic<bool> voiceSynthesisScheduled(false);
+
+// Auxiliary task for loading (decoding and mapping) songs of the library in the background
+AuxiliaryTask songLoadTask;
+// Set by render() when the song load task is scheduled, cleared by the task when it is done
+std::atomic<bool> songLoadScheduled(false);
+
+// Auxiliary task rebuilding stale analysis caches of loaded songs (below the song load, so a song change never waits for it)
+AuxiliaryTask analysisRebuildTask;
+// Set by render() when the analysis rebuild task is scheduled, cleared by the task when it is done
+std::atomic<bool> analysisRebuildScheduled(false);
+
+// Auxiliary task for the STFT of the live input (one FFT per completed hop)
+AuxiliaryTask liveAnalysisTask;
+// Set by render() when the live analysis task is scheduled, cleared by the task when it is done
+std::atomic<bool> liveAnalysisScheduled(false);
+
+// Auxiliary task rebuilding the engine for another quality tier or voice mode
+AuxiliaryTask engineRebuildTask;
+// Set by render() when a new tier or voice mode is requested, cleared by the rebuild task when the engine is rebuilt
+// While it is set render() outputs silence and leaves the engine (voices, grain sources) alone
+std::atomic<bool> engineRebuilding(false);
+// Tier the rebuild task switches to (the voice modes are parameters of the engines)
+QualityTier requestedQuality;
+// Number of auxiliary tasks currently using the engine (the rebuild task waits until there are none)
+std::atomic<int> engineTasksRunning(0);
+
+// Auxiliary task sending the window and the meters to the GUI
+AuxiliaryTask guiTelemetryTask;
+// Set by render() when the telemetry task is scheduled, cleared by the task when it is done
+// (render() skips a telemetry frame while the previous one is still being sent, so the GUI always gets the latest state)
+std::atomic<bool> guiTelemetryScheduled(false);
+
+// Recording of the output (only with --record): the output of the current block and the recorder it is copied to,
+// whose auxiliary task writes the files
+Recorder* recorder = nullptr;
+std::vector<float> recordBlock;
+AuxiliaryTask recorderTask;
+std::atomic<bool> recorderScheduled(false);
+
 // Convenience function definitions for running an auxiliary task later
 void processGrainSrcBufferUpdateBackground(void*);
 void processGrainWindowUpdateBackground(void *);
+void processVoiceSynthesisBackground(void *);
+void processSongLoadBackground(void *);
+void processAnalysisRebuildBackground(void *);
+void processLiveAnalysisBackground(void *);
+void processEngineRebuildBackground(void *);
+void processGuiTelemetryBackground(void *);
+void processRecorderBackground(void *);
 // ---------------------------------- end auxiliary tasks --------------------------------
 // ---------------------------------- Voices  --------------------------------------------
 // MIDI object for receiving MIDI data
 Midi midi;
+// Note events from the MIDI thread, applied by render()
+MidiQueue midiQueue;
+// Events of the current block (in arrival order) and how many of them were applied
+MidiEvent blockEvents[MIDI_QUEUE_LENGTH];
+int numBlockEvents = 0;
+int nextBlockEvent = 0;
+// Start time of the previous block, events are placed relative to it one block later
+unsigned long long previousBlockTime = 0;
+
+// Delay from arrival to application of the events (its spread is the timing jitter)
+unsigned long long midiEventsApplied = 0;
+unsigned long long midiDelaySum = 0;
+unsigned long long midiDelayMin = ~0ULL;
+unsigned long long midiDelayMax = 0;
+// Number of frames an event had to wait because its voice was busy
+int midiEventsDeferred = 0;
 
-// Voice indices: An array indicating which voice (default number of voices: 10) currently plays which frequency
-// All voices are initially "not playing", indicated by -1.0f
-float voiceIndices[NUM_VOICES] = { NOT_PLAYING };
-// Vector containing the voice objects (i.e. instances of the Voice class) in the same order as the indices
-std::vector<Voice> voiceObjects = {};
+// Engine instances (layers), one per --layer route, each with its own voices, grain window, filters and parameters
+// Every MIDI event is applied by all engines whose route accepts it and the outputs of all engines are summed
+std::vector<std::unique_ptr<Engine>> engines;
 // ---------------------------------- end Voices -----------------------------------------
 // ---------------------------------- Grain window ---------------------------------------
-// The one grain window used for all grains in all voices (to rule them all)
-Window* grainWindow = nullptr;
-// A corresponding window buffer which can be sent to p5 js to display the current window in the GUI
-float guiWindowBuffer[MAX_GRAIN_LENGTH] = {};
+// The window of the edited engine decimated for the display in the GUI: minimum and maximum of every column
+// (the window is drawn 75 pixels wide, sending all MAX_GRAIN_LENGTH samples on every change flooded the websocket)
+const int GUI_WINDOW_COLUMNS = 75;
+float guiWindowEnvelope[2 * GUI_WINDOW_COLUMNS] = {};
+// Version (incremented on every change) and length in samples of the decimated window, both sent with it
+int guiWindowInfo[2] = {0, 0};
+// Version that was sent last
+int sentWindowVersion = -1;
+// Set by render() to send the current window again (when the GUI connects)
+std::atomic<bool> resendWindow(false);
+// Held while the decimated window is written or sent
+std::mutex guiWindowMutex;
 // ---------------------------------- end grain window -----------------------------------
 // ---------------------------------- GUI related ----------------------------------------
 // Browser-based GUI to adjust system parameters
 Gui gui;
 
-// Current selected position in source file
-int currentSourcePosition = 0;
-// Current scatter of grains in Voices (if greater than 0, will shift start positions of grains)
-int currentScatter = 0;
-// Current grain length in ms (global for all grains)
-int currentGrainLength = 0;
-// Current grain frequency (how often to trigger a grain per second)
-int currentGrainFrequency = 0;
-// Current grain window type (0 = Hann, 1 = Tukey, 2 = Gaussian or 3 = trapezoid)
-int currentWindowType = 0;
-float currentWindowModifier = 0.0f;
-
-// Lowpass filter data
-float currentLowpassCutoff = 20000.0f;
-float currentLowpassQ = 0.707f;
-float currentHighpassCutoff = 30.0f;
-float currentHighpassQ = 0.707f;
-
-// Main output gain
-float mainOutputGain = 5.0f;
-
-// Previous values for GUI parameters
-int prevSourcePosition = 0;
-int prevScatter = 0;
-int prevGrainLength = 0;
-int prevGrainFrequency = 0;
-int prevWindowType = 0;
-float prevWindowModifier = 0.0f;
-float prevLowpassCutoff = 0.0f;
-float prevLowpassQ = 0.0f;
-float prevHighpassCutoff = 0.0f;
-float prevHighpassQ = 0.0f;
+// Engine the GUI controls edit (selected in the GUI)
+int editedEngine = 0;
+
+// Controls as last received from the GUI (as sent, before conversion)
+// A control is only passed to the edited engine when it moves, so selecting another engine
+// does not copy the controls of the previous one over
+struct GuiControls {
+	int sourcePosition;
+	int grainLength;
+	int grainFrequency;
+	int scatter;
+	float outputGain;
+	float windowType;
+	float windowModifier;
+	int song;
+	float lowpassCutoff;
+	float lowpassQ;
+	float highpassCutoff;
+	float highpassQ;
+	int liveInput;
+	float pan;
+	int spread;
+	float pitch;
+	float pitchJitter;
+	int interpolation;
+	int scanRate;
+	int voiceMode;
+};
+GuiControls prevControls = {};
 
 // Flag to set the file length to the gui once at startup
 bool fileLengthSent = false;
 
+// The window and the meters are sent at most at the frame rate of the sketch
+const int GUI_TELEMETRY_RATE = 30;
+// Frames until the next telemetry frame
+int telemetryCountdown = 0;
+// Peak level and number of playing grains of every voice of the edited engine (sent as one buffer)
+float guiMeters[2 * NUM_VOICES] = {};
+
+// Telemetry statistics: frames and bytes sent, frames carrying a new window and the bytes sent in them,
+// time spent in the window and telemetry tasks, and what sending the full window on every change would have cost
+int telemetryFrames = 0;
+int telemetryWindowFrames = 0;
+long long telemetryBytes = 0;
+long long telemetryWindowFrameBytes = 0;
+double windowTaskSeconds = 0.0;
+double telemetryTaskSeconds = 0.0;
+int windowUpdates = 0;
+long long fullWindowBytes = 0;
+
+// Quality tier selected in the GUI (index into QUALITY_TIERS)
+int currentQualityTier = DEFAULT_QUALITY_TIER;
+
 // ---------------------------------- end GUI related -------------------------------------
-// ---------------------------------- Filters ---------------------------------------------
-std::unique_ptr<Lowpass> lowpass;
-std::unique_ptr<Highpass> highpass;
-// ---------------------------------- end Filters------------------------------------------
 // Function definition here to have setup() as the first method in render.cpp
 void midiCallback(MidiChannelMessage message, void* arg);
+void decimateWindow(Engine& engine);
+void allocateAnalysis(float sampleRate);
+void freeAnalysis();
+void processGrainSrcBufferUpdate();
+void recordOutput(int numFrames);
 
 bool setup(BelaContext *context, void *userData)
 {
@@ -132,38 +233,36 @@ bool setup(BelaContext *context, void *userData)
 	if(context->audioInChannels != context->audioOutChannels){
 		printf("Different number of audio outputs and inputs available. Using %d channels.\n", numAudioChannels);
 	}
+	numOutputChannels = std::min(numAudioChannels, MAX_OUTPUT_CHANNELS);
+	if(numOutputChannels < numAudioChannels){
+		printf("Grains are panned across the first %d channels, the others stay silent.\n", numOutputChannels);
+	}
 	
-	// Retrieve songs from main.cpp initAudio() call
-	gSampleData = &songs[0];
-	
-	rt_printf("Sample data length: %4.2f seconds \n", (gSampleData->sampleLen / context->audioSampleRate));
-
-	// Allocate memory for FFT config
-	cfg = ne10_fft_alloc_c2c_float32_neon (N_FFT);
+	// Songs are converted to the audio rate when they are decoded, so the first one is loaded here
+	gSongLibrary.setSampleRate(int(context->audioSampleRate));
+	if(!gSongLibrary.load(INITIAL_SONG)){
+		printf("Error: unable to load samples\n");
+		return false;
+	}
+	// Prefetch its neighbours
+	gSongLibrary.request(INITIAL_SONG);
 	
-	grainSrcTimeDomainIn = (ne10_fft_cpx_float32_t*) NE10_MALLOC (N_FFT * sizeof (ne10_fft_cpx_float32_t));
-	// Initialise grain buffers
-	for (int i = 0; i < GRAIN_FFT_INTERVAL; i++){
-		grainSrcFrequencyDomain[i] = (ne10_fft_cpx_float32_t*) NE10_MALLOC (N_FFT * sizeof (ne10_fft_cpx_float32_t));
+	rt_printf("Sample data length: %4.2f seconds \n", (gSongLibrary.get(INITIAL_SONG)->sampleLen / context->audioSampleRate));
 
-		for (int k = 0; k < N_FFT; k++){
-			grainSrcFrequencyDomain[i][k].r = 0.0f;
-			grainSrcFrequencyDomain[i][k].i = 0.0f;
-		}
+	// FFT config, FFT buffers and grain sources for the quality tier chosen at startup
+	// The helpers run just below the lowest task handing them work (grain-src-update and voice-synthesis, see below),
+	// so they never preempt a task submitting a job; the submitting task works on the job itself meanwhile
+	workerPool = new WorkerPool(gWorkerThreads, 91);
+	rt_printf("Analysis and synthesis on %d threads\n", workerPool->getNumWorkers());
+	allocateAnalysis(context->audioSampleRate);
+	for (int i = 0; i < NUM_QUALITY_TIERS; i++){
+		if(QUALITY_TIERS[i].fftSize == gQuality.fftSize && QUALITY_TIERS[i].hopSize == gQuality.hopSize)
+			currentQualityTier = i;
 	}
+	rt_printf("Voice mode of the engines: %s\n", VOICE_MODE_NAMES[gVoiceMode]);
 	
 	// Allocate output buffer memory
-	memset(gOutputBuffer, 0, MAIN_BUFFER_LENGTH * sizeof(float));
-
-	// Allocate the window buffer based on the FFT size
-	gWindowBuffer = (float *)malloc(N_FFT * sizeof(float));
-	if(gWindowBuffer == 0)
-		return false;
-
-	// Calculate a Hann window
-	for(int n = 0; n < N_FFT; n++) {
-		gWindowBuffer[n] = 0.5f * (1.0f - cosf(2.0f * M_PI * n / (float)(N_FFT - 1)));
-	}
+	memset(gOutputBuffer, 0, sizeof(gOutputBuffer));
 	
 	// Initialise auxiliary task	
 	if((updateGrainSrcBufferTask = Bela_createAuxiliaryTask(&processGrainSrcBufferUpdateBackground, 94, "grain-src-update")) == 0)
@@ -172,6 +271,40 @@ bool setup(BelaContext *context, void *userData)
 	// For async grain window update
 	if((updateGrainWindowTask = Bela_createAuxiliaryTask(&processGrainWindowUpdateBackground, 90, "grain-window-update")) == 0)
 		return false;
+	
+	// For progressive synthesis of the voice buffers
+	if((voiceSynthesisTask = Bela_createAuxiliaryTask(&processVoiceSynthesisBackground, 92, "voice-synthesis")) == 0)
+		return false;
+	
+	// For the live input analysis (has to keep up with the input, so above the voice synthesis)
+	if((liveAnalysisTask = Bela_createAuxiliaryTask(&processLiveAnalysisBackground, 93, "live-analysis")) == 0)
+		return false;
+	liveSource = new LiveSource(gQuality);
+	liveInputBlock.resize(context->audioFrames);
+	
+	// For loading songs of the library (decoding may take seconds, so low priority)
+	if((songLoadTask = Bela_createAuxiliaryTask(&processSongLoadBackground, 10, "song-load")) == 0)
+		return false;
+	
+	// For the analysis caches of the songs (one FFT per hop of a song, so below the song load)
+	if((analysisRebuildTask = Bela_createAuxiliaryTask(&processAnalysisRebuildBackground, 8, "analysis-rebuild")) == 0)
+		return false;
+	
+	// For switching the quality tier or voice mode (waits for the other tasks, so it does not need a high priority)
+	if((engineRebuildTask = Bela_createAuxiliaryTask(&processEngineRebuildBackground, 15, "engine-rebuild")) == 0)
+		return false;
+	
+	// For sending the window and the meters to the GUI (a late frame is only drawn later)
+	if((guiTelemetryTask = Bela_createAuxiliaryTask(&processGuiTelemetryBackground, 20, "gui-telemetry")) == 0)
+		return false;
+	
+	// For writing the recording to disk (the ring holds seconds of output, so lowest priority)
+	if(!gRecordPath.empty()){
+		if((recorderTask = Bela_createAuxiliaryTask(&processRecorderBackground, 5, "recorder")) == 0)
+			return false;
+		recorder = new Recorder(gRecordPath, gRecordFormat, context->audioSampleRate, numOutputChannels, gRecordRotateSeconds);
+		recordBlock.resize(context->audioFrames * numOutputChannels);
+	}
 		
 	// Setup MIDI
 	midi.readFrom(0);
@@ -180,33 +313,33 @@ bool setup(BelaContext *context, void *userData)
 	// Expose audio sample rate
 	gSampleRate = context->audioSampleRate;
 	
-	// Initialise window for grains
-	grainWindow = new Window(MAX_GRAIN_LENGTH);
-	
-	// Initialise GUI window
-	int defaultWindowSize = int(100.0f * 0.001f * gSampleRate);
-	for (int i = 0; i < defaultWindowSize; i++){
-		guiWindowBuffer[i] = grainWindow->getAt(i);
+	// One engine per route, all starting with the defaults of the GUI controls on the first song
+	EngineParameters parameters;
+	parameters.grainLength = int(100.0f * 0.001f * gSampleRate);
+	parameters.grainFrequency = gSampleRate;
+	parameters.interpolation = gInterpolation;
+	parameters.voiceMode = gVoiceMode;
+	for(auto& route : gEngineRoutes){
+		engines.push_back(std::unique_ptr<Engine>(new Engine(gSampleRate, gQuality, numOutputChannels, route,
+			parameters, INITIAL_SONG, liveSource)));
+		engines.back()->updateWindow();
+		engines.back()->takeWindowUpdate();
 	}
+	processGrainSrcBufferUpdate();
+	rt_printf("Quality: FFT size %d, hop size %d, %d hops (%.2f seconds of source), %d analysis resolutions\n", gQuality.fftSize, gQuality.hopSize,
+		gQuality.sourceHops, gQuality.sourceSamples() / context->audioSampleRate, engines[0]->getPyramid()->getNumLevels());
+	rt_printf("%d engine(s)\n", int(engines.size()));
 	
-	// Initialise voices array 
-	for (auto& voice : voiceIndices) {
-		voice = NOT_PLAYING;
-	}
-	
-	// Initialise voice voice objects
-	for (int i = 0; i < NUM_VOICES; i++){
-		Voice* voice = new Voice(gSampleRate, *grainWindow);
-		voiceObjects.push_back(*voice);
-	}
+	// Initialise GUI window
+	decimateWindow(*engines[0]);
 	
 	// Set up the GUI
 	gui.setup(context->projectName);
 	// controller.setup(&gui, "Controls");	
 	
 	// Notifiers (Bela to p5.js)
-	gui.setBuffer('f', MAX_GRAIN_LENGTH); // index 0 is used to send the grain window data to the GUI for rendering
-	gui.setBuffer('d', 2); // index 1 is to indicate whether the window has changed and sends 1/0 for changed and the new length of the window
+	gui.setBuffer('f', 2 * GUI_WINDOW_COLUMNS); // index 0 is used to send the decimated grain window (minimum and maximum per column) to the GUI for rendering
+	gui.setBuffer('d', 2); // index 1 sends the version of the window (incremented on every change) and its length in samples
 	
 	// Incoming values from p5.js
 	gui.setBuffer('d', 1); // index 2: Source position (in samples)
@@ -232,90 +365,415 @@ bool setup(BelaContext *context, void *userData)
 	// Buffer for highpass filter cutoff frequency and q
 	gui.setBuffer('f', 2); // index 11
 	
-	// Setup filters
-	lowpass.reset(new Lowpass(float(gSampleRate)));
-	highpass.reset(new Highpass(float(gSampleRate)));
+	// Notifier for the number of songs in the library (to enable previous / next song selection)
+	gui.setBuffer('d', 1); // index 12
+	
+	// Buffer for receiving the grain source selection (0 = song, 1 = live input)
+	gui.setBuffer('d', 1); // index 13
+	
+	// Buffer for receiving the quality tier (index into QUALITY_TIERS + 1, 0 until a tier is chosen in the GUI)
+	gui.setBuffer('d', 1); // index 14
+	
+	// Notifier for the quality tier in use (to initialise the quality selection)
+	gui.setBuffer('d', 1); // index 15
+	
+	// Buffer for receiving the voice mode (VOICE_MODE_FFT / VOICE_MODE_RESONATOR + 1, 0 until a mode is chosen in the GUI)
+	gui.setBuffer('d', 1); // index 16
+	
+	// Notifier for the voice mode in use (to initialise the voice mode selection)
+	gui.setBuffer('d', 1); // index 17
+	
+	// Buffer for receiving the grain pan position [-1...1]
+	gui.setBuffer('f', 1); // index 18
+	
+	// Buffer for receiving the grain spread [0...100]
+	gui.setBuffer('d', 1); // index 19
+	
+	// Buffer for receiving the grain pitch in semitones [-24...24]
+	gui.setBuffer('f', 1); // index 20
+	
+	// Buffer for receiving the grain pitch jitter in cents [0...100]
+	gui.setBuffer('f', 1); // index 21
+	
+	// Buffer for receiving the interpolation kernel (INTERPOLATION_LINEAR / CUBIC / SINC + 1, 0 until one is chosen in the GUI)
+	gui.setBuffer('d', 1); // index 22
+	
+	// Notifier for the interpolation kernel in use (to initialise the interpolation selection)
+	gui.setBuffer('d', 1); // index 23
+	
+	// Buffer for receiving the engine the controls edit (index + 1, 0 until one is chosen in the GUI)
+	gui.setBuffer('d', 1); // index 24
+	
+	// Notifier for the number of engines (to fill the engine selection)
+	gui.setBuffer('d', 1); // index 25
+	
+	// Notifier for the meters of the edited engine: peak level of every voice since the last frame, then its number of playing grains
+	gui.setBuffer('f', 2 * NUM_VOICES); // index 26
+	
+	// Buffer for receiving the scan rate in percent of the song speed [0...400]
+	gui.setBuffer('d', 1); // index 27
 	
 	return true;
 }
 
+/*
+ * Allocate the grain source cache for gQuality (the pyramids with their FFT configs, windows and grain sources
+ * are allocated by the grain source task as the engines need them)
+*/
+void allocateAnalysis(float sampleRate){
+	grainSourceCache = new GrainSourceCache(gQuality, sampleRate, gMultiResolution, *workerPool);
+}
+
+/*
+ * Release what allocateAnalysis() allocated
+*/
+void freeAnalysis(){
+	// Memory for the grain source frames
+	delete grainSourceCache;
+	grainSourceCache = nullptr;
+}
+
 /* 
- * Updates the grain source buffer by creating a frequency domain representation 
- * of the current window in the source material.
- * The new window data is then passed to all playing voices (the other voices mask it dynamically on noteOn events)
+ * Updates the grain source buffers by creating a frequency domain representation 
+ * of the current window in the source material of every engine.
+ * Engines on the same slice of the same song share one pyramid (see GrainSourceCache), which is analysed once.
+ * Only the pyramid levels that playing voices use (or that were requested by a noteOn) are analysed,
+ * the others wait until a note in their register arrives.
+ * The new window data is then passed to the playing voices (the other voices mask it dynamically on noteOn events)
+ * Resonator voices filter the samples of the slice directly, so there is nothing to analyse for them
+ * (scanning notes start their scan at the slice, see Voice::setScanRate())
+ * The work is Engine::updateGrainSources(), which the stress test runs too
 */
-void processGrainSrcBufferUpdate(int startIdx){
-	// Copy part of sample buffer into FFT input from given start index
-	for (int hop = 0; hop < GRAIN_FFT_INTERVAL; hop++){
-		int currentStart = hop * FFT_HOP_SIZE;
-		for(int n = 0; n < N_FFT; n++) {
-			grainSrcTimeDomainIn[n].r = (ne10_float32_t) (gSampleData->samples[startIdx + currentStart + n] * gWindowBuffer[n]);
-			grainSrcTimeDomainIn[n].i = 0;
+void processGrainSrcBufferUpdate(){
+	Engine::updateGrainSources(engines, *grainSourceCache);
+	rt_printf("Done updating grain source buffer \n");
+}
+
+/*
+ * Triggered via the UI. Updates the windows used to control amplitudes of all grains of the engines they changed in.
+ * The window of the edited engine is decimated for the GUI, the telemetry task sends it with its next frame.
+*/
+void processGrainWindowUpdate(){
+	auto start = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < engines.size(); i++){
+		if(!engines[i]->takeWindowUpdate())
+			continue;
+		engines[i]->updateWindow();
+		if(int(i) == editedEngine)
+			decimateWindow(*engines[i]);
+	}
+	std::lock_guard<std::mutex> lock(guiWindowMutex);
+	windowTaskSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Reduce the window of an engine to the minimum and maximum of every GUI_WINDOW_COLUMNS column
+*/
+void decimateWindow(Engine& engine){
+	int windowLength = engine.getWindowLength();
+	float envelope[2 * GUI_WINDOW_COLUMNS];
+	for(int column = 0; column < GUI_WINDOW_COLUMNS; column++){
+		int first = column * windowLength / GUI_WINDOW_COLUMNS;
+		int last = std::max(first + 1, (column + 1) * windowLength / GUI_WINDOW_COLUMNS);
+		float minimum = engine.getWindow().getAt(std::min(first, windowLength - 1));
+		float maximum = minimum;
+		for(int n = first + 1; n < last && n < windowLength; n++){
+			float value = engine.getWindow().getAt(n);
+			minimum = std::min(minimum, value);
+			maximum = std::max(maximum, value);
 		}
-		
-		// Perform FFT -> indicated by the "0" for the last function parameter 
-		ne10_fft_c2c_1d_float32_neon (grainSrcFrequencyDomain[hop], grainSrcTimeDomainIn, cfg, 0);
+		envelope[2 * column] = minimum;
+		envelope[2 * column + 1] = maximum;
 	}
 	
-	// Update grain source buffer for all playing voices
-	for (int i = 0; i < NUM_VOICES; i++){
-		if(voiceIndices[i] > NOT_PLAYING)
-			voiceObjects[i].updateGrainSrcBuffer(grainSrcFrequencyDomain);
+	std::lock_guard<std::mutex> lock(guiWindowMutex);
+	std::copy(envelope, envelope + 2 * GUI_WINDOW_COLUMNS, guiWindowEnvelope);
+	guiWindowInfo[0]++;
+	guiWindowInfo[1] = windowLength;
+	windowUpdates++;
+	// What the full window dump on every change cost (window, then the changed flag set and cleared)
+	fullWindowBytes += sizeof(float) * MAX_GRAIN_LENGTH + 2 * sizeof(guiWindowInfo);
+}
+
+// ----------------------------- Methods used by auxiliary tasks -----------------------------
+/*
+ * Tasks using the voices or grain sources call beginEngineTask() first and skip their work if it returns false
+ * (the engine is being rebuilt for another quality tier or voice mode), otherwise they call endEngineTask() when they are done
+*/
+bool beginEngineTask(){
+	engineTasksRunning++;
+	if(engineRebuilding){
+		engineTasksRunning--;
+		return false;
+	}
+	return true;
+}
+
+void endEngineTask(){
+	engineTasksRunning--;
+}
+
+void processGrainSrcBufferUpdateBackground(void *){
+	if(!beginEngineTask())
+		return;
+	processGrainSrcBufferUpdate();
+	endEngineTask();
+}
+
+void processGrainWindowUpdateBackground(void *){
+	if(!beginEngineTask())
+		return;
+	processGrainWindowUpdate();
+	endEngineTask();
+}
+
+/*
+ * Prepares all newly triggered voices in one batch (e.g. all notes of a chord arriving in the same block)
+ * and then synthesises the remaining hops of all voice buffers, one hop per voice at a time
+ * so that all playing voices make progress together, several voices per lane-interleaved inverse FFT
+ * (see Engine::synthesise(), which the stress test runs too)
+*/
+void processVoiceSynthesisBackground(void *){
+	if(!beginEngineTask()){
+		voiceSynthesisScheduled = false;
+		return;
 	}
+	Engine::synthesise(engines, *workerPool);
+	endEngineTask();
+	voiceSynthesisScheduled = false;
+}
+
+/*
+ * Send one telemetry frame: the meters and, if it changed since the last frame, the decimated window
+*/
+void processGuiTelemetryBackground(void *){
+	auto start = std::chrono::steady_clock::now();
+	int bytes = sizeof(guiMeters);
+	gui.sendBuffer(26, guiMeters);
 	
-	rt_printf("Done updating grain source buffer \n");
+	std::lock_guard<std::mutex> lock(guiWindowMutex);
+	bool windowChanged = resendWindow.exchange(false) || guiWindowInfo[0] != sentWindowVersion;
+	if(windowChanged){
+		gui.sendBuffer(0, guiWindowEnvelope);
+		gui.sendBuffer(1, guiWindowInfo);
+		sentWindowVersion = guiWindowInfo[0];
+		bytes += sizeof(guiWindowEnvelope) + sizeof(guiWindowInfo);
+	}
+	
+	telemetryFrames++;
+	telemetryBytes += bytes;
+	if(windowChanged){
+		telemetryWindowFrames++;
+		telemetryWindowFrameBytes += bytes;
+	}
+	telemetryTaskSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	guiTelemetryScheduled = false;
+}
+
+void processSongLoadBackground(void *){
+	gSongLibrary.processRequests();
+	songLoadScheduled = false;
+}
+
+void processAnalysisRebuildBackground(void *){
+	gSongLibrary.processAnalyses();
+	analysisRebuildScheduled = false;
+}
+
+void processLiveAnalysisBackground(void *){
+	if(!beginEngineTask()){
+		liveAnalysisScheduled = false;
+		return;
+	}
+	TRACE_SCOPE("live-analysis");
+	liveSource->analysePendingFrames();
+	endEngineTask();
+	liveAnalysisScheduled = false;
 }
 
 /*
- * Triggered via the UI. Updates the window used to control amplitudes of all grains.
- * Sends updated window back to UI.
+ * Rebuild the engines for requestedQuality: FFT buffers, grain sources, live analysis and voices are
+ * reallocated with the new sizes and the analysis caches of the songs switch to the new tier
+ * If only the voice mode of some engines changed, just their voices are recreated and the rest is kept
+ * render() outputs silence (and keeps the MIDI events queued) until the rebuild is done, the notes that were
+ * playing in the rebuilt engines are released
 */
-void processGrainWindowUpdate(){
-	// Update grain window type (also sets length)
-	grainWindow->updateWindow(currentGrainLength, currentWindowType, currentWindowModifier);
+void processEngineRebuildBackground(void *){
+	// Wait for the tasks that were already running when the rebuild was requested
+	while(engineTasksRunning > 0){
+		usleep(1000);
+	}
+	auto start = std::chrono::steady_clock::now();
 	
-	// Adjust grains to new length
-	for(Voice& voice : voiceObjects){
-		voice.setGrainLength(currentGrainLength);
+	bool qualityChanged = requestedQuality.fftSize != gQuality.fftSize || requestedQuality.hopSize != gQuality.hopSize;
+	if(qualityChanged){
+		freeAnalysis();
+		delete liveSource;
+		gQuality = requestedQuality;
+		gSongLibrary.setQuality(gQuality);
+		allocateAnalysis(gSampleRate);
+		liveSource = new LiveSource(gQuality);
 	}
+	for(unsigned int i = 0; i < engines.size(); i++){
+		bool modeChanged = engines[i]->getParameters().voiceMode != engines[i]->getVoiceMode();
+		if(qualityChanged)
+			engines[i]->rebuild(gQuality, liveSource);
+		else if(modeChanged)
+			engines[i]->rebuildVoices();
+		if(modeChanged)
+			rt_printf("Voice mode of engine %d: %s \n", i + 1, VOICE_MODE_NAMES[engines[i]->getVoiceMode()]);
+	}
+	
+	// Grain length of the new voices and the grain sources of the current source positions
+	processGrainWindowUpdate();
+	processGrainSrcBufferUpdate();
 	
-	for (int i = 0; i < currentGrainLength; i++){
-		guiWindowBuffer[i] = grainWindow->getAt(i);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	rt_printf("Quality: FFT size %d, hop size %d, %d hops (rebuilt in %.3f seconds)\n", gQuality.fftSize, gQuality.hopSize,
+		gQuality.sourceHops, seconds);
+	
+	// Hand the engine back to render()
+	engineRebuilding.store(false, std::memory_order_release);
+}
+// ----------------------------- end methods used by auxiliary tasks -----------------------------
+
+/*
+ * Take the MIDI events that arrived during the previous block and assign each one the frame
+ * of this block that corresponds to its arrival time
+ * Events that could not be applied in the previous block stay at the front (at frame 0)
+*/
+void collectMidiEvents(int numAudioFrames, unsigned long long blockTime){
+	int remaining = numBlockEvents - nextBlockEvent;
+	for (int i = 0; i < remaining; i++){
+		blockEvents[i] = blockEvents[nextBlockEvent + i];
+		blockEvents[i].frameOffset = 0;
 	}
+	numBlockEvents = remaining;
+	nextBlockEvent = 0;
 	
-	// Send update to GUI
-	int windowChanged[2] = {1, currentGrainLength};
-	gui.sendBuffer(1, windowChanged);
-	gui.sendBuffer(0, guiWindowBuffer);
+	MidiEvent event;
+	while(numBlockEvents < MIDI_QUEUE_LENGTH && midiQueue.pop(event)){
+		long long offset = previousBlockTime == 0 || event.timestamp < previousBlockTime ? 0 
+			: (long long)((event.timestamp - previousBlockTime) * 1e-6 * gSampleRate);
+		event.frameOffset = int(std::min<long long>(offset, numAudioFrames - 1));
+		blockEvents[numBlockEvents++] = event;
+	}
+	previousBlockTime = blockTime;
+}
+
+/*
+ * Apply a note event to the voice tables of all engines it is routed to (audio thread only)
+ * Returns false if the voice of an engine is busy and the event has to be retried later
+ * (engines that applied it already are marked in the event and skip it then)
+*/
+bool applyMidiEvent(MidiEvent& event, unsigned long long blockTime, int frame){
+	float frequency = powf(2, (event.note-69)/12.f)*440;
+	bool applied = true;
+	for(unsigned int i = 0; i < engines.size(); i++){
+		if((event.appliedEngines & (1u << i)) || !engines[i]->accepts(event))
+			continue;
+		if(event.velocity > 0){
+			TRACE_SCOPE("noteOn");
+			if(!engines[i]->noteOn(event.note, frequency)){
+				applied = false;
+				continue;
+			}
+		} else {
+			TRACE_SCOPE("noteOff");
+			engines[i]->noteOff(event.note);
+		}
+		event.appliedEngines |= 1u << i;
+	}
+	if(!applied)
+		return false;
 	
-	// Turn off window length changed again
-	windowChanged[0] = 0;
-	gui.sendBuffer(1, windowChanged);
+	// Time from arrival until the event takes effect in the output
+	unsigned long long appliedTime = blockTime + (unsigned long long)(frame * 1e6 / gSampleRate);
+	unsigned long long delay = appliedTime > event.timestamp ? appliedTime - event.timestamp : 0;
+	midiEventsApplied++;
+	midiDelaySum += delay;
+	midiDelayMin = std::min(midiDelayMin, delay);
+	midiDelayMax = std::max(midiDelayMax, delay);
+	return true;
 }
 
-// ----------------------------- Methods used by auxiliary tasks -----------------------------
-void processGrainSrcBufferUpdateBackground(void *){
-	processGrainSrcBufferUpdate(currentSourcePosition);
+/*
+ * Output silence for the whole block
+*/
+void writeSilence(BelaContext *context){
+	for(unsigned int n = 0; n < context->audioFrames; n++) {
+		for(int channel = 0; channel < numAudioChannels; channel++){
+			audioWrite(context, n, channel, 0.0f);
+		}
+	}
+	// The recording stays in time with the output
+	if(recorder != nullptr){
+		std::fill(recordBlock.begin(), recordBlock.end(), 0.0f);
+		recordOutput(context->audioFrames);
+	}
 }
 
-void processGrainWindowUpdateBackground(void *){
-	processGrainWindowUpdate();
+/*
+ * Pass the output of the block (in recordBlock) to the recorder and wake its writer once a chunk is complete
+ * The recorder only copies into its ring: a full ring drops the block, it never waits for the disk
+*/
+void recordOutput(int numFrames){
+	recorder->write(recordBlock.data(), numFrames);
+	if(recorder->hasPendingChunk() && !recorderScheduled){
+		recorderScheduled = true;
+		Bela_scheduleAuxiliaryTask(recorderTask);
+	}
+}
+
+void processRecorderBackground(void *){
+	// cleanup() may have closed the recorder before a late wake-up ran
+	if(recorder != nullptr)
+		recorder->drain(false);
+	recorderScheduled = false;
 }
-// ----------------------------- end methods used by auxiliary tasks -----------------------------
 
 void render(BelaContext *context, void *userData)
 {
+	TRACE_SCOPE("render");
+	
 	// Get number of audio frames
 	int numAudioFrames = context->audioFrames;
 	
+	// Silence while the engine is rebuilt for another quality tier or voice mode (MIDI events stay in the queue)
+	if(engineRebuilding.load(std::memory_order_acquire)){
+		writeSilence(context);
+		return;
+	}
+	
+	// MIDI events that arrived during the previous block
+	unsigned long long blockTime = MidiQueue::now();
+	collectMidiEvents(numAudioFrames, blockTime);
+	
 	// Send file length of loaded sample ONCE when connected to GUI to initialise source position slider range
+	Engine& edited = *engines[editedEngine];
 	if(gui.isConnected() && !fileLengthSent){
 		rt_printf("Connected to GUI! \n");
-		gui.sendBuffer(7, gSampleData->sampleLen);
+		gui.sendBuffer(7, edited.getSampleData()->sampleLen);
 		fileLengthSent = true;
 		
-		// Send gui window data once
-		gui.sendBuffer(0, guiWindowBuffer);
+		// Send number of songs once
+		int numSongs = gSongLibrary.size();
+		gui.sendBuffer(12, numSongs);
+		
+		// Send the quality tier in use once
+		gui.sendBuffer(15, currentQualityTier);
+		// And the voice mode of the edited engine
+		int voiceMode = edited.getParameters().voiceMode;
+		gui.sendBuffer(17, voiceMode);
+		// And the interpolation kernel
+		int interpolation = edited.getParameters().interpolation;
+		gui.sendBuffer(23, interpolation);
+		// And the number of engines
+		int numEngines = engines.size();
+		gui.sendBuffer(25, numEngines);
+		
+		// Send gui window data with the next telemetry frame
+		resendWindow = true;
 	} else if(!gui.isConnected() && fileLengthSent){
 		fileLengthSent = false;
 	}
@@ -330,187 +788,277 @@ void render(BelaContext *context, void *userData)
 	auto songIDReceiver = gui.getDataBuffer(9);
 	auto lowpassReceiver = gui.getDataBuffer(10);
 	auto highpassReceiver = gui.getDataBuffer(11);
+	auto liveInputReceiver = gui.getDataBuffer(13);
+	auto qualityReceiver = gui.getDataBuffer(14);
+	auto voiceModeReceiver = gui.getDataBuffer(16);
+	auto panReceiver = gui.getDataBuffer(18);
+	auto spreadReceiver = gui.getDataBuffer(19);
+	auto pitchReceiver = gui.getDataBuffer(20);
+	auto pitchJitterReceiver = gui.getDataBuffer(21);
+	auto interpolationReceiver = gui.getDataBuffer(22);
+	auto editedEngineReceiver = gui.getDataBuffer(24);
+	auto scanRateReceiver = gui.getDataBuffer(27);
 	
 	// Unpack values
-	int sourcePosition = *(sourcePositionReceiver.getAsInt());
-	int grainLength = *(grainLengthReceiver.getAsInt());
-	int grainFrequency = *(grainFrequencyReceiver.getAsInt());
-	int grainScatter = *(grainScatterReceiver.getAsInt());
-	float mag = *(mainOutputGainReceiver.getAsFloat());
+	GuiControls controls;
+	controls.sourcePosition = *(sourcePositionReceiver.getAsInt());
+	controls.grainLength = *(grainLengthReceiver.getAsInt());
+	controls.grainFrequency = *(grainFrequencyReceiver.getAsInt());
+	controls.scatter = *(grainScatterReceiver.getAsInt());
+	controls.outputGain = *(mainOutputGainReceiver.getAsFloat());
 	float* windowTypeInput = windowTypeReceiver.getAsFloat();
-	int incomingSongID = *(songIDReceiver.getAsInt());
-	
-	// Set values for lowpass filter
+	controls.windowType = windowTypeInput[0];
+	controls.windowModifier = windowTypeInput[1];
+	controls.song = *(songIDReceiver.getAsInt());
 	float* lowpassData = lowpassReceiver.getAsFloat();
-	currentLowpassCutoff = lowpassData[0];
-	currentLowpassQ = lowpassData[1];
-	
-	// Set values for highpass filter
+	controls.lowpassCutoff = lowpassData[0];
+	controls.lowpassQ = lowpassData[1];
 	float* highpassData = highpassReceiver.getAsFloat();
-	currentHighpassCutoff = highpassData[0];
-	currentHighpassQ = highpassData[1];
+	controls.highpassCutoff = highpassData[0];
+	controls.highpassQ = highpassData[1];
+	controls.liveInput = *(liveInputReceiver.getAsInt());
+	controls.pan = *(panReceiver.getAsFloat());
+	controls.spread = *(spreadReceiver.getAsInt());
+	controls.pitch = *(pitchReceiver.getAsFloat());
+	controls.pitchJitter = *(pitchJitterReceiver.getAsFloat());
+	controls.interpolation = *(interpolationReceiver.getAsInt()) - 1;
+	controls.scanRate = *(scanRateReceiver.getAsInt());
+	controls.voiceMode = *(voiceModeReceiver.getAsInt()) - 1;
+	int incomingQualityTier = *(qualityReceiver.getAsInt()) - 1;
+	int incomingEditedEngine = *(editedEngineReceiver.getAsInt()) - 1;
 	
+	// Engine the controls edit from now on: show its song length, voice mode and window
+	if(incomingEditedEngine >= 0 && incomingEditedEngine < int(engines.size()) && incomingEditedEngine != editedEngine){
+		editedEngine = incomingEditedEngine;
+		gui.sendBuffer(7, engines[editedEngine]->getSampleData()->sampleLen);
+		int voiceMode = engines[editedEngine]->getParameters().voiceMode;
+		gui.sendBuffer(17, voiceMode);
+		engines[editedEngine]->requestWindowUpdate();
+		Bela_scheduleAuxiliaryTask(updateGrainWindowTask);
+		rt_printf("Editing engine %d \n", editedEngine + 1);
+	}
+	
+	// Pass the controls that moved to the edited engine
+	EngineParameters& parameters = engines[editedEngine]->getParameters();
 	// Where we are in the sample
-	currentSourcePosition = sourcePosition;
+	if(controls.sourcePosition != prevControls.sourcePosition)
+		parameters.sourcePosition = controls.sourcePosition;
 	// Convert grain length from ms to samples and pass to voices
-	currentGrainLength = grainLength == 0 ? 1 : int(float(grainLength) * 0.001f * gSampleRate);
+	if(controls.grainLength != prevControls.grainLength)
+		parameters.grainLength = controls.grainLength == 0 ? 1 : int(float(controls.grainLength) * 0.001f * gSampleRate);
 	// Grain frequency per second
-	currentGrainFrequency = grainFrequency > 0 ? gSampleRate / grainFrequency : 1;
+	if(controls.grainFrequency != prevControls.grainFrequency)
+		parameters.grainFrequency = controls.grainFrequency > 0 ? gSampleRate / controls.grainFrequency : 1;
 	// How scattered the grain start positions should be 
-	currentScatter = grainScatter;	
-	currentWindowType = int(windowTypeInput[0]);
-	currentWindowModifier = windowTypeInput[1];
-	// Main output gain
-	mainOutputGain = mag; 
+	if(controls.scatter != prevControls.scatter)
+		parameters.scatter = controls.scatter;
+	// Where new grains are placed on the output bus
+	if(controls.pan != prevControls.pan)
+		parameters.pan = std::min(1.0f, std::max(-1.0f, controls.pan));
+	if(controls.spread != prevControls.spread)
+		parameters.spread = controls.spread;
+	// Grain playback rate from the pitch in semitones
+	if(controls.pitch != prevControls.pitch)
+		parameters.playbackRate = powf(2.0f, std::min(24.0f, std::max(-24.0f, controls.pitch)) / 12.0f);
+	if(controls.pitchJitter != prevControls.pitchJitter)
+		parameters.rateJitter = std::max(0.0f, controls.pitchJitter);
+	if(controls.interpolation != prevControls.interpolation && controls.interpolation >= 0 && controls.interpolation < NUM_INTERPOLATION_KERNELS)
+		parameters.interpolation = InterpolationKernel(controls.interpolation);
+	// Rate the notes scan through the song
+	if(controls.scanRate != prevControls.scanRate)
+		parameters.scanRate = 0.01f * std::max(0, controls.scanRate);
+	// Overtone extraction, the voices of the engine are recreated for it on the rebuild task
+	if(controls.voiceMode != prevControls.voiceMode && controls.voiceMode >= 0 && controls.voiceMode < NUM_VOICE_MODES)
+		parameters.voiceMode = VoiceMode(controls.voiceMode);
+	if(controls.windowType != prevControls.windowType)
+		parameters.windowType = int(controls.windowType);
+	if(controls.windowModifier != prevControls.windowModifier)
+		parameters.windowModifier = controls.windowModifier;
+	// Filters
+	if(controls.lowpassCutoff != prevControls.lowpassCutoff || controls.lowpassQ != prevControls.lowpassQ){
+		parameters.lowpassCutoff = controls.lowpassCutoff;
+		parameters.lowpassQ = controls.lowpassQ;
+	}
+	if(controls.highpassCutoff != prevControls.highpassCutoff || controls.highpassQ != prevControls.highpassQ){
+		parameters.highpassCutoff = controls.highpassCutoff;
+		parameters.highpassQ = controls.highpassQ;
+	}
+	// Output gain
+	if(controls.outputGain != prevControls.outputGain)
+		parameters.outputGain = controls.outputGain;
+	// Switch the grain source between song and live input, playing voices follow on the grain source task
+	if(controls.liveInput != prevControls.liveInput){
+		parameters.liveInput = controls.liveInput != 0;
+		rt_printf("Grain source of engine %d: %s \n", editedEngine + 1, parameters.liveInput ? "live input" : "song");
+	}
+	// Update source material if changed in the UI
+	if(controls.song != prevControls.song)
+		engines[editedEngine]->requestSong(controls.song);
+	prevControls = controls;
 	
-	// Calculate new filter coefficients if changed
-	if(currentLowpassCutoff != prevLowpassCutoff || currentLowpassQ != prevLowpassQ){
-		lowpass->calculate_coefficients(currentLowpassCutoff, currentLowpassQ);
+	if(gSongLibrary.hasPendingRequests() && !songLoadScheduled){
+		songLoadScheduled = true;
+		Bela_scheduleAuxiliaryTask(songLoadTask);
 	}
-	if(currentHighpassCutoff != prevHighpassCutoff || currentHighpassQ != prevHighpassQ){
-		highpass->calculate_coefficients(currentHighpassCutoff, currentHighpassQ);
+	if(gSongLibrary.hasPendingAnalyses() && !analysisRebuildScheduled){
+		analysisRebuildScheduled = true;
+		Bela_scheduleAuxiliaryTask(analysisRebuildTask);
 	}
 	
-	// Update source material if changed in the UI
-	// This happens when one of the three buttons is clicked
-	if(incomingSongID != currentSong){
-		currentSong = incomingSongID;
-		gSampleData = &songs[currentSong];
-		// Reset pointers
-		gOutputBufferReadPointer = 0;
-		gOutputBufferWritePointer = 0;
-		
-		// Update file length in UI
-		gui.sendBuffer(7, gSampleData->sampleLen);
-		fileLengthSent = true;
-		
-		rt_printf("Song changed to %i \n", currentSong);
+	// Rebuild the engines for another quality tier or voice mode in the background (silent until it is done)
+	bool rebuild = false;
+	requestedQuality = gQuality;
+	if(incomingQualityTier >= 0 && incomingQualityTier < NUM_QUALITY_TIERS && incomingQualityTier != currentQualityTier){
+		currentQualityTier = incomingQualityTier;
+		requestedQuality = QUALITY_TIERS[currentQualityTier];
+		// The source span and the storage format set on the command line are kept
+		requestedQuality.sourceHops = gQuality.sourceHops;
+		requestedQuality.storage = gQuality.storage;
+		rebuild = true;
+		rt_printf("Quality: switching to %s \n", QUALITY_TIER_NAMES[currentQualityTier]);
+	}
+	for(unsigned int i = 0; i < engines.size(); i++){
+		VoiceMode voiceMode = engines[i]->getParameters().voiceMode;
+		if(voiceMode != engines[i]->getVoiceMode()){
+			rebuild = true;
+			rt_printf("Voice mode of engine %d: switching to %s \n", i + 1, VOICE_MODE_NAMES[voiceMode]);
+		}
+	}
+	if(rebuild){
+		engineRebuilding = true;
+		Bela_scheduleAuxiliaryTask(engineRebuildTask);
+		writeSilence(context);
+		return;
 	}
 	
-	// Update voice parameters if changed
-	if(currentScatter != prevScatter){
-		for(Voice& voice : voiceObjects){
-			voice.setScatter(currentScatter);
+	int updates = 0;
+	for(unsigned int i = 0; i < engines.size(); i++){
+		// Switch as soon as the requested song is loaded (just a pointer swap), the grain source follows on its task
+		if(engines[i]->switchSong()){
+			updates |= ENGINE_UPDATE_SOURCE;
+			// Update file length in UI
+			if(int(i) == editedEngine){
+				gui.sendBuffer(7, engines[i]->getSampleData()->sampleLen);
+				fileLengthSent = true;
+			}
+			rt_printf("Song of engine %d changed to %i \n", i + 1, engines[i]->getSong());
 		}
+		// Update voice parameters and filters if changed
+		updates |= engines[i]->applyParameters();
+		// Pyramid levels that playing voices wait for (they did not hold the current slice) are analysed as well
+		if(engines[i]->requestLevels())
+			updates |= ENGINE_UPDATE_SOURCE;
 	}
-	// Update grain window if changed
-	if(currentGrainLength != prevGrainLength 
-	|| currentWindowType != prevWindowType
-	|| currentWindowModifier != prevWindowModifier
-	){
-		// Update grain window asynchronously
+	// Update grain windows asynchronously
+	if(updates & ENGINE_UPDATE_WINDOW)
 		Bela_scheduleAuxiliaryTask(updateGrainWindowTask);
-	}
+	// If a source position or grain source changed, update the grain source buffers
+	if(updates & ENGINE_UPDATE_SOURCE)
+		Bela_scheduleAuxiliaryTask(updateGrainSrcBufferTask);
 	
-	// Update grain frequency (number of grains per second) if changed
-	if(currentGrainFrequency != prevGrainFrequency){
-		for(Voice& voice : voiceObjects){
-			voice.setGrainFrequency(currentGrainFrequency);
+	// Synthesise the voice buffers in the background as far as the grains will read
+	if(!voiceSynthesisScheduled){
+		for(auto& engine : engines){
+			if(engine->needsSynthesis()){
+				voiceSynthesisScheduled = true;
+				Bela_scheduleAuxiliaryTask(voiceSynthesisTask);
+				break;
+			}
 		}
 	}
 	
-	// If source position changed, update the grain source buffer
-	if (currentSourcePosition != prevSourcePosition){
-		Bela_scheduleAuxiliaryTask(updateGrainSrcBufferTask);
+	// The live input is only captured and analysed while an engine plays from it
+	bool liveInputUsed = false;
+	for(auto& engine : engines){
+		liveInputUsed = liveInputUsed || engine->usesLiveInput();
 	}
+	if(!liveInputUsed && liveInputCapturing)
+		liveSource->pause();
+	liveInputCapturing = liveInputUsed;
 
 	for(int n = 0; n < numAudioFrames; n++) {
+		// Apply the MIDI events due at this frame (once one has to wait, all later ones wait too)
+		while(nextBlockEvent < numBlockEvents && blockEvents[nextBlockEvent].frameOffset <= n){
+			if(!applyMidiEvent(blockEvents[nextBlockEvent], blockTime, n)){
+				midiEventsDeferred++;
+				break;
+			}
+			nextBlockEvent++;
+		}
+		
+		// Capture the input (mono mix of all channels) for the live analysis
+		if(liveInputCapturing){
+			float input = 0.0f;
+			for(int channel = 0; channel < numAudioChannels; channel++){
+				input += audioRead(context, n, channel);
+			}
+			liveInputBlock[n] = input / numAudioChannels;
+		}
+		
 		// Write output buffer to sound output
 		for(int channel = 0; channel < numAudioChannels; channel++){
-			audioWrite(context, n, channel, gOutputBuffer[gOutputBufferReadPointer]);
+			audioWrite(context, n, channel, channel < numOutputChannels ? gOutputBuffer[gOutputBufferReadPointer][channel] : 0.0f);
 		}
+		// Keep the frame for the recording
+		if(recorder != nullptr)
+			std::copy(gOutputBuffer[gOutputBufferReadPointer], gOutputBuffer[gOutputBufferReadPointer] + numOutputChannels, &recordBlock[n * numOutputChannels]);
 		
 		// Increment output buffer pointers
-		gOutputBuffer[gOutputBufferReadPointer] = 0;
+		std::fill(gOutputBuffer[gOutputBufferReadPointer], gOutputBuffer[gOutputBufferReadPointer] + MAX_OUTPUT_CHANNELS, 0.0f);
 		gOutputBufferReadPointer++;
 		if(gOutputBufferReadPointer >= MAIN_BUFFER_LENGTH)
 			gOutputBufferReadPointer = 0;
 		gOutputBufferWritePointer++;
 		if(gOutputBufferWritePointer >= MAIN_BUFFER_LENGTH)
 			gOutputBufferWritePointer = 0;
-			
-		// Check if any voice is currently playing
-		int sum = std::accumulate(voiceIndices, voiceIndices + NUM_VOICES, 0);
-		bool allVoicesOff = sum == -1 * NUM_VOICES;
 		
-		// Get grain audio data from voices
-		if(!allVoicesOff){
-			gOutputBuffer[gOutputBufferWritePointer] = 0.0f;
-			for(int voiceIdx = 0; voiceIdx < NUM_VOICES; voiceIdx++){
-				if(voiceIndices[voiceIdx] > NOT_PLAYING){
-					gOutputBuffer[gOutputBufferWritePointer] += voiceObjects[voiceIdx].play();
-				}
-			}
-		} 
-		
-		// Apply filters
-		float out = lowpass->processSample(gOutputBuffer[gOutputBufferWritePointer]);
-		out = highpass->processSample(out);
-		
-		// Apply main output gain
-		gOutputBuffer[gOutputBufferWritePointer] = out * mainOutputGain;
-	}
-	
-	// Update previous state of parameters
-	prevSourcePosition = currentSourcePosition;
-	prevScatter = currentScatter;
-	prevGrainLength = currentGrainLength;
-	prevGrainFrequency = currentGrainFrequency;
-	prevWindowType = currentWindowType;
-	prevWindowModifier = currentWindowModifier;
-	prevLowpassCutoff = currentLowpassCutoff;
-	prevLowpassQ = currentLowpassQ;
-	prevHighpassCutoff = currentLowpassCutoff;
-	prevHighpassQ = currentHighpassQ;
+		// Sum the filtered output of all engines
+		float* frame = gOutputBuffer[gOutputBufferWritePointer];
+		for(auto& engine : engines){
+			engine->process(frame);
+		}
+	}
+	
+	if(recorder != nullptr)
+		recordOutput(numAudioFrames);
+	
+	// Analyse the live input as soon as a hop is complete
+	if(liveInputCapturing)
+		liveSource->write(liveInputBlock.data(), numAudioFrames);
+	if(liveSource->hasPendingFrames() && !liveAnalysisScheduled){
+		liveAnalysisScheduled = true;
+		Bela_scheduleAuxiliaryTask(liveAnalysisTask);
+	}
+	
+	// Telemetry frame for the GUI (the meters keep accumulating while a frame is skipped)
+	telemetryCountdown -= numAudioFrames;
+	if(telemetryCountdown <= 0){
+		telemetryCountdown += gSampleRate / GUI_TELEMETRY_RATE;
+		if(gui.isConnected() && !guiTelemetryScheduled){
+			engines[editedEngine]->takeMeters(guiMeters, guiMeters + NUM_VOICES);
+			guiTelemetryScheduled = true;
+			Bela_scheduleAuxiliaryTask(guiTelemetryTask);
+		}
+	}
 }
 
 /*
  * Handling of MIDI note-on and note-off events
+ * Runs on the MIDI thread: events are only timestamped and queued, render() applies them
 */
 void midiCallback(MidiChannelMessage message, void* arg){
-	// Note on event: Find the next free voice and assign frequency coming from MIDI note
-	if(message.getType() == kmmNoteOn){
-		if(message.getDataByte(1) > 0){
-			int note = message.getDataByte(0);
-			float frequency = powf(2, (note-69)/12.f)*440;
-			
-			// Find free voice and assign
-			for (int i = 0; i < NUM_VOICES; i++){
-				if (voiceIndices[i] == NOT_PLAYING) {
-					// Assign frequency of incoming MIDI note
-					voiceIndices[i] = frequency;
-					// Trigger note on event
-					voiceObjects[i].noteOn(grainSrcFrequencyDomain, frequency, currentGrainLength);
-					
-					// Print note info
-					// rt_printf("\nnote: %d, frequency: %f \n", note, frequency);
-					
-					// Break loop
-					break;
-				}
-			}
-		}
-	}
-	// Note off event: Find voice for incoming frequency and set to NOT_PLAYING
-	if(message.getType() == kmmNoteOff){
-		// Get frequency of incoming note off 
-		int note = message.getDataByte(0);
-		float frequency = powf(2, (note-69)/12.f)*440;
-		
-		// Find the voice that plays this note, remove assignment
-		for (int i = 0; i < NUM_VOICES; i++){
-			if (voiceIndices[i] == frequency) {
-				// Reset voice
-				voiceIndices[i] = NOT_PLAYING;
-				
-				// Trigger note off event
-				voiceObjects[i].noteOff();
-				
-				// Break loop
-				break;
-			}
-		}
-	}
+	if(message.getType() != kmmNoteOn && message.getType() != kmmNoteOff)
+		return;
+	MidiEvent event;
+	event.timestamp = MidiQueue::now();
+	event.channel = message.getChannel();
+	event.note = message.getDataByte(0);
+	// Note off events (and note on events with velocity 0) release the note
+	event.velocity = message.getType() == kmmNoteOn ? message.getDataByte(1) : 0;
+	event.frameOffset = 0;
+	event.appliedEngines = 0;
+	if(!midiQueue.push(event))
+		rt_printf("MIDI queue full, note %d dropped \n", event.note);
 }
 
 /* 
@@ -518,14 +1066,46 @@ void midiCallback(MidiChannelMessage message, void* arg){
 */
 void cleanup(BelaContext *context, void *userData)
 {
-	NE10_FREE(cfg);
-	free(gWindowBuffer);
-	NE10_FREE(grainSrcTimeDomainIn);
+	// Write the recorded timeline (only if built with ENABLE_TRACE)
+	TRACE_WRITE("trace.json");
+	
+	// Analysis cost per register
+	grainSourceCache->printStatistics();
+	freeAnalysis();
+	
+	liveSource->printStatistics(gSampleRate);
+	delete liveSource;
+	
+	// Write the rest of the recording: give a writer pass that is running up to a second to finish,
+	// a wake-up that never ran (the auxiliary tasks are stopped by now) is dropped, close() writes the
+	// whole ring itself (drain() and close() are serialised, so a pass still in progress only delays it)
+	if(recorder != nullptr){
+		for(int waited = 0; recorderScheduled && waited < 1000; waited++){
+			usleep(1000);
+		}
+		recorderScheduled = false;
+		recorder->close();
+		recorder->printStatistics();
+		delete recorder;
+		recorder = nullptr;
+	}
+	delete workerPool;
+	
+	// GUI traffic and task time per second of window changes (slider movement), against full window dumps
+	if(telemetryWindowFrames > 0){
+		double seconds = double(telemetryWindowFrames) / GUI_TELEMETRY_RATE;
+		printf("GUI telemetry: %d frames, %.1f kB sent (%d frames with a new window, %d window changes); per second of window changes: "
+			"%.1f kB sent (full window dumps: %.1f kB), window task %.2f ms, telemetry task %.2f ms\n",
+			telemetryFrames, telemetryBytes * 1e-3, telemetryWindowFrames, windowUpdates, telemetryWindowFrameBytes * 1e-3 / seconds,
+			fullWindowBytes * 1e-3 / seconds, windowTaskSeconds * 1e3 / seconds, telemetryTaskSeconds * 1e3 / telemetryFrames * GUI_TELEMETRY_RATE);
+	}
 	
-	// Memory for frequency domain mask
-	for (int i = 0; i < GRAIN_FFT_INTERVAL; i++){
-		NE10_FREE(grainSrcFrequencyDomain[i]);
+	// Arrival to output delay of the MIDI events, the spread between min and max is the jitter
+	if(midiEventsApplied > 0){
+		printf("MIDI: %llu events, delay min %.2f ms, mean %.2f ms, max %.2f ms (jitter %.2f ms), %d deferred\n",
+			midiEventsApplied, midiDelayMin * 1e-3, (double)midiDelaySum / midiEventsApplied * 1e-3, midiDelayMax * 1e-3,
+			(midiDelayMax - midiDelayMin) * 1e-3, midiEventsDeferred);
 	}
 	
-	delete grainWindow;
+	engines.clear();
 }
\ No newline at end of file
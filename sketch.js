@@ -5,17 +5,22 @@ var guiSketch = new p5(function( sketch ) {
 	// Used to convert sample values to seconds, only for display => all values are still passed expressed in samples
 	let sampleRate = 44100;
 	
-	// Array containing the current grain window data
-    let windowData = 0;
-    // And its length
+	// The current grain window decimated by render.cpp: minimum and maximum of every column
+    let windowData = [];
+    // And its length in samples
     let windowLength = 0;
-    // Whether the window changed, if it changed, redraw it
-    let windowBufferChanged = 0;
+    // Version of the window that windowData holds (render.cpp increments it on every change)
+    let windowVersion = -1;
     
     // Default values for parameters
     let grainLength = 100;
 	let grainFrequency = 1;
 	let grainScatter = 0;
+	let grainPan = 0;
+	let grainSpread = 0;
+	let grainPitch = 0;
+	let grainPitchJitter = 0;
+	let scanRate = 0;
 	let windowTypeMod = 0;
 	let lowpassCutoff = 20000.0;
 	let lowpassQ = 0.707;
@@ -53,11 +58,28 @@ var guiSketch = new p5(function( sketch ) {
 
 	// Flag for checking if length of source file was already set
 	let isSrcFileLengthSet = false;
-	let windowChanged = true;
-	let modChanged = false;
 	
 	// Whether it's the first run
 	let firstRun = true;
+	
+	// Index of the selected song in the song library
+	let currentSong = 0;
+	// Whether the live audio input is used as grain source instead of the song
+	let liveInput = 0;
+	// Analysis quality tiers (same order as QUALITY_TIERS in Constants.h)
+	const qualityTiers = ['Low (FFT 2048)', 'Medium (FFT 4096)', 'High (FFT 8192)'];
+	// Whether the quality select shows the tier render.cpp uses
+	let isQualitySet = false;
+	// Voice modes (same order as VoiceMode in Constants.h)
+	const voiceModes = ['FFT resynthesis', 'Resonator bank'];
+	// Voice mode of the edited layer the select shows (render.cpp sends it on connecting and for every selected layer)
+	let shownVoiceMode = -1;
+	// Interpolation kernels (same order as InterpolationKernel in Constants.h)
+	const interpolationKernels = ['Linear', 'Cubic Hermite', 'Windowed sinc'];
+	// Whether the interpolation select shows the kernel render.cpp uses
+	let isInterpolationSet = false;
+	// Whether the layer select lists the engine instances of render.cpp
+	let isLayerCountSet = false;
 
     sketch.setup = function() {
     	p5.disableFriendlyErrors = true;
@@ -124,6 +146,54 @@ var guiSketch = new p5(function( sketch ) {
 		button.position(sliderX + 144, windowTypeModSliderY + 2 * marginTop);
 		button.mousePressed(loadSong2);
 		
+		// Previous / next song in the library
+		button = sketch.createButton('<');
+		button.position(sliderX + 216, windowTypeModSliderY + 2 * marginTop);
+		button.mousePressed(loadPreviousSong);
+		
+		button = sketch.createButton('>');
+		button.position(sliderX + 248, windowTypeModSliderY + 2 * marginTop);
+		button.mousePressed(loadNextSong);
+		
+		// Live audio input as grain source
+		liveInputButton = sketch.createButton('Live input');
+		liveInputButton.position(sliderX + 280, windowTypeModSliderY + 2 * marginTop);
+		liveInputButton.mousePressed(toggleLiveInput);
+		
+		// Analysis quality (switching rebuilds the engine, playing notes are released)
+		qualitySel = sketch.createSelect();
+		qualitySel.position(sliderX, windowTypeModSliderY + 3 * marginTop);
+		for(let i = 0; i < qualityTiers.length; i++){
+			qualitySel.option(qualityTiers[i]);
+		}
+		qualitySel.selected(qualityTiers[1]);
+		qualitySel.changed(qualityChanged);
+		
+		// Voice mode (switching rebuilds the engine as well)
+		voiceModeSel = sketch.createSelect();
+		voiceModeSel.position(sliderX, windowTypeModSliderY + 4 * marginTop);
+		for(let i = 0; i < voiceModes.length; i++){
+			voiceModeSel.option(voiceModes[i]);
+		}
+		voiceModeSel.selected(voiceModes[0]);
+		voiceModeSel.changed(voiceModeChanged);
+		
+		// Interpolation of grains played at another pitch
+		interpolationSel = sketch.createSelect();
+		interpolationSel.position(sliderX, windowTypeModSliderY + 5 * marginTop);
+		for(let i = 0; i < interpolationKernels.length; i++){
+			interpolationSel.option(interpolationKernels[i]);
+		}
+		interpolationSel.selected(interpolationKernels[1]);
+		interpolationSel.changed(interpolationChanged);
+		
+		// Layer (engine instance) the controls edit, filled once render.cpp sent the number of layers
+		layerSel = sketch.createSelect();
+		layerSel.position(sliderX, windowTypeModSliderY + 6 * marginTop);
+		layerSel.option('Layer 1');
+		layerSel.selected('Layer 1');
+		layerSel.changed(layerChanged);
+		
 		// Filter controls
 		// Lowpass
 		lowpassCutoffSlider = sketch.createSlider(1, 20000.0, 20000.0, 1);
@@ -154,6 +224,39 @@ var guiSketch = new p5(function( sketch ) {
 		
 		highpassDataChanged();
 		
+		// Spatialisation: position of new grains across the output channels and their random spread
+		grainPanSlider = sketch.createSlider(-1, 1, 0, 0.01);
+        grainPanSlider.position(sliderColumn2X, mainOutputGainY + 3 * marginTop);
+		grainPanSlider.style('width', '240px');
+		grainPanSlider.input(grainPanChanged);
+		grainPanChanged();
+		
+		grainSpreadSlider = sketch.createSlider(0, 100, 0, 1);
+        grainSpreadSlider.position(sliderColumn2X, mainOutputGainY + 4 * marginTop);
+		grainSpreadSlider.style('width', '240px');
+		grainSpreadSlider.input(grainSpreadChanged);
+		grainSpreadChanged();
+		
+		// Pitch of the grains in semitones (read rate of the voice buffer) and its random jitter in cents
+		grainPitchSlider = sketch.createSlider(-24, 24, 0, 0.1);
+        grainPitchSlider.position(sliderColumn2X, mainOutputGainY + 5 * marginTop);
+		grainPitchSlider.style('width', '240px');
+		grainPitchSlider.input(grainPitchChanged);
+		grainPitchChanged();
+		
+		grainPitchJitterSlider = sketch.createSlider(0, 100, 0, 1);
+        grainPitchJitterSlider.position(sliderColumn2X, mainOutputGainY + 6 * marginTop);
+		grainPitchJitterSlider.style('width', '240px');
+		grainPitchJitterSlider.input(grainPitchJitterChanged);
+		grainPitchJitterChanged();
+		
+		// Rate the notes scan through the song in percent of the song speed (0 = every grain plays from the slice)
+		scanRateSlider = sketch.createSlider(0, 400, 0, 5);
+        scanRateSlider.position(sliderColumn2X, mainOutputGainY + 7 * marginTop);
+		scanRateSlider.style('width', '240px');
+		scanRateSlider.input(scanRateChanged);
+		scanRateChanged();
+		
 		mainOutputGainChanged();
     };
 
@@ -161,6 +264,29 @@ var guiSketch = new p5(function( sketch ) {
     	// In order to set the range of the source position slider correctly
     	// we wait until render.cpp sends us the file length in samples
     	// (this happens during the first render() call and later if the song is changed in the UI)
+    	// Show the quality tier render.cpp is using (sent once when connected)
+    	if(!isQualitySet && Bela.data.buffers[15] !== undefined && qualityTiers[Bela.data.buffers[15]] !== undefined){
+    		qualitySel.selected(qualityTiers[Bela.data.buffers[15]]);
+    		isQualitySet = true;
+    	}
+    	// Same for the voice mode of the edited layer
+    	if(Bela.data.buffers[17] !== undefined && voiceModes[Bela.data.buffers[17]] !== undefined && Bela.data.buffers[17] != shownVoiceMode){
+    		shownVoiceMode = Bela.data.buffers[17];
+    		voiceModeSel.selected(voiceModes[shownVoiceMode]);
+    	}
+    	// And the interpolation kernel
+    	if(!isInterpolationSet && Bela.data.buffers[23] !== undefined && interpolationKernels[Bela.data.buffers[23]] !== undefined){
+    		interpolationSel.selected(interpolationKernels[Bela.data.buffers[23]]);
+    		isInterpolationSet = true;
+    	}
+    	// And the layers
+    	if(!isLayerCountSet && Bela.data.buffers[25] > 0){
+    		for(let i = 2; i <= Bela.data.buffers[25]; i++){
+    			layerSel.option('Layer ' + i);
+    		}
+    		isLayerCountSet = true;
+    	}
+    	
     	if(!isSrcFileLengthSet && Bela.data.buffers[7] > 0){
     		// Get file length
     		let fileLengthSamples = Bela.data.buffers[7];
@@ -211,6 +337,10 @@ var guiSketch = new p5(function( sketch ) {
 		sketch.text('Window Type', labelX, windowSelY + 14);
 		sketch.text('Window Modifier', labelX, windowTypeModSliderY + sliderHeight);
 		sketch.text('Source Audio Data', labelX, windowTypeModSliderY + 2 * marginTop + 15);
+		sketch.text('Analysis Quality', labelX, windowTypeModSliderY + 3 * marginTop + 14);
+		sketch.text('Voice Mode', labelX, windowTypeModSliderY + 4 * marginTop + 14);
+		sketch.text('Interpolation', labelX, windowTypeModSliderY + 5 * marginTop + 14);
+		sketch.text('Edited Layer', labelX, windowTypeModSliderY + 6 * marginTop + 14);
 		
 		// Filter slider labels
 		sketch.text('Cutoff frequency (Hz)', labelColumn2X, grainLengthY + sliderHeight);
@@ -218,6 +348,13 @@ var guiSketch = new p5(function( sketch ) {
 		// Highpass
 		sketch.text('Cutoff frequency (Hz)', labelColumn2X, mainOutputGainY + sliderHeight);
 		sketch.text('Filter Q', labelColumn2X, mainOutputGainY + marginTop + sliderHeight);
+		// Spatialisation
+		sketch.text('Grain pan', labelColumn2X, mainOutputGainY + 3 * marginTop + sliderHeight);
+		sketch.text('Grain spread', labelColumn2X, mainOutputGainY + 4 * marginTop + sliderHeight);
+		sketch.text('Grain pitch (semitones)', labelColumn2X, mainOutputGainY + 5 * marginTop + sliderHeight);
+		sketch.text('Pitch jitter (cents)', labelColumn2X, mainOutputGainY + 6 * marginTop + sliderHeight);
+		sketch.text('Scan rate (%)', labelColumn2X, mainOutputGainY + 7 * marginTop + sliderHeight);
+		sketch.text('Voices (level, grains)', labelColumn2X, mainOutputGainY + 8 * marginTop + sliderHeight);
 		
         // Get values from sliders
         if(sourcePosSlider !== undefined){
@@ -226,6 +363,11 @@ var guiSketch = new p5(function( sketch ) {
         grainLength = grainLengthSlider.value();
         grainFrequency = grainFrequencySlider.value();
         grainScatter = grainScatterSlider.value();
+        grainPan = grainPanSlider.value();
+        grainSpread = grainSpreadSlider.value();
+        grainPitch = grainPitchSlider.value();
+        grainPitchJitter = grainPitchJitterSlider.value();
+        scanRate = scanRateSlider.value();
         mainOutputGain = mainOutputGainSlider.value();
         windowTypeMod = windowTypeModSlider.value();
         lowpassCutoff = lowpassCutoffSlider.value();
@@ -246,19 +388,25 @@ var guiSketch = new p5(function( sketch ) {
 		sketch.text(lowpassQ, sliderValuesColumn2X, grainFrequencyY + sliderHeight);
 		sketch.text(highpassCutoff, sliderValuesColumn2X, mainOutputGainY + sliderHeight);
 		sketch.text(highpassQ, sliderValuesColumn2X, mainOutputGainY + marginTop + sliderHeight);
+		sketch.text(grainPan.toFixed(2), sliderValuesColumn2X, mainOutputGainY + 3 * marginTop + sliderHeight);
+		sketch.text(grainSpread, sliderValuesColumn2X, mainOutputGainY + 4 * marginTop + sliderHeight);
+		sketch.text(grainPitch.toFixed(1), sliderValuesColumn2X, mainOutputGainY + 5 * marginTop + sliderHeight);
+		sketch.text(grainPitchJitter, sliderValuesColumn2X, mainOutputGainY + 6 * marginTop + sliderHeight);
+		sketch.text(scanRate, sliderValuesColumn2X, mainOutputGainY + 7 * marginTop + sliderHeight);
 		
 		// Draw filter headers
 		sketch.textStyle(sketch.BOLD);
 		sketch.textSize(16);
 		sketch.text("Lowpass", labelColumn2X, sourcePosY + sliderHeight);
 		sketch.text("Highpass", labelColumn2X, grainScatterY + sliderHeight);
+		sketch.text("Space", labelColumn2X, mainOutputGainY + 2 * marginTop + sliderHeight);
 		
-		// Update the grain window rendering if it changed
-		windowBufferChanged = Bela.data.buffers[1];
-		
-		if(windowBufferChanged !== undefined && windowBufferChanged[0] == 1){
-			// Update window length 
-			windowLength = windowBufferChanged[1];
+		// Take the latest grain window (render.cpp sends it at most once per frame)
+		let windowInfo = Bela.data.buffers[1];
+		if(windowInfo !== undefined && Bela.data.buffers[0] !== undefined && windowInfo[0] != windowVersion){
+			windowVersion = windowInfo[0];
+			windowLength = windowInfo[1];
+			windowData = Bela.data.buffers[0].slice();
 		}
 		
 		// Draw filter header
@@ -270,33 +418,11 @@ var guiSketch = new p5(function( sketch ) {
 	    sketch.text("FILTERS", 0,0);
 		sketch.pop();
 		
-		if (Bela.data.buffers[0].length > 0 && windowChanged){
-			windowData = Bela.data.buffers[0].slice(0, windowLength);
-			setTimeout(() => {
-				// Update window data
-				// Slice used here to only include the relevant part of the window
-				// as the window array in C++ is fixed size
-				windowData = Bela.data.buffers[0].slice(0, windowLength);
-				windowLength = Bela.data.buffers[1][1];
-
-				// Draw the current grain window
-				drawWindow();
-				
-				windowChanged = false;
-				
-				// Disable looping
-				console.log(windowLength);
-				console.log("Loop off");
-				sketch.noLoop();
-				
-				
-			}, 300);
-		}
+		// Draw the current grain window
+		drawWindow();
 		
-		if(!windowChanged){
-			// Draw the current grain window
-			drawWindow();
-		}
+		// And the meters of the voices of the edited layer
+		drawMeters();
     };
     
     // Callback functions for parameter changes
@@ -320,10 +446,33 @@ var guiSketch = new p5(function( sketch ) {
     	sketch.redraw();
     }
     
+    function grainPanChanged(){
+    	Bela.data.sendBuffer(18, 'float', grainPan);
+    	sketch.redraw();
+    }
+    
+    function grainSpreadChanged(){
+    	Bela.data.sendBuffer(19, 'int', grainSpread);
+    	sketch.redraw();
+    }
+    
+    function grainPitchChanged(){
+    	Bela.data.sendBuffer(20, 'float', grainPitch);
+    	sketch.redraw();
+    }
+    
+    function grainPitchJitterChanged(){
+    	Bela.data.sendBuffer(21, 'float', grainPitchJitter);
+    	sketch.redraw();
+    }
+    
+    function scanRateChanged(){
+    	Bela.data.sendBuffer(27, 'int', scanRate);
+    	sketch.redraw();
+    }
+    
     function windowTypeModChanged(){
-    	modChanged = true;
     	windowTypeSend();
-    	modChanged = false;
     }
     
     function mainOutputGainChanged(){
@@ -362,29 +511,47 @@ var guiSketch = new p5(function( sketch ) {
 		}
 		
 		Bela.data.sendBuffer(8, 'float', [coded, windowTypeMod]);
-
-		windowChanged = true;
-		// Only loop on select change as mod change calls redraw by itself
-		if(!modChanged){
-			sketch.loop();
-		} else {
-			sketch.redraw();
-		}
+		sketch.redraw();
 	}
     
+    // Helper function to draw the peak level (bar) and number of playing grains of every voice
+    function drawMeters(){
+    	let meters = Bela.data.buffers[26];
+    	if(meters === undefined)
+    		return;
+    	const numVoices = meters.length / 2;
+    	const rootY = mainOutputGainY + 9 * marginTop;
+    	sketch.textSize(10);
+    	for(let i = 0; i < numVoices; i++){
+    		let x = sliderColumn2X + i * 24;
+    		// Levels up to 1 fill the bar
+    		let height = Math.min(1, meters[i]) * 40;
+    		sketch.noStroke();
+    		sketch.fill(220);
+    		sketch.rect(x, rootY - 40, 16, 40);
+    		sketch.fill(meters[numVoices + i] > 0 ? 60 : 160);
+    		sketch.rect(x, rootY - height, 16, height);
+    		sketch.fill(0);
+    		sketch.text(meters[numVoices + i], x + 2, rootY + 12);
+    	}
+    	sketch.textSize(14);
+    }
+    
     // Helper function to draw the current grain window representation
     function drawWindow(){
     	sketch.stroke(0);
     	const rootX = sliderX + 124;
     	const rootY = windowSelY + grainWindowSize;
 
-    	// draw lines
+    	// draw lines through the maxima of the columns, and the range of every column
+    	let columns = windowData.length / 2;
     	let px = rootX;
-    	let py = rootY - (windowData[0] * grainWindowSize);
-    	for(let i = 0; i < windowData.length; i++){
-	    	let x = rootX + i * (grainWindowSize / (windowData.length - 1));
-	    	let y = rootY - (windowData[i] * grainWindowSize);
+    	let py = rootY - (windowData[1] * grainWindowSize);
+    	for(let i = 0; i < columns; i++){
+	    	let x = rootX + i * (grainWindowSize / (columns - 1));
+	    	let y = rootY - (windowData[2 * i + 1] * grainWindowSize);
 	    	sketch.line(px, py, x, y);
+	    	sketch.line(x, rootY - (windowData[2 * i] * grainWindowSize), x, y);
 	    	// Update last position
 	    	px = x;
 	    	py = y;
@@ -402,28 +569,70 @@ var guiSketch = new p5(function( sketch ) {
 	}
 	
 	// Callback functions for loading songs
-	function loadSong0(){
+	function loadSong(index){
+		currentSong = index;
 		isSrcFileLengthSet = false;
 		// Loop until new file length is received
 		sketch.loop();
 		
-		Bela.data.sendBuffer(9, 'int', 0);
+		Bela.data.sendBuffer(9, 'int', index);
+	}
+	
+	function loadSong0(){
+		loadSong(0);
 	}
 	
 	function loadSong1(){
-		isSrcFileLengthSet = false;
-		// Loop until new file length is received
-		sketch.loop();
-		
-		Bela.data.sendBuffer(9, 'int', 1);
+		loadSong(1);
 	}
 	
 	function loadSong2(){
-		isSrcFileLengthSet = false;
-		// Loop until new file length is received
-		sketch.loop();
-		
-		Bela.data.sendBuffer(9, 'int', 2);
+		loadSong(2);
+	}
+	
+	// Step through the whole song library (wraps around)
+	function loadPreviousSong(){
+		let numSongs = Bela.data.buffers[12] > 0 ? Bela.data.buffers[12] : 1;
+		loadSong((currentSong - 1 + numSongs) % numSongs);
+	}
+	
+	function loadNextSong(){
+		let numSongs = Bela.data.buffers[12] > 0 ? Bela.data.buffers[12] : 1;
+		loadSong((currentSong + 1) % numSongs);
+	}
+	
+	// Switch between the song and the live input as grain source
+	function toggleLiveInput(){
+		liveInput = liveInput ? 0 : 1;
+		liveInputButton.html(liveInput ? 'Song' : 'Live input');
+		Bela.data.sendBuffer(13, 'int', liveInput);
+	}
+	
+	// Send the selected quality tier (index + 1, 0 means no tier chosen yet)
+	function qualityChanged(){
+		let tier = qualityTiers.indexOf(qualitySel.value());
+		Bela.data.sendBuffer(14, 'int', tier + 1);
+	}
+	
+	// Send the selected voice mode (index + 1, 0 means no mode chosen yet)
+	function voiceModeChanged(){
+		let mode = voiceModes.indexOf(voiceModeSel.value());
+		Bela.data.sendBuffer(16, 'int', mode + 1);
+	}
+	
+	// Send the selected interpolation kernel (index + 1, 0 means no kernel chosen yet)
+	function interpolationChanged(){
+		let kernel = interpolationKernels.indexOf(interpolationSel.value());
+		Bela.data.sendBuffer(22, 'int', kernel + 1);
+	}
+	
+	// Send the layer the controls edit from now on (index + 1, 0 means no layer chosen yet)
+	// The controls keep their positions, only the ones moved afterwards change the selected layer
+	// The voice mode is reset to none chosen, so choosing the mode of the previous layer changes the new one as well
+	function layerChanged(){
+		let layer = parseInt(layerSel.value().replace('Layer ', ''));
+		Bela.data.sendBuffer(16, 'int', 0);
+		Bela.data.sendBuffer(24, 'int', layer);
 	}
     
 }, 'gui');
\ No newline at end of file